@@ -0,0 +1,188 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file LockContention.cpp
+/// \brief Benchmark of the locks in Threads.h when a 1 kHz writer shares
+/// data with a 60 Hz reader, like a haptic thread and a graphics thread.
+///
+/// A PeriodicThread at 1 kHz locks the shared state in each loop to write
+/// a small update. A PeriodicThread at 60 Hz locks it to copy the whole
+/// state. For each lock type the percentiles of the time the writer waits
+/// for the lock and the number of writer periods missed are reported.
+///
+/// Usage: LockContention [seconds per lock] [shared state size in KB]
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/TimeStamp.h>
+
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace H3DUtil;
+
+namespace LockContentionInternal {
+  const int writer_frequency = 1000;
+  const int reader_frequency = 60;
+
+  // Lock the lock for reading. Only ReadWriteLock lets readers share it.
+  template< class LockType >
+  inline void readLock( LockType &lock ) {
+    lock.lock();
+  }
+
+  template<>
+  inline void readLock< ReadWriteLock >( ReadWriteLock &lock ) {
+    lock.readLock();
+  }
+
+  template< class LockType >
+  struct Benchmark {
+    Benchmark( size_t state_size, double duration ):
+      state( state_size ),
+      reader_copy( state_size ),
+      next_offset( 0 ) {
+      // room for all writer loops, so the writer never allocates.
+      lock_waits.reserve( (size_t)( duration * writer_frequency * 2 ) );
+    }
+
+    LockType lock;
+    std::vector< unsigned char > state;
+    std::vector< unsigned char > reader_copy;
+    // the offset in state of the next update of the writer.
+    size_t next_offset;
+    // the time the writer waited for the lock in each loop, in ns.
+    std::vector< H3DInt64 > lock_waits;
+  };
+
+  // The 1 kHz writer. Writes a small update, e.g. a device position, to
+  // the shared state.
+  template< class LockType >
+  PeriodicThread::CallbackCode writerCallback( void *data ) {
+    Benchmark< LockType > *b = static_cast< Benchmark< LockType > * >( data );
+    unsigned char update[ 64 ];
+    memset( update, (int) b->lock_waits.size(), sizeof( update ) );
+
+    H3DInt64 start = TimeStamp::getMonotonicNanoseconds();
+    b->lock.lock();
+    H3DInt64 locked = TimeStamp::getMonotonicNanoseconds();
+    memcpy( &b->state[ b->next_offset ], update, sizeof( update ) );
+    b->lock.unlock();
+
+    b->next_offset += sizeof( update );
+    if( b->next_offset + sizeof( update ) > b->state.size() )
+      b->next_offset = 0;
+    if( b->lock_waits.size() < b->lock_waits.capacity() )
+      b->lock_waits.push_back( locked - start );
+    return PeriodicThread::CALLBACK_CONTINUE;
+  }
+
+  // The 60 Hz reader. Copies the whole shared state, e.g. to render it.
+  template< class LockType >
+  PeriodicThread::CallbackCode readerCallback( void *data ) {
+    Benchmark< LockType > *b = static_cast< Benchmark< LockType > * >( data );
+    readLock( b->lock );
+    memcpy( &b->reader_copy[0], &b->state[0], b->state.size() );
+    b->lock.unlock();
+    return PeriodicThread::CALLBACK_CONTINUE;
+  }
+
+  // Wait for the given number of seconds.
+  void waitFor( double duration ) {
+    ConditionLock l;
+    H3DInt64 end = TimeStamp::getMonotonicNanoseconds() +
+      (H3DInt64)( duration * 1e9 );
+    l.lock();
+    for( H3DInt64 now = TimeStamp::getMonotonicNanoseconds(); now < end;
+         now = TimeStamp::getMonotonicNanoseconds() ) {
+      l.timedWait( (unsigned int)( ( end - now ) / 1000000 ) + 1 );
+    }
+    l.unlock();
+  }
+
+  // Returns the given percentile of the sorted values, in microseconds.
+  double percentile( const std::vector< H3DInt64 > &sorted, double p ) {
+    if( sorted.empty() ) return 0;
+    size_t i = (size_t)( p * ( sorted.size() - 1 ) + 0.5 );
+    return sorted[i] * 1e-3;
+  }
+
+  template< class LockType >
+  void runBenchmark( const char *name, double duration, size_t state_size ) {
+    Benchmark< LockType > b( state_size, duration );
+
+    unsigned int nr_overruns;
+    {
+      PeriodicThread writer( PeriodicThread::HIGH_PRIORITY,
+                             writer_frequency );
+      PeriodicThread reader( PeriodicThread::NORMAL_PRIORITY,
+                             reader_frequency );
+      H3DInt64 start = TimeStamp::getMonotonicNanoseconds();
+      writer.asynchronousCallback( writerCallback< LockType >, &b );
+      reader.asynchronousCallback( readerCallback< LockType >, &b );
+      waitFor( duration );
+      nr_overruns = writer.getNrOverruns();
+      // the threads stop when destroyed at the end of the block.
+      duration = ( TimeStamp::getMonotonicNanoseconds() - start ) * 1e-9;
+    }
+
+    std::vector< H3DInt64 > waits( b.lock_waits );
+    std::sort( waits.begin(), waits.end() );
+    int expected = (int)( duration * writer_frequency );
+    int missed = expected - (int) waits.size();
+    if( missed < 0 ) missed = 0;
+    printf( "%-18s %7d %7d %8u %8.1f %8.1f %8.1f %8.1f\n",
+            name, (int) waits.size(), missed, nr_overruns,
+            percentile( waits, 0.5 ), percentile( waits, 0.99 ),
+            percentile( waits, 0.999 ),
+            waits.empty() ? 0.0 : waits.back() * 1e-3 );
+  }
+}
+
+int main( int argc, char *argv[] ) {
+  using namespace LockContentionInternal;
+  double duration = argc > 1 ? atof( argv[1] ) : 5;
+  size_t state_size = ( argc > 2 ? (size_t) atoi( argv[2] ) : 4096 ) * 1024;
+  if( duration <= 0 || state_size < 64 ) {
+    printf( "Usage: %s [seconds per lock] [shared state size in KB]\n",
+            argv[0] );
+    return 1;
+  }
+
+  printf( "Writer at %d Hz, reader at %d Hz copying %d KB, %.1f s per lock.\n"
+          "Lock wait times of the writer in microseconds.\n\n",
+          writer_frequency, reader_frequency, (int)( state_size / 1024 ),
+          duration );
+  printf( "%-18s %7s %7s %8s %8s %8s %8s %8s\n",
+          "lock", "writes", "missed", "overruns",
+          "p50", "p99", "p99.9", "max" );
+  runBenchmark< MutexLock >( "MutexLock", duration, state_size );
+  runBenchmark< AdaptiveMutexLock >( "AdaptiveMutexLock", duration,
+                                     state_size );
+  runBenchmark< ReadWriteLock >( "ReadWriteLock", duration, state_size );
+  runBenchmark< TicketLock >( "TicketLock", duration, state_size );
+  return 0;
+}
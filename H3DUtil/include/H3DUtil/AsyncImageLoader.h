@@ -0,0 +1,303 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file AsyncImageLoader.h
+/// \brief Header file for AsyncImageLoader, loading of images in
+/// background threads.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __ASYNCIMAGELOADER_H__
+#define __ASYNCIMAGELOADER_H__
+
+#include <H3DUtil/LoadImageFunctions.h>
+#include <H3DUtil/AutoRef.h>
+#include <H3DUtil/Threads.h>
+#include <set>
+
+namespace H3DUtil {
+
+  /// AsyncImageLoader loads images in a fixed number of background threads
+  /// so that e.g. the rendering thread does not have to stall while large
+  /// volumes are loaded. Each load returns a Handle that can be used to
+  /// check the status and progress of the load, wait for it, change its
+  /// priority or cancel it. Queued loads are started in order of priority
+  /// and loads with the same priority in the order they were added.
+  ///
+  /// Example:
+  /// \code
+  /// AsyncImageLoader loader;
+  /// AsyncImageLoader::Handle h =
+  ///   loader.load( url, AsyncImageLoader::loadDicomSeriesFunc );
+  /// ...
+  /// // each frame
+  /// if( h.isDone() && h.getImage() ) useImage( h.getImage() );
+  /// \endcode
+  class H3DUTIL_API AsyncImageLoader {
+  protected:
+    struct Request;
+
+  public:
+    /// Function type used to load an image.
+    /// \param url The url to load.
+    /// \param progress_func Function the load function can call to report
+    /// its progress. It returns false when the load has been cancelled, in
+    /// which case the load function should stop and return NULL.
+    /// \param progress_data Data to pass to progress_func.
+    /// \param data The data given together with the load function.
+    /// \returns The loaded image or NULL on failure.
+    typedef Image *(*LoadFunc)( const string &url,
+                                LoadImageProgressFunc progress_func,
+                                void *progress_data,
+                                void *data );
+
+    /// The status of a load.
+    typedef enum {
+      /// Waiting for a free thread.
+      QUEUED,
+      /// The image is being loaded.
+      LOADING,
+      /// The image has been loaded.
+      DONE,
+      /// The load function returned NULL.
+      FAILED,
+      /// The load was cancelled.
+      CANCELLED
+    } Status;
+
+    class Handle;
+
+    /// Function type for functions called when a load has finished,
+    /// failed or been cancelled. It is called from the thread that
+    /// finished the load.
+    typedef void (*DoneFunc)( const Handle &handle, void *data );
+
+    /// A Handle is a reference to a load started with AsyncImageLoader.
+    /// Copies of a Handle refer to the same load.
+    class H3DUTIL_API Handle {
+    public:
+      /// Constructor. Creates a Handle that does not refer to any load.
+      Handle();
+
+      /// Copy constructor.
+      Handle( const Handle &h );
+
+      /// Destructor.
+      ~Handle();
+
+      /// Assignment operator.
+      Handle &operator=( const Handle &h );
+
+      /// Returns true if the Handle refers to a load.
+      inline bool isValid() const { return request != NULL; }
+
+      /// Returns the url that is loaded.
+      string getUrl() const;
+
+      /// Returns the status of the load.
+      Status getStatus() const;
+
+      /// Returns true if the load has finished, failed or been cancelled.
+      bool isDone() const;
+
+      /// Returns the progress of the load between 0 and 1 as reported by
+      /// the load function. It is 1 when the load is done.
+      H3DFloat getProgress() const;
+
+      /// Wait until the load is done.
+      void wait() const;
+
+      /// Returns the loaded image or NULL if the load is not done or
+      /// failed. The image is referenced by the load and exists as long as
+      /// any Handle to it exists. Use ref() on it to keep it longer.
+      Image *getImage() const;
+
+      /// Cancel the load. A queued load is removed from the queue. A load
+      /// that has already started is stopped the next time the load
+      /// function reports its progress. Load functions that do not report
+      /// progress are allowed to finish but the image is discarded.
+      /// Returns false if the load was already done.
+      bool cancel();
+
+      /// Change the priority of a queued load.
+      void setPriority( int priority );
+
+    protected:
+      friend class AsyncImageLoader;
+
+      /// Constructor.
+      Handle( Request *_request );
+
+      /// The request the handle refers to.
+      Request *request;
+    };
+
+    /// Constructor.
+    /// \param nr_threads The number of threads used for loading.
+    AsyncImageLoader( unsigned int nr_threads = 2 );
+
+    /// Destructor. Cancels all queued loads and waits for the loads that
+    /// have started to finish.
+    ~AsyncImageLoader();
+
+    /// Start loading an image.
+    /// \param url The url to load.
+    /// \param func The function used to load the url.
+    /// \param func_data Data passed to func.
+    /// \param priority Loads with higher priority are started first.
+    /// \param done_func If not NULL, called when the load is done.
+    /// \param done_data Data passed to done_func.
+    Handle load( const string &url,
+                 LoadFunc func,
+                 void *func_data = NULL,
+                 int priority = 0,
+                 DoneFunc done_func = NULL,
+                 void *done_data = NULL );
+
+    /// Start loading a raw image. See loadRawImage and load.
+    Handle loadRaw( const string &url,
+                    const RawImageInfo &raw_image_info,
+                    int priority = 0,
+                    DoneFunc done_func = NULL,
+                    void *done_data = NULL );
+
+    /// Returns the number of loads waiting for a thread.
+    unsigned int getNrQueued();
+
+#ifdef HAVE_FREEIMAGE
+    /// LoadFunc using loadFreeImage.
+    static Image *loadFreeImageFunc( const string &url,
+                                     LoadImageProgressFunc progress_func,
+                                     void *progress_data,
+                                     void *data );
+#endif
+
+    /// LoadFunc using loadNrrdFile.
+    static Image *loadNrrdFileFunc( const string &url,
+                                    LoadImageProgressFunc progress_func,
+                                    void *progress_data,
+                                    void *data );
+
+#ifdef HAVE_DCMTK
+    /// LoadFunc using loadDicomFile to load a single file.
+    static Image *loadDicomFileFunc( const string &url,
+                                     LoadImageProgressFunc progress_func,
+                                     void *progress_data,
+                                     void *data );
+
+    /// LoadFunc using loadDicomFile to load all files in the same series
+    /// as url.
+    static Image *loadDicomSeriesFunc( const string &url,
+                                       LoadImageProgressFunc progress_func,
+                                       void *progress_data,
+                                       void *data );
+#endif
+
+  protected:
+    /// The state of a load, shared between the loader and its Handles.
+    struct Request {
+      string url;
+      LoadFunc func;
+      void *func_data;
+      DoneFunc done_func;
+      void *done_data;
+      /// Copy of the RawImageInfo for loads started with loadRaw.
+      RawImageInfo *raw_image_info;
+      int priority;
+      /// Order of the request among requests with the same priority.
+      H3DUInt64 sequence_number;
+      /// The loader the request was added to.
+      AsyncImageLoader *loader;
+      /// true while the request is in the queue of loader. Protected by
+      /// the queue_lock of loader.
+      bool queued;
+      /// Protects the members below and is used to wait for the load.
+      ConditionLock lock;
+      Status status;
+      /// true if the request has been cancelled.
+      bool cancelled;
+      H3DFloat progress;
+      AutoRef< Image > image;
+      /// The number of Handles and queue entries using the request.
+      volatile int ref_count;
+    };
+
+    /// Orders requests with the highest priority first.
+    struct RequestOrder {
+      bool operator()( const Request *a, const Request *b ) const {
+        if( a->priority != b->priority ) return a->priority > b->priority;
+        return a->sequence_number < b->sequence_number;
+      }
+    };
+
+    typedef std::set< Request *, RequestOrder > RequestQueue;
+
+    /// Add a request to the queue.
+    Handle addRequest( Request *request );
+
+    /// Decrease the reference count of a request and delete it if unused.
+    static void releaseRequest( Request *request );
+
+    /// Set the result of a request that is done, wake up waiting threads
+    /// and call its done function. The status is CANCELLED if the request
+    /// has been cancelled, otherwise DONE or FAILED depending on if image
+    /// is NULL.
+    static void finishRequest( Request *request, Image *image );
+
+    /// LoadImageProgressFunc updating the progress of a Request. Returns
+    /// false if the request has been cancelled.
+    static bool progressFunc( H3DFloat progress, void *data );
+
+    /// LoadFunc used by loadRaw.
+    static Image *loadRawFunc( const string &url,
+                               LoadImageProgressFunc progress_func,
+                               void *progress_data,
+                               void *data );
+
+    /// The function run by the loading threads.
+    static void *threadFunc( void *data );
+
+    /// The loading threads.
+    std::vector< ThreadBase::ThreadId > threads;
+
+    /// Lock for queue, next_sequence_number and running. Loading threads
+    /// wait on it for new requests.
+    ConditionLock queue_lock;
+
+    /// Requests waiting for a thread.
+    RequestQueue queue;
+
+    /// Sequence number of the next request.
+    H3DUInt64 next_sequence_number;
+
+    /// false when the loader is being destroyed.
+    bool running;
+
+  private:
+    // Not copyable.
+    AsyncImageLoader( const AsyncImageLoader & );
+    AsyncImageLoader &operator=( const AsyncImageLoader & );
+  };
+}
+
+#endif
@@ -0,0 +1,178 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file Atomic.h
+/// \brief Header file for atomic operations used for lock free
+/// communication between threads.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __ATOMIC_H__
+#define __ATOMIC_H__
+
+#include <H3DUtil/H3DUtil.h>
+#include <H3DUtil/H3DBasicTypes.h>
+
+#ifdef H3D_WINDOWS
+#include <intrin.h>
+#endif
+
+namespace H3DUtil {
+
+  /// \ingroup H3DUtilClasses
+  /// \defgroup H3DUtilAtomic Atomic operations
+  /// Atomic operations on integers. The operations are implemented with
+  /// compiler intrinsics and all of them act as full memory barriers.
+
+  /// Namespace containing functions for atomic operations.
+  namespace Atomic {
+
+    /// \ingroup H3DUtilAtomic
+    /// Full memory barrier. No loads or stores are moved across the call,
+    /// neither by the compiler nor by the processor.
+    inline void memoryBarrier() {
+#ifdef H3D_WINDOWS
+      MemoryBarrier();
+#else
+      __sync_synchronize();
+#endif
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Tell the processor that the thread is waiting in a loop for a value
+    /// to change. Call it in each iteration of such loops, it saves power
+    /// and lets the other hardware thread of the core run.
+    inline void pause() {
+#ifdef H3D_WINDOWS
+      YieldProcessor();
+#elif defined( __i386__ ) || defined( __x86_64__ )
+      __builtin_ia32_pause();
+#endif
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Atomically adds value to *v and returns the value *v had before
+    /// the addition.
+    inline int fetchAndAdd( volatile int *v, int value ) {
+#ifdef H3D_WINDOWS
+      return (int)InterlockedExchangeAdd( (volatile LONG *)v, (LONG)value );
+#else
+      return __sync_fetch_and_add( v, value );
+#endif
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Atomically increments *v by one and returns the new value.
+    inline int increment( volatile int *v ) {
+      return fetchAndAdd( v, 1 ) + 1;
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Atomically decrements *v by one and returns the new value.
+    inline int decrement( volatile int *v ) {
+      return fetchAndAdd( v, -1 ) - 1;
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Sets *v to new_value if *v is equal to old_value. Returns true
+    /// if the value was set.
+    inline bool compareAndSwap( volatile int *v,
+                                int old_value,
+                                int new_value ) {
+#ifdef H3D_WINDOWS
+      return InterlockedCompareExchange( (volatile LONG *)v,
+                                         (LONG)new_value,
+                                         (LONG)old_value ) == old_value;
+#else
+      return __sync_bool_compare_and_swap( v, old_value, new_value );
+#endif
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Read the value of *v. Loads and stores after the call will not be
+    /// moved to before it.
+    inline int load( volatile int *v ) {
+      int value = *v;
+      memoryBarrier();
+      return value;
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Set the value of *v. Loads and stores before the call will not be
+    /// moved to after it.
+    inline void store( volatile int *v, int value ) {
+      memoryBarrier();
+      *v = value;
+    }
+
+#ifdef H3DUTIL_INT64
+    /// \ingroup H3DUtilAtomic
+    /// Sets *v to new_value if *v is equal to old_value. Returns true
+    /// if the value was set.
+    inline bool compareAndSwap( volatile H3DInt64 *v,
+                                H3DInt64 old_value,
+                                H3DInt64 new_value ) {
+#ifdef H3D_WINDOWS
+      return _InterlockedCompareExchange64( v,
+                                            new_value,
+                                            old_value ) == old_value;
+#else
+      return __sync_bool_compare_and_swap( v, old_value, new_value );
+#endif
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Atomically adds value to *v and returns the value *v had before
+    /// the addition.
+    inline H3DInt64 fetchAndAdd( volatile H3DInt64 *v, H3DInt64 value ) {
+#ifdef H3D_WINDOWS
+      // InterlockedExchangeAdd64 is not available on 32 bit systems.
+      H3DInt64 old_value;
+      do {
+        old_value = *v;
+      } while( !compareAndSwap( v, old_value, old_value + value ) );
+      return old_value;
+#else
+      return __sync_fetch_and_add( v, value );
+#endif
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Read the value of *v. The read is atomic also on 32 bit systems.
+    inline H3DInt64 load( volatile H3DInt64 *v ) {
+      return fetchAndAdd( v, 0 );
+    }
+
+    /// \ingroup H3DUtilAtomic
+    /// Set the value of *v. The write is atomic also on 32 bit systems.
+    inline void store( volatile H3DInt64 *v, H3DInt64 value ) {
+      H3DInt64 old_value;
+      do {
+        old_value = *v;
+      } while( !compareAndSwap( v, old_value, value ) );
+    }
+#endif
+  }
+}
+
+#endif
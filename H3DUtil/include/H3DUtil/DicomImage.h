@@ -84,6 +84,17 @@ namespace H3DUtil {
     /// from the dicom file.
     H3DFloat hounsfieldToPixelValue( H3DFloat v );
 
+    /// Register the JPEG decoders of DCMTK. The registration is process
+    /// global and counted, the decoders are registered by the first call
+    /// and removed when unregisterCodecs has been called as many times as
+    /// registerCodecs. Can be called from any thread. Used by loaders that
+    /// construct DicomImages in several threads at once, so that the
+    /// decoders stay registered while all of them decode.
+    static void registerCodecs();
+
+    /// Remove a registration made with registerCodecs.
+    static void unregisterCodecs();
+
   protected:
     /// Load the image from the given url. The url can be a DIRFILE.
     void loadImage( const string &url );
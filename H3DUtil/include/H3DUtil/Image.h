@@ -32,6 +32,8 @@
 #include <H3DUtil/H3DUtil.h>
 #include <H3DUtil/LinAlgTypes.h>
 #include <H3DUtil/RefCountedClass.h>
+#include <H3DUtil/AutoRef.h>
+#include <H3DUtil/Atomic.h>
 #include <assert.h>
 #include <string.h>
 
@@ -44,7 +46,12 @@ namespace H3DUtil {
   public:
     /// Constructor.
     Image():
-      byte_alignment( 1 ) {}
+      byte_alignment( 1 ),
+      data_version( 0 ),
+      normalized_float_data_version( 0 ) {}
+
+    /// Destructor.
+    virtual ~Image();
 
     /// Type that defines what format each pixel in the image is
     /// on.
@@ -72,6 +79,16 @@ namespace H3DUtil {
       LINEAR
     } FilterType;
 
+    /// The order in which pixels are stored in the image data.
+    typedef enum {
+      /// The pixel at position (x, y, z) is stored at index 
+      /// ( z * height() + y ) * width() + x.
+      LINEAR_LAYOUT,
+      /// The image is divided into bricks that are stored one after the
+      /// other, see PixelImage::setDataLayout.
+      BRICKED_LAYOUT
+    } DataLayout;
+
     /// Returns the width of the image in pixels.
     virtual unsigned int width() = 0;
     /// Returns the height of the image in pixels.
@@ -100,6 +117,13 @@ namespace H3DUtil {
     /// deallocating that memory.
     virtual void *getImageData() = 0;
 
+    /// Returns the layout of the data returned by getImageData. Code that
+    /// accesses the image data directly instead of using getElement must
+    /// check that the layout is LINEAR_LAYOUT.
+    virtual DataLayout dataLayout() {
+      return LINEAR_LAYOUT;
+    }
+
     /// Sample the image at a given normalized position(texture coordinate), 
     /// i.e. coordinates between 0 and 1. Pixel data will be trilinearly
     /// interpolated to  calculate the result.
@@ -109,11 +133,11 @@ namespace H3DUtil {
     /// \param y The position in y(height) to sample(0-1).
     /// \param z The position in z(depth) to sample(0-1).
     /// \param filter_type Determines the sample should be interpolated.
-    void getSample( void *value, 
-                    H3DFloat x = 0, 
-                    H3DFloat y = 0, 
-                    H3DFloat z = 0,
-                    FilterType filter_type = LINEAR );
+    virtual void getSample( void *value, 
+                            H3DFloat x = 0, 
+                            H3DFloat y = 0, 
+                            H3DFloat z = 0,
+                            FilterType filter_type = LINEAR );
 
     /// Sample the image at a given normalized position(texture coordinate), 
     /// i.e. coordinates between 0 and 1. Pixel data will be trilinearly
@@ -149,6 +173,35 @@ namespace H3DUtil {
       }
       return rgba;
     }
+
+    /// Sample the image at n normalized positions(texture coordinates).
+    /// Gives the same result as calling getSample for each position
+    /// except that the values are not rounded to the precision of the
+    /// pixel format. The format of the image is only checked once for all
+    /// positions, which makes this a lot faster than calling getSample for
+    /// each of them when sampling many positions, e.g. when ray casting.
+    ///
+    /// \param coords The positions to sample (0-1 in each direction).
+    /// \param n The number of positions.
+    /// \param values Where to put the n sampled values.
+    /// \param filter_type Determines the sample should be interpolated.
+    virtual void getSamples( const Vec3f *coords,
+                             size_t n,
+                             H3DUtil::RGBA *values,
+                             FilterType filter_type = LINEAR );
+
+    /// Sample the first color component of the image at n normalized 
+    /// positions, i.e. the luminance value for LUMINANCE images and the
+    /// red value for color images. See getSamples above.
+    ///
+    /// \param coords The positions to sample (0-1 in each direction).
+    /// \param n The number of positions.
+    /// \param values Where to put the n sampled values.
+    /// \param filter_type Determines the sample should be interpolated.
+    virtual void getSamples( const Vec3f *coords,
+                             size_t n,
+                             H3DFloat *values,
+                             FilterType filter_type = LINEAR );
  
     /// Set the pixel at a given position given an RGBA struct. 
     /// If an LUMINANCE image, the R component is used as value. 
@@ -210,8 +263,50 @@ namespace H3DUtil {
       memcpy( &data[ ( ( z * height() + y ) * width() + x ) * bytes_per_pixel ],
               value, 
               bytes_per_pixel );
+      imageDataChanged();
     }
 
+    /// Copy the pixels in a box of the image to data. The box has its
+    /// lowest corner at (x, y, z) and size w x h x d pixels and must be
+    /// inside the image. The pixels are written as an image of size
+    /// w x h x d in LINEAR_LAYOUT, i.e. row by row and slice by slice
+    /// without padding, in the pixel format of the image. Whole rows are
+    /// copied at a time when possible, which makes this a lot faster than
+    /// calling getElement for each pixel.
+    ///
+    /// \param data Where to put the pixels. Must have room for
+    /// w * h * d pixels.
+    virtual void readRegion( void *data,
+                             unsigned int x, unsigned int y, unsigned int z,
+                             unsigned int w, unsigned int h, unsigned int d );
+
+    /// Copy the pixels in a box of the image to data as readRegion above,
+    /// but converted to the given pixel format. Pixels are converted in
+    /// the same way as by getPixel and setPixel, i.e. through normalized
+    /// RGBA values. If the format is the same as the image format no
+    /// conversion is made.
+    void readRegion( void *data,
+                     unsigned int x, unsigned int y, unsigned int z,
+                     unsigned int w, unsigned int h, unsigned int d,
+                     PixelType pixel_type,
+                     PixelComponentType pixel_component_type,
+                     unsigned int bits_per_pixel );
+
+    /// Set the pixels in a box of the image from data. The box and the
+    /// format of data are as for readRegion.
+    virtual void writeRegion( const void *data,
+                              unsigned int x, unsigned int y, unsigned int z,
+                              unsigned int w, unsigned int h, unsigned int d );
+
+    /// Set the pixels in a box of the image from data in the given pixel
+    /// format. The pixels are converted as for the converting readRegion.
+    void writeRegion( const void *data,
+                      unsigned int x, unsigned int y, unsigned int z,
+                      unsigned int w, unsigned int h, unsigned int d,
+                      PixelType pixel_type,
+                      PixelComponentType pixel_component_type,
+                      unsigned int bits_per_pixel );
+
     /// Gets the byte alignment for the start of each pixel row in memory.
     /// Valid values are 1, 2, 4 and 8.
     virtual int byteAlignment() {
@@ -223,8 +318,13 @@ namespace H3DUtil {
     /// the lowest value that can be held by the data type used in the image maps
     /// to 0 and the highest to 1. 
     ///
-    /// This function only works on images with pixel component type SIGNED or
-    /// UNSIGNED.
+    /// Integer values are divided by the largest value of their type and
+    /// negative results are set to 0. Values of images with pixel component
+    /// type RATIONAL are clamped to [0,1]. The conversion is done in
+    /// parallel using ThreadPool::getDefaultPool().
+    ///
+    /// This function only works on images with data in LINEAR_LAYOUT and
+    /// components of 8, 16, 32 or 64 bits.
     /// 
     /// It is the responsibility of the caller to free the memory of the returned
     /// pointer when it is finished with it.
@@ -233,16 +333,78 @@ namespace H3DUtil {
     /// Returns the image data as a double array with the same number of elements
     /// as getImageData but with the values normalized to the range [0,1] with
     /// the lowest value that can be held by the data type used in the image maps
-    /// to 0 and the highest to 1. 
-    ///
-    /// This function only works on images with pixel component type SIGNED or
-    /// UNSIGNED.
+    /// to 0 and the highest to 1. See convertToNormalizedFloatData.
     /// 
     /// It is the responsibility of the caller to free the memory of the returned
     /// pointer when it is finished with it.
     double *convertToNormalizedDoubleData();
+
+    /// Normalized float data shared between an image and the users of
+    /// getNormalizedFloatData. The data is deleted with the last reference.
+    class H3DUTIL_API NormalizedFloatData: public RefCountedClass {
+    public:
+      /// Constructor. Takes ownership of _data, allocated with new[].
+      NormalizedFloatData( float *_data ):
+        RefCountedClass( true ),
+        data( _data ) {}
+
+      /// Destructor.
+      virtual ~NormalizedFloatData() {
+        delete [] data;
+      }
+
+      /// Returns the normalized values.
+      inline const float *getData() { return data; }
+
+    protected:
+      float *data;
+    };
+
+    /// Returns the same data as convertToNormalizedFloatData, but the data
+    /// is kept by the image and only converted again when the image data
+    /// has changed. The returned data stays valid as long as the AutoRef
+    /// to it is kept, even if another thread converts the data again after
+    /// it has changed. Returns a NULL reference if the image data cannot
+    /// be converted.
+    AutoRef< NormalizedFloatData > getNormalizedFloatData();
+
+    /// Tell the image that its data has changed, e.g. after writing to the
+    /// data returned by getImageData, so that data derived from it, like
+    /// the data returned by getNormalizedFloatData, is computed again.
+    /// Functions like setElement call this automatically, so it is a plain
+    /// increment and not an atomic one. Writes to the image data must not
+    /// be concurrent anyway, and getNormalizedFloatData only needs to see
+    /// that the value differs from the one it converted.
+    inline void imageDataChanged() {
+      data_version = data_version + 1;
+    }
+
   protected:
+    /// readRegion implemented with one getElement call per pixel. Used
+    /// when the image data cannot be accessed directly.
+    void readRegionElements( unsigned char *data,
+                             unsigned int x, unsigned int y, unsigned int z,
+                             unsigned int w, unsigned int h, unsigned int d );
+
+    /// writeRegion implemented with one setElement call per pixel.
+    void writeRegionElements( const unsigned char *data,
+                              unsigned int x, unsigned int y, unsigned int z,
+                              unsigned int w, unsigned int h,
+                              unsigned int d );
+
     int byte_alignment;
+
+    /// Incremented each time the image data changes.
+    volatile int data_version;
+
+    /// Lock for normalized_float_data.
+    MutexLock normalized_data_lock;
+
+    /// The data returned by getNormalizedFloatData.
+    AutoRef< NormalizedFloatData > normalized_float_data;
+
+    /// The value of data_version when normalized_float_data was computed.
+    int normalized_float_data_version;
   };
 }
 
@@ -0,0 +1,102 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImageMipChain.h
+/// \brief Header file for functions building mipmap chains of images.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __IMAGEMIPCHAIN_H__
+#define __IMAGEMIPCHAIN_H__
+
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/AutoRef.h>
+#include <vector>
+
+namespace H3DUtil {
+
+  /// \defgroup ImageMipChainFunctions Mipmap functions
+  /// Functions for downsampling images, e.g. to build texture mipmaps or
+  /// coarse versions of volumes.
+  ///
+  /// Each downsampling halves the size of every dimension that is larger
+  /// than 1, rounding down. Pixel (x, y, z) of the result is computed
+  /// from the pixels around (2x, 2y, 2z) in the source. The filtering is
+  /// done separately for each pixel component in the component type of
+  /// the image, so no precision is lost by converting to RGBA. Images
+  /// with 1 to 4 components of 8, 16 or 32 bit integers, floats or
+  /// doubles are filtered, other images are downsampled by picking the
+  /// pixel at (2x, 2y, 2z).
+
+  /// \ingroup ImageMipChainFunctions
+  /// The filters that can be used when downsampling.
+  typedef enum {
+    /// The average of the 2x2x2 pixels at (2x, 2y, 2z).
+    BOX_MIP_FILTER,
+    /// A Gaussian-like filter with weights (1 3 3 1)/8 along each axis over
+    /// the pixels from 2x-1 to 2x+2. Gives smoother results than the box
+    /// filter at the cost of reading 4x4x4 pixels for each result pixel.
+    GAUSSIAN_MIP_FILTER
+  } MipFilterType;
+
+  /// \ingroup ImageMipChainFunctions
+  /// Returns a new image with half the resolution of image.
+  H3DUTIL_API PixelImage *downsampleImage(
+    Image *image,
+    MipFilterType filter_type = BOX_MIP_FILTER );
+
+  /// \ingroup ImageMipChainFunctions
+  /// Compute slices [begin, end) of dst by downsampling src. dst must
+  /// have the same pixel format as src and the size of a downsampled src.
+  /// The slices of src that are used must have their final values, i.e.
+  /// slices 2 * begin to 2 * end - 1 for BOX_MIP_FILTER and one more
+  /// slice in each direction for GAUSSIAN_MIP_FILTER. This makes it
+  /// possible to downsample an image as it is being loaded.
+  H3DUTIL_API void downsampleImageSlices( Image *src,
+                                          PixelImage *dst,
+                                          unsigned int begin,
+                                          unsigned int end,
+                                          MipFilterType filter_type =
+                                          BOX_MIP_FILTER );
+
+  /// \ingroup ImageMipChainFunctions
+  /// Build a chain of downsampled versions of image. levels[0] is image
+  /// downsampled once, levels[1] is levels[0] downsampled, and so on until
+  /// a level of 1x1x1 pixels or max_levels levels. The source image is
+  /// read once and each level is computed from the previous one. The
+  /// pixels of each level are computed in parallel using
+  /// ThreadPool::getDefaultPool().
+  /// \param image The image to downsample.
+  /// \param levels The vector the levels are added to. Any previous
+  /// content is removed.
+  /// \param filter_type The filter to use.
+  /// \param max_levels The maximum number of levels to build. 0 means
+  /// no limit.
+  H3DUTIL_API void buildMipChain(
+    Image *image,
+    std::vector< AutoRef< PixelImage > > &levels,
+    MipFilterType filter_type = BOX_MIP_FILTER,
+    unsigned int max_levels = 0 );
+}
+
+#endif
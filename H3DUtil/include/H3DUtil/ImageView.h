@@ -0,0 +1,314 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImageView.h
+/// \brief Header file for ImageView, typed access to the data of an Image.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __IMAGEVIEW_H__
+#define __IMAGEVIEW_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/Exception.h>
+
+namespace H3DUtil {
+
+  /// Thrown when an ImageView is created for an Image with a different
+  /// pixel format than the view.
+  H3D_API_EXCEPTION( ImageViewFormatMismatch );
+
+  /// Compile time information about a PixelType. For each pixel type
+  /// there is the number of components and functions to convert between
+  /// normalized component values and RGBA in the same way as
+  /// Image::imageValueToRGBA and Image::RGBAToImageValue.
+  template< Image::PixelType P >
+  struct PixelTypeTraits;
+
+  template<>
+  struct PixelTypeTraits< Image::LUMINANCE > {
+    static const unsigned int nr_components = 1;
+    static inline RGBA toRGBA( const H3DFloat *v ) {
+      return RGBA( v[0], v[0], v[0], 1 );
+    }
+    static inline void fromRGBA( const RGBA &c, H3DFloat *v ) {
+      v[0] = c.r;
+    }
+  };
+
+  template<>
+  struct PixelTypeTraits< Image::LUMINANCE_ALPHA > {
+    static const unsigned int nr_components = 2;
+    static inline RGBA toRGBA( const H3DFloat *v ) {
+      return RGBA( v[0], v[0], v[0], v[1] );
+    }
+    static inline void fromRGBA( const RGBA &c, H3DFloat *v ) {
+      v[0] = c.r; v[1] = c.a;
+    }
+  };
+
+  template<>
+  struct PixelTypeTraits< Image::RGB > {
+    static const unsigned int nr_components = 3;
+    static inline RGBA toRGBA( const H3DFloat *v ) {
+      return RGBA( v[0], v[1], v[2], 1 );
+    }
+    static inline void fromRGBA( const RGBA &c, H3DFloat *v ) {
+      v[0] = c.r; v[1] = c.g; v[2] = c.b;
+    }
+  };
+
+  template<>
+  struct PixelTypeTraits< Image::VEC3 >:
+    public PixelTypeTraits< Image::RGB > {};
+
+  template<>
+  struct PixelTypeTraits< Image::BGR > {
+    static const unsigned int nr_components = 3;
+    static inline RGBA toRGBA( const H3DFloat *v ) {
+      return RGBA( v[2], v[1], v[0], 1 );
+    }
+    static inline void fromRGBA( const RGBA &c, H3DFloat *v ) {
+      v[0] = c.b; v[1] = c.g; v[2] = c.r;
+    }
+  };
+
+  template<>
+  struct PixelTypeTraits< Image::RGBA > {
+    static const unsigned int nr_components = 4;
+    static inline RGBA toRGBA( const H3DFloat *v ) {
+      return RGBA( v[0], v[1], v[2], v[3] );
+    }
+    static inline void fromRGBA( const RGBA &c, H3DFloat *v ) {
+      v[0] = c.r; v[1] = c.g; v[2] = c.b; v[3] = c.a;
+    }
+  };
+
+  template<>
+  struct PixelTypeTraits< Image::BGRA > {
+    static const unsigned int nr_components = 4;
+    static inline RGBA toRGBA( const H3DFloat *v ) {
+      return RGBA( v[2], v[1], v[0], v[3] );
+    }
+    static inline void fromRGBA( const RGBA &c, H3DFloat *v ) {
+      v[0] = c.b; v[1] = c.g; v[2] = c.r; v[3] = c.a;
+    }
+  };
+
+  /// Compile time information about the type of a pixel component.
+  /// normalize converts a component value to a float in the same way as
+  /// Image::imageValueToRGBA, i.e. unsigned values are divided by
+  /// 2^bits - 1, signed values by 2^(bits-1) - 1 and rational values are
+  /// unchanged. denormalize does the opposite conversion.
+  template< class T >
+  struct ComponentTypeTraits;
+
+  /// Macro used to define ComponentTypeTraits for integer types.
+#define H3D_INTEGER_COMPONENT_TRAITS( type, comp_type, max_value )       \
+  template<>                                                                \
+  struct ComponentTypeTraits< type > {                                      \
+    static const Image::PixelComponentType component_type = comp_type;     \
+    static inline H3DFloat normalize( type v ) {                            \
+      return (H3DFloat)( v * ( 1.0 / max_value ) );                         \
+    }                                                                       \
+    static inline type denormalize( H3DFloat v ) {                          \
+      return (type)( v * max_value );                                       \
+    }                                                                       \
+  }
+
+  H3D_INTEGER_COMPONENT_TRAITS( unsigned char, Image::UNSIGNED, 255.0 );
+  H3D_INTEGER_COMPONENT_TRAITS( unsigned short, Image::UNSIGNED, 65535.0 );
+  H3D_INTEGER_COMPONENT_TRAITS( unsigned int, Image::UNSIGNED, 4294967295.0 );
+  H3D_INTEGER_COMPONENT_TRAITS( signed char, Image::SIGNED, 127.0 );
+  H3D_INTEGER_COMPONENT_TRAITS( short, Image::SIGNED, 32767.0 );
+  H3D_INTEGER_COMPONENT_TRAITS( int, Image::SIGNED, 2147483647.0 );
+#undef H3D_INTEGER_COMPONENT_TRAITS
+
+  template<>
+  struct ComponentTypeTraits< float > {
+    static const Image::PixelComponentType component_type = Image::RATIONAL;
+    static inline H3DFloat normalize( float v ) { return v; }
+    static inline float denormalize( H3DFloat v ) { return v; }
+  };
+
+  template<>
+  struct ComponentTypeTraits< double > {
+    static const Image::PixelComponentType component_type = Image::RATIONAL;
+    static inline H3DFloat normalize( double v ) { return (H3DFloat) v; }
+    static inline double denormalize( H3DFloat v ) { return v; }
+  };
+
+  /// ImageView gives typed access to the pixel data of an Image where
+  /// the format is known at compile time. The format is checked once when
+  /// the view is created and all access functions are inlined, which makes
+  /// it suitable for loops over all pixels in an image. The view does not
+  /// own the image and is only valid as long as the image data is not
+  /// changed with setImageData or similar functions. Writing through
+  /// the view does not notify the image, so call Image::imageDataChanged
+  /// when done.
+  ///
+  /// Example:
+  /// \code
+  /// ImageView< Image::LUMINANCE, unsigned short > view( image );
+  /// for( unsigned int i = 0; i < view.nrPixels(); ++i )
+  ///   sum += view.normalizedComponent( i );
+  /// \endcode
+  template< Image::PixelType P, class ComponentT >
+  class ImageView {
+  public:
+    /// The number of components in each pixel.
+    static const unsigned int nr_components =
+      PixelTypeTraits< P >::nr_components;
+
+    /// Constructor. Throws ImageViewFormatMismatch if the format of the
+    /// image does not match the view or if the image has no data in
+    /// linear layout.
+    ImageView( Image *image ):
+      w( 0 ), h( 0 ), d( 0 ), data( NULL ) {
+      if( !matches( image ) ) {
+        throw ImageViewFormatMismatch( "Image format does not match view",
+                                       H3D_FULL_LOCATION );
+      }
+      w = image->width();
+      h = image->height();
+      d = image->depth();
+      data = static_cast< ComponentT * >( image->getImageData() );
+    }
+
+    /// Returns true if an ImageView of this type can be created for the
+    /// given image.
+    static bool matches( Image *image ) {
+      return image &&
+        image->pixelType() == P &&
+        image->pixelComponentType() ==
+        ComponentTypeTraits< ComponentT >::component_type &&
+        image->bitsPerPixel() == 8 * sizeof( ComponentT ) * nr_components &&
+        image->dataLayout() == Image::LINEAR_LAYOUT &&
+        image->getImageData() != NULL;
+    }
+
+    /// Returns the width of the image.
+    inline unsigned int width() const { return w; }
+    /// Returns the height of the image.
+    inline unsigned int height() const { return h; }
+    /// Returns the depth of the image.
+    inline unsigned int depth() const { return d; }
+    /// Returns the total number of pixels in the image.
+    inline size_t nrPixels() const { return (size_t) w * h * d; }
+
+    /// Returns the index of the pixel at the given position.
+    inline size_t pixelIndex( unsigned int x,
+                              unsigned int y,
+                              unsigned int z ) const {
+      return ( (size_t) z * h + y ) * w + x;
+    }
+
+    /// Returns a pointer to the first component of the pixel with the
+    /// given index. Named differently from pixel so that a call with int
+    /// arguments is not ambiguous.
+    inline ComponentT *pixelAt( size_t index ) {
+      return data + index * nr_components;
+    }
+
+    /// Returns a pointer to the first component of the pixel at the given
+    /// position.
+    inline ComponentT *pixel( unsigned int x,
+                              unsigned int y = 0,
+                              unsigned int z = 0 ) {
+      return pixelAt( pixelIndex( x, y, z ) );
+    }
+
+    /// Returns component c of the pixel with the given index.
+    inline ComponentT component( size_t index, unsigned int c = 0 ) const {
+      return data[ index * nr_components + c ];
+    }
+
+    /// Set component c of the pixel with the given index.
+    inline void setComponent( size_t index,
+                              ComponentT value,
+                              unsigned int c = 0 ) {
+      data[ index * nr_components + c ] = value;
+    }
+
+    /// Returns component c of the pixel with the given index as a
+    /// normalized value. See ComponentTypeTraits.
+    inline H3DFloat normalizedComponent( size_t index,
+                                         unsigned int c = 0 ) const {
+      return ComponentTypeTraits< ComponentT >::normalize(
+        component( index, c ) );
+    }
+
+    /// Set component c of the pixel with the given index from a
+    /// normalized value. See ComponentTypeTraits.
+    inline void setNormalizedComponent( size_t index,
+                                        H3DFloat value,
+                                        unsigned int c = 0 ) {
+      setComponent( index,
+                    ComponentTypeTraits< ComponentT >::denormalize( value ),
+                    c );
+    }
+
+    /// Get the pixel with the given index as an RGBA value. Gives the
+    /// same result as Image::getPixel.
+    inline RGBA getPixelAt( size_t index ) const {
+      H3DFloat v[ nr_components ];
+      const ComponentT *p = data + index * nr_components;
+      for( unsigned int c = 0; c < nr_components; ++c )
+        v[c] = ComponentTypeTraits< ComponentT >::normalize( p[c] );
+      return PixelTypeTraits< P >::toRGBA( v );
+    }
+
+    /// Get the pixel at the given position as an RGBA value.
+    inline RGBA getPixel( unsigned int x,
+                          unsigned int y,
+                          unsigned int z ) const {
+      return getPixelAt( pixelIndex( x, y, z ) );
+    }
+
+    /// Set the pixel with the given index from an RGBA value.
+    inline void setPixelAt( size_t index, const RGBA &value ) {
+      H3DFloat v[ nr_components ];
+      PixelTypeTraits< P >::fromRGBA( value, v );
+      ComponentT *p = data + index * nr_components;
+      for( unsigned int c = 0; c < nr_components; ++c )
+        p[c] = ComponentTypeTraits< ComponentT >::denormalize( v[c] );
+    }
+
+    /// Set the pixel at the given position from an RGBA value.
+    inline void setPixel( unsigned int x,
+                          unsigned int y,
+                          unsigned int z,
+                          const RGBA &value ) {
+      setPixelAt( pixelIndex( x, y, z ), value );
+    }
+
+    /// Returns a pointer to the image data.
+    inline ComponentT *getData() { return data; }
+
+  protected:
+    unsigned int w, h, d;
+    ComponentT *data;
+  };
+}
+
+#endif
@@ -33,9 +33,21 @@
 
 namespace H3DUtil {
 
+  class MultiResolutionImage;
+
   /// \ingroup H3DUtilClasses
   /// \defgroup ImageLoaderFunctions Image loader functions
   /// These functions can be used to load an image of a certain type.
+
+  /// \ingroup ImageLoaderFunctions
+  /// Function type used by image loader functions to report how much of
+  /// an image has been loaded.
+  /// \param progress The fraction of the image that has been loaded,
+  /// between 0 and 1.
+  /// \param data User data given to the loader function.
+  /// \returns true to continue loading. If false is returned the loader
+  /// stops as soon as possible and returns NULL.
+  typedef bool (*LoadImageProgressFunc)( H3DFloat progress, void *data );
  
 #ifdef HAVE_FREEIMAGE
   /// \ingroup ImageLoaderFunctions
@@ -46,22 +58,40 @@ namespace H3DUtil {
   H3DUTIL_API Image *loadFreeImage( const string &url );
 #endif
 
-#ifdef HAVE_TEEM
   /// \ingroup ImageLoaderFunctions
-  /// Loads a file in the Nrrd file format as an image.
+  /// Loads a file in the Nrrd file format as an image. If H3DUtil is
+  /// built with teem, teem is used to read the file, otherwise NrrdReader
+  /// is used, which supports the raw and gzip encodings.
   /// \param url The url of the image to load.
+  /// \param progress_func If not NULL it is called as the data is read.
+  /// NrrdReader reads and reports a few slices at a time while teem reads
+  /// all data at once so progress is then only reported when done.
+  /// \param progress_data Data passed to progress_func.
   /// \returns A pointer to and Image class containing the data
   /// of the loaded url. NULL if unsuccessful.
-  H3DUTIL_API Image *loadNrrdFile( const string &url );
+  H3DUTIL_API Image *loadNrrdFile( const string &url,
+                                   LoadImageProgressFunc progress_func = NULL,
+                                   void *progress_data = NULL );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Start loading a Nrrd file in the background using NrrdReader and
+  /// return a MultiResolutionImage that is filled in while it is used.
+  /// See loadRawImageProgressive.
+  /// \returns The image or NULL if the header of the file could not be
+  /// read.
+  H3DUTIL_API MultiResolutionImage *
+  loadNrrdFileProgressive( const string &url );
 
   /// \ingroup ImageLoaderFunctions
-  /// Saves an image in the Nrrd file format.
+  /// Saves an image in the Nrrd file format. The image is written a few
+  /// slices at a time with NrrdWriter.
   /// \param url The filename to save to.
   /// \param image The image to save.
+  /// \param compress If true the data is gzip compressed.
   /// \returns 0 on success.
   H3DUTIL_API int saveImageAsNrrdFile( const string &url,
-                                       Image *image );
-#endif
+                                       Image *image,
+                                       bool compress = false );
 
 #ifdef HAVE_DCMTK
   /// \ingroup ImageLoaderFunctions
@@ -92,11 +122,14 @@ namespace H3DUtil {
   /// if the top left corner of the DICOM image is desired the texture
   /// coordinate (0,1) have to be used.
   ///
-  /// When composing a voxel data set using several dicom files it is assumed
-  /// that the numbering of the files corresponds to decreasing or increasing
-  /// z-values in the ImagePositionPatient data entry. If this is true the
-  /// slices will be stacked such that the first slice is the slice with the
-  /// highest z-value of ImagePositionPatient. It might be worth noting that
+  /// When composing a voxel data set using several dicom files the slices
+  /// are sorted by their ImagePositionPatient projected on the slice
+  /// normal given by ImageOrientationPatient. The slices will be stacked
+  /// such that the first slice is the slice with the highest such value,
+  /// i.e. the highest z-value of ImagePositionPatient for the default
+  /// orientation. If some file lacks ImagePositionPatient the files are
+  /// used in alphabetical order. The headers of the files are read and the
+  /// slices decoded in parallel using ThreadPool::getDefaultPool(). It might be worth noting that
   /// the default X3D Texture coordinate generation is from +Z to -Z for the
   /// r texture coordinate (3rd value) which means that when a DICOM voxel data
   /// set is displayed using that setup it will look as if the first slice in
@@ -109,10 +142,46 @@ namespace H3DUtil {
   /// file url specifies. If false, it will look in the same directory
   /// for files of the same image set, and compose them to a 3d image
   /// if they are found.
+  /// \param progress_func If not NULL it is called as the files are
+  /// loaded. Reading the headers is the first half of the progress and
+  /// decoding the slices the second half. It can be called from any thread
+  /// but the calls are never made concurrently. If it returns false no
+  /// more files are read or decoded and NULL is returned.
+  /// \param progress_data Data passed to progress_func.
   /// \returns A pointer to and Image class containing the data
   /// of the loaded url. NULL if unsuccessful.
   H3DUTIL_API Image *loadDicomFile( const string &url, 
-                                    bool load_single_file = true );
+                                    bool load_single_file = true,
+                                    LoadImageProgressFunc progress_func = NULL,
+                                    void *progress_data = NULL );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Get the files of the DICOM series that url is part of, in the order
+  /// their slices are stacked by loadDicomFile with load_single_file set to
+  /// false. The header cache is used as by loadDicomFile.
+  /// \param url The url of a file in the series.
+  /// \param files The vector the file names are put in.
+  /// \param pixel_size If not NULL it is set to the pixel size of the
+  /// image formed by the series.
+  /// \returns false if no series was found.
+  H3DUTIL_API bool getDicomSeriesFiles( const string &url,
+                                        vector< string > &files,
+                                        Vec3f *pixel_size = NULL );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Set the directory used to cache DICOM header information between
+  /// calls to loadDicomFile. When loading a series, an index file is kept
+  /// in this directory for each directory of DICOM files. It contains the
+  /// series instance UID, position, orientation and pixel format of every
+  /// file, so that files whose size and modification time have not changed
+  /// are not parsed again. The directory must exist. An empty string,
+  /// the default, disables the cache.
+  H3DUTIL_API void setDicomHeaderCacheDirectory( const string &dir );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Get the directory used to cache DICOM header information. See
+  /// setDicomHeaderCacheDirectory.
+  H3DUTIL_API string getDicomHeaderCacheDirectory();
 #endif
 
   /// Contains information needed by the loadRawImage function
@@ -161,8 +230,33 @@ namespace H3DUtil {
   /// Read the data from the file pointed to by the parameter url
   /// and creates and returns a PixelImage containing this data.
   /// How to interpret the data is specified by the raw_image_info parameter.
+  /// \param url The url of the image to load.
+  /// \param raw_image_info The format of the data.
+  /// \param progress_func If not NULL it is called as the data is read or
+  /// inflated. Memory mapped files are not read when loaded so no progress
+  /// is reported for them.
+  /// \param progress_data Data passed to progress_func.
   H3DUTIL_API Image *loadRawImage( const string &url,
-                                   RawImageInfo &raw_image_info );
+                                   RawImageInfo &raw_image_info,
+                                   LoadImageProgressFunc progress_func = NULL,
+                                   void *progress_data = NULL );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Start loading a raw file in the background and return a
+  /// MultiResolutionImage that is filled in while it is used. For
+  /// uncompressed files a coarse preview is read from a few slices spread
+  /// over the volume first, then the full resolution data is read in
+  /// order of z and the coarser levels are computed from it. Compressed
+  /// files can only be inflated in order of z, so they get no preview and
+  /// are only sampled when complete, but
+  /// MultiResolutionImage::getLoadProgress reports how much has been
+  /// inflated. Use MultiResolutionImage::isComplete and
+  /// MultiResolutionImage::loadFailed to check the state of the load.
+  /// \returns The image or NULL if raw_image_info is invalid or the file
+  /// could not be opened.
+  H3DUTIL_API MultiResolutionImage *
+  loadRawImageProgressive( const string &url,
+                           RawImageInfo &raw_image_info );
 }
 
 #endif
@@ -0,0 +1,156 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file LockFreeQueue.h
+/// \brief Header file for LockFreeQueue, a bounded lock free queue.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __LOCKFREEQUEUE_H__
+#define __LOCKFREEQUEUE_H__
+
+#include <H3DUtil/Atomic.h>
+#include <H3DUtil/H3DMath.h>
+
+namespace H3DUtil {
+
+  /// LockFreeQueue is a bounded first in first out queue that can be
+  /// used by several producer threads and one consumer thread at the same
+  /// time without any locks. All memory is allocated in the constructor
+  /// so no heap allocations are made when adding or removing elements.
+  ///
+  /// Each cell in the ring buffer has a sequence number that tells if
+  /// the cell is free to write to or contains a value ready to be read.
+  /// Producers claim a cell by incrementing the enqueue position with a
+  /// compare and swap and publish the value by updating the sequence
+  /// number of the cell.
+  ///
+  /// push() can be called from any thread. pop() and empty() must only be
+  /// called from one thread at a time, e.g. by holding a lock around them.
+  template< class T >
+  class LockFreeQueue {
+  public:
+    /// Constructor.
+    /// \param _capacity The maximum number of elements in the queue. Will
+    /// be rounded up to the nearest power of two.
+    LockFreeQueue( unsigned int _capacity = 1024 ):
+      enqueue_pos( 0 ),
+      dequeue_pos( 0 ) {
+      if( _capacity < 2 ) _capacity = 2;
+      unsigned int size = nextPowerOfTwo( _capacity );
+      mask = size - 1;
+      cells = new Cell[ size ];
+      for( unsigned int i = 0; i < size; ++i ) {
+        cells[i].sequence = (int) i;
+      }
+    }
+
+    /// Destructor.
+    ~LockFreeQueue() {
+      delete [] cells;
+    }
+
+    /// Add a value last in the queue. Returns false if the queue is full.
+    bool push( const T &value ) {
+      Cell *cell;
+      unsigned int pos = (unsigned int) Atomic::load( &enqueue_pos );
+      for( ; ; ) {
+        cell = &cells[ pos & mask ];
+        unsigned int seq = (unsigned int) Atomic::load( &cell->sequence );
+        int diff = (int)( seq - pos );
+        if( diff == 0 ) {
+          // the cell is free, try to claim it.
+          if( Atomic::compareAndSwap( &enqueue_pos,
+                                      (int) pos,
+                                      (int)( pos + 1 ) ) ) {
+            break;
+          }
+          pos = (unsigned int) Atomic::load( &enqueue_pos );
+        } else if( diff < 0 ) {
+          // the cell still contains a value that has not been read.
+          return false;
+        } else {
+          // another producer claimed the cell before us.
+          pos = (unsigned int) Atomic::load( &enqueue_pos );
+        }
+      }
+      cell->value = value;
+      Atomic::store( &cell->sequence, (int)( pos + 1 ) );
+      return true;
+    }
+
+    /// Remove the first value in the queue and put it in value. Returns
+    /// false if the queue is empty.
+    bool pop( T &value ) {
+      Cell *cell = &cells[ dequeue_pos & mask ];
+      unsigned int seq = (unsigned int) Atomic::load( &cell->sequence );
+      if( (int)( seq - ( dequeue_pos + 1 ) ) < 0 ) return false;
+      value = cell->value;
+      Atomic::store( &cell->sequence, (int)( dequeue_pos + mask + 1 ) );
+      ++dequeue_pos;
+      return true;
+    }
+
+    /// Returns true if there are no values ready to be read from the queue.
+    bool empty() {
+      unsigned int seq =
+        (unsigned int) Atomic::load( &cells[ dequeue_pos & mask ].sequence );
+      return (int)( seq - ( dequeue_pos + 1 ) ) < 0;
+    }
+
+    /// Returns the maximum number of elements in the queue.
+    unsigned int capacity() {
+      return mask + 1;
+    }
+
+  protected:
+    /// A position in the ring buffer.
+    struct Cell {
+      volatile int sequence;
+      T value;
+    };
+
+    /// The ring buffer.
+    Cell *cells;
+
+    /// Size of the ring buffer - 1.
+    unsigned int mask;
+
+    /// Position of the next cell to write to. Shared between producers.
+    volatile int enqueue_pos;
+
+    /// Padding to keep the producer and consumer positions in different
+    /// cache lines.
+    char pad[64];
+
+    /// Position of the next cell to read from. Only used by the consumer.
+    unsigned int dequeue_pos;
+
+  private:
+    // Not copyable.
+    LockFreeQueue( const LockFreeQueue & );
+    LockFreeQueue &operator=( const LockFreeQueue & );
+  };
+}
+
+#endif
@@ -0,0 +1,100 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file MappedRawImage.h
+/// \brief Header file for MappedRawImage, an image using a memory mapped
+/// raw file as image data.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __MAPPEDRAWIMAGE_H__
+#define __MAPPEDRAWIMAGE_H__
+
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Exception.h>
+
+namespace H3DUtil {
+  /// \class MappedRawImage
+  /// A PixelImage where the image data is a memory mapped uncompressed raw
+  /// file. No data is read when the image is created, instead pages of the
+  /// file are read by the operating system the first time they are
+  /// accessed. The mapping is private, so changes to the image data are
+  /// not written to the file, and pages that have not been changed are
+  /// shared between all processes that map the same file.
+  ///
+  /// If the image data is replaced with setImageData the mapping is
+  /// released and the image behaves as a normal PixelImage.
+  class H3DUTIL_API MappedRawImage: public PixelImage {
+  public:
+    /// Thrown when the file could not be mapped.
+    H3D_VALUE_EXCEPTION( string, CouldNotMapFile );
+
+    /// Constructor. Throws CouldNotMapFile if the file could not be
+    /// opened or is smaller than the size of the image.
+    /// \param filename The raw file to map.
+    /// \param _width The width of the image in pixels.
+    /// \param _height The height of the image in pixels.
+    /// \param _depth The depth of the image in pixels.
+    /// \param _bits_per_pixel The number of bits used for each pixel.
+    /// \param _pixel_type The PixelType of the image.
+    /// \param _pixel_component_type The PixelComponentType of the image.
+    /// \param _pixel_size The size of a pixel in metres.
+    MappedRawImage( const string &filename,
+                    unsigned int _width,
+                    unsigned int _height,
+                    unsigned int _depth,
+                    unsigned int _bits_per_pixel,
+                    PixelType _pixel_type,
+                    PixelComponentType _pixel_component_type,
+                    const Vec3f &_pixel_size = Vec3f( 0, 0, 0 ) );
+
+    /// Destructor. Releases the mapping.
+    virtual ~MappedRawImage();
+
+    /// Returns true if the image data is still the mapped file.
+    inline bool isMapped() {
+      return mapped_data != NULL;
+    }
+
+  protected:
+    /// Releases the mapping if data is the mapped file, otherwise
+    /// deletes data.
+    virtual void deleteImageData( unsigned char *data );
+
+    /// Release the mapping.
+    void unmap();
+
+    /// The start of the mapped memory. NULL if not mapped.
+    unsigned char *mapped_data;
+
+    /// The size of the mapped memory in bytes.
+    size_t mapped_size;
+
+#ifdef H3D_WINDOWS
+    /// Handle to the file mapping object.
+    void *mapping_handle;
+#endif
+  };
+}
+
+#endif
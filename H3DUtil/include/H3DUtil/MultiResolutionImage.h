@@ -0,0 +1,304 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file MultiResolutionImage.h
+/// \brief Header file for MultiResolutionImage, an image consisting of
+/// several resolution levels that are loaded progressively.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __MULTIRESOLUTIONIMAGE_H__
+#define __MULTIRESOLUTIONIMAGE_H__
+
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/AutoRef.h>
+#include <H3DUtil/Atomic.h>
+#include <H3DUtil/Threads.h>
+
+namespace H3DUtil {
+
+  /// \class MultiResolutionImage
+  /// An image stored as a pyramid of PixelImage levels where level 0 is
+  /// the full resolution image and each following level has half the
+  /// resolution of the previous one in each dimension larger than 1.
+  ///
+  /// The image is intended to be filled in while it is used, e.g. by
+  /// loadRawImageProgressive. A loader that can seek in its source first
+  /// fills in a preview, an approximation of a coarse level, and then adds
+  /// the full resolution data in order of increasing z. The coarser levels
+  /// are computed from the full resolution data as it is added. getSample
+  /// and getSamples use the preview until the full resolution data is
+  /// complete, so sampling never has to wait for it. The preview is kept
+  /// in its own buffer so that building the levels never changes data
+  /// that is being sampled.
+  ///
+  /// The functions returning the full resolution data, e.g. getImageData,
+  /// return data that is incomplete until isComplete() returns true.
+  class H3DUTIL_API MultiResolutionImage: public Image {
+  public:
+    /// Function type for functions loading data into an image. Started
+    /// with startLoading.
+    typedef void (*LoadFunc)( MultiResolutionImage *image, void *data );
+
+    /// Constructor. Creates all levels down to a single pixel. The levels
+    /// are not initialized since they are not used until they have been
+    /// filled in, which keeps the constructor fast for large volumes. The
+    /// preview is set to 0.
+    MultiResolutionImage( unsigned int _width,
+                          unsigned int _height,
+                          unsigned int _depth,
+                          unsigned int _bits_per_pixel,
+                          PixelType _pixel_type,
+                          PixelComponentType _pixel_component_type,
+                          const Vec3f &_pixel_size = Vec3f( 0, 0, 0 ) );
+
+    /// Destructor. Aborts and waits for a loading thread started with
+    /// startLoading.
+    virtual ~MultiResolutionImage();
+
+    /// Returns the width of the full resolution image.
+    virtual unsigned int width() { return levels[0]->width(); }
+
+    /// Returns the height of the full resolution image.
+    virtual unsigned int height() { return levels[0]->height(); }
+
+    /// Returns the depth of the full resolution image.
+    virtual unsigned int depth() { return levels[0]->depth(); }
+
+    /// Returns the number of bits used for each pixel.
+    virtual unsigned int bitsPerPixel() { return levels[0]->bitsPerPixel(); }
+
+    /// Returns the size of a pixel in the full resolution image.
+    virtual Vec3f pixelSize() { return levels[0]->pixelSize(); }
+
+    /// Returns the pixel type of the image.
+    virtual PixelType pixelType() { return levels[0]->pixelType(); }
+
+    /// Returns the pixel component type of the image.
+    virtual PixelComponentType pixelComponentType() {
+      return levels[0]->pixelComponentType();
+    }
+
+    /// Returns the full resolution image data.
+    virtual void *getImageData() { return levels[0]->getImageData(); }
+
+    /// Get an element of the level returned by getFinestCompleteLevel.
+    /// x, y and z are coordinates in the full resolution image. If no
+    /// level is complete the value is set to 0.
+    virtual void getElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    /// Set an element in the full resolution image.
+    virtual void setElement( void *value, int x = 0, int y = 0, int z = 0 ) {
+      levels[0]->setElement( value, x, y, z );
+      imageDataChanged();
+    }
+
+    using Image::readRegion;
+    using Image::writeRegion;
+
+    /// Copy the pixels in a box of the level returned by
+    /// getFinestCompleteLevel to data. x, y, z, w, h and d are in the full
+    /// resolution image. See Image::readRegion.
+    virtual void readRegion( void *data,
+                             unsigned int x, unsigned int y, unsigned int z,
+                             unsigned int w, unsigned int h, unsigned int d );
+
+    /// Set the pixels in a box of the full resolution image from data.
+    /// See Image::writeRegion.
+    virtual void writeRegion( const void *data,
+                              unsigned int x, unsigned int y, unsigned int z,
+                              unsigned int w, unsigned int h,
+                              unsigned int d ) {
+      levels[0]->writeRegion( data, x, y, z, w, h, d );
+      imageDataChanged();
+    }
+
+    using Image::getSample;
+
+    /// Sample the preview while loading and the full resolution image when
+    /// it is complete. If neither is available the value is set to 0.
+    virtual void getSample( void *value,
+                            H3DFloat x = 0,
+                            H3DFloat y = 0,
+                            H3DFloat z = 0,
+                            FilterType filter_type = LINEAR );
+
+    /// Sample as getSample does. See Image::getSamples.
+    virtual void getSamples( const Vec3f *coords,
+                             size_t n,
+                             H3DUtil::RGBA *values,
+                             FilterType filter_type = LINEAR );
+
+    /// Sample as getSample does. See Image::getSamples.
+    virtual void getSamples( const Vec3f *coords,
+                             size_t n,
+                             H3DFloat *values,
+                             FilterType filter_type = LINEAR );
+
+    /// Returns the number of levels.
+    inline unsigned int getNrLevels() {
+      return (unsigned int) levels.size();
+    }
+
+    /// Returns the given level. Level 0 is the full resolution image. The
+    /// levels are incomplete until isComplete() returns true.
+    inline PixelImage *getLevel( unsigned int level ) {
+      return levels[ level ].get();
+    }
+
+    /// Returns the finest level that can be sampled. It is
+    /// getNrLevels() until the preview is done, then getPreviewLevel()
+    /// until all full resolution data has been added and 0 after that. The
+    /// other coarse levels are built from the full resolution data as it
+    /// is added but only become complete together with it, so loading has
+    /// only these two stages.
+    inline unsigned int getFinestCompleteLevel() {
+      return (unsigned int) Atomic::load( &finest_complete_level );
+    }
+
+    /// Returns true if all full resolution data has been added.
+    inline bool isComplete() {
+      return getFinestCompleteLevel() == 0;
+    }
+
+    /// Returns the progress of loading the image, between 0 and 1.
+    H3DFloat getLoadProgress();
+
+    /// Returns true if loading the image failed.
+    inline bool loadFailed() {
+      return Atomic::load( &load_failed ) != 0;
+    }
+
+    /// Start a thread that calls func( this, data ). Used by loader
+    /// functions to fill in the image in the background. Can only be
+    /// called once. func must check loadingAborted() regularly and return
+    /// when it is true.
+    void startLoading( LoadFunc func, void *data );
+
+    /// Returns true if the image is being destroyed and loading should
+    /// stop.
+    inline bool loadingAborted() {
+      return Atomic::load( &abort_loading ) != 0;
+    }
+
+    /// Wait for the thread started with startLoading to finish.
+    void waitForLoading();
+
+    /// \name Functions used by loaders.
+    /// @{
+
+    /// Returns the level used as preview while loading. It is the finest
+    /// level with at most 32 pixels in each dimension.
+    inline unsigned int getPreviewLevel() {
+      return preview_level;
+    }
+
+    /// Returns the preview image. It has the size of the preview level.
+    inline PixelImage *getPreview() {
+      return preview.get();
+    }
+
+    /// Returns the slice of the full resolution image used to compute
+    /// slice preview_z of the preview level.
+    unsigned int getPreviewSourceSlice( unsigned int preview_z );
+
+    /// Set slice preview_z of the preview from the full resolution slice
+    /// returned by getPreviewSourceSlice. The preview slice is the average
+    /// of blocks of pixels in the full resolution slice.
+    void setPreviewSlice( unsigned int preview_z,
+                          const unsigned char *slice_data );
+
+    /// Mark the preview as complete after all of its slices have been set.
+    /// Does nothing if a finer level is already complete.
+    void setPreviewDone();
+
+    /// Tell the image that the full resolution data for the next
+    /// nr_slices slices has been written to the data of level 0. The
+    /// coarser levels are updated with the new slices, and when all slices
+    /// have been added all levels are complete. Only the loading thread
+    /// may call it.
+    void slicesAdded( unsigned int nr_slices );
+
+    /// Returns the number of full resolution slices that have been added.
+    inline unsigned int getNrAddedSlices() {
+      return (unsigned int) Atomic::load( &nr_added_slices );
+    }
+
+    /// Mark the loading of the image as failed.
+    inline void setLoadFailed() {
+      Atomic::store( &load_failed, 1 );
+    }
+
+    /// @}
+
+  protected:
+    /// Returns the level to sample or NULL if no level is complete.
+    PixelImage *getSampleLevel();
+
+    /// Compute slices [begin, end) of level from the level before it.
+    void buildSlices( unsigned int level,
+                      unsigned int begin,
+                      unsigned int end );
+
+    /// The function run by the loading thread.
+    static void *loadThreadFunc( void *data );
+
+    /// The levels of the image.
+    std::vector< AutoRef< PixelImage > > levels;
+
+    /// The number of complete slices in each level. Only used by the
+    /// loading thread.
+    std::vector< unsigned int > nr_complete_slices;
+
+    /// The number of complete slices in level 0, readable from any thread.
+    volatile int nr_added_slices;
+
+    /// The level used for preview.
+    unsigned int preview_level;
+
+    /// The preview sampled until level 0 is complete. The same image as
+    /// the preview level if that is level 0.
+    AutoRef< PixelImage > preview;
+
+    /// The level that is sampled, see getFinestCompleteLevel.
+    volatile int finest_complete_level;
+
+    /// The number of preview slices that have been set.
+    volatile int nr_preview_slices;
+
+    /// 1 if loading failed.
+    volatile int load_failed;
+
+    /// 1 when the loading thread should stop.
+    volatile int abort_loading;
+
+    /// The loading thread, if any.
+    SimpleThread *load_thread;
+
+    /// The function and data for the loading thread.
+    LoadFunc load_func;
+    void *load_data;
+  };
+}
+
+#endif
@@ -0,0 +1,235 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file NrrdStream.h
+/// \brief Header file for NrrdReader and NrrdWriter, reading and writing
+/// Nrrd files a few slices at a time.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __NRRDSTREAM_H__
+#define __NRRDSTREAM_H__
+
+#include <H3DUtil/Image.h>
+#include <fstream>
+
+namespace H3DUtil {
+
+  /// NrrdReader reads the data of a Nrrd file a few slices at a time, so
+  /// that volumes that do not fit in memory can be processed. It does not
+  /// use teem. The raw and gzip encodings are supported, in files with
+  /// attached or detached headers, together with the byte skip, line skip
+  /// and endian fields. The axes are interpreted in the same way as by
+  /// loadNrrdFile.
+  ///
+  /// Example, cropping a volume out-of-core:
+  /// \code
+  /// NrrdReader reader;
+  /// NrrdWriter writer;
+  /// if( reader.open( "in.nrrd" ) &&
+  ///     writer.open( "out.nrrd", reader.width(), reader.height(), 10,
+  ///                  reader.bitsPerPixel(), reader.pixelType(),
+  ///                  reader.pixelComponentType(), reader.pixelSize() ) ) {
+  ///   vector< unsigned char > slice( reader.sliceSize() );
+  ///   reader.skipSlices( 100 );
+  ///   for( int z = 0; z < 10; ++z ) {
+  ///     reader.readSlices( &slice[0], 1 );
+  ///     writer.writeSlices( &slice[0], 1 );
+  ///   }
+  ///   writer.close();
+  /// }
+  /// \endcode
+  class H3DUTIL_API NrrdReader {
+  public:
+    /// Constructor.
+    NrrdReader();
+
+    /// Destructor.
+    ~NrrdReader();
+
+    /// Read the header of a Nrrd file and prepare for reading its data.
+    /// Returns false and prints a warning if the file could not be read or
+    /// uses features that are not supported.
+    bool open( const string &url );
+
+    /// Close the file.
+    void close();
+
+    /// Returns true if a file is open.
+    inline bool isOpen() { return is_open; }
+
+    /// Returns the width of the image in the file.
+    inline unsigned int width() { return w; }
+
+    /// Returns the height of the image in the file.
+    inline unsigned int height() { return h; }
+
+    /// Returns the depth of the image in the file.
+    inline unsigned int depth() { return d; }
+
+    /// Returns the number of bits per pixel of the image in the file.
+    inline unsigned int bitsPerPixel() { return bits_per_pixel; }
+
+    /// Returns the pixel type of the image in the file.
+    inline Image::PixelType pixelType() { return pixel_type; }
+
+    /// Returns the pixel component type of the image in the file.
+    inline Image::PixelComponentType pixelComponentType() {
+      return pixel_component_type;
+    }
+
+    /// Returns the size of a pixel in the file.
+    inline Vec3f pixelSize() { return pixel_size; }
+
+    /// Returns the number of bytes in a slice.
+    inline size_t sliceSize() {
+      return ( (size_t) w * h * bits_per_pixel ) / 8;
+    }
+
+    /// Returns the index of the next slice that will be read.
+    inline unsigned int getNextSlice() { return next_slice; }
+
+    /// Read the next nr_slices slices into data, which must have room
+    /// for nr_slices * sliceSize() bytes. The values are converted to the
+    /// endianness of the machine. Returns false if the data could not be
+    /// read.
+    bool readSlices( unsigned char *data, unsigned int nr_slices );
+
+    /// Skip the next nr_slices slices. For compressed files the slices
+    /// are decompressed and discarded.
+    bool skipSlices( unsigned int nr_slices );
+
+    /// Returns true if seekSlice can be used, i.e. if the data is not
+    /// compressed.
+    inline bool isSeekable() { return is_open && !compressed; }
+
+    /// Set the next slice to read. Only works if isSeekable() is true.
+    bool seekSlice( unsigned int z );
+
+  protected:
+    struct InflateState;
+
+    /// Read size bytes of data from the file, decompressing it if needed.
+    bool readData( unsigned char *data, size_t size );
+
+    /// The stream the data is read from.
+    ifstream is;
+
+    /// The url of the file with the data, used in warnings.
+    string data_url;
+
+    /// Position in the file of the first slice when not compressed.
+    streamoff data_offset;
+
+    bool is_open;
+    bool compressed;
+    /// true if the endianness of the file differs from the machine.
+    bool swap_bytes;
+    unsigned int bytes_per_component;
+    unsigned int w, h, d;
+    unsigned int bits_per_pixel;
+    Image::PixelType pixel_type;
+    Image::PixelComponentType pixel_component_type;
+    Vec3f pixel_size;
+    unsigned int next_slice;
+
+    /// The state of the decompression of compressed data.
+    InflateState *inflate_state;
+
+  private:
+    // Not copyable.
+    NrrdReader( const NrrdReader & );
+    NrrdReader &operator=( const NrrdReader & );
+  };
+
+  /// NrrdWriter writes a Nrrd file a few slices at a time, so that an
+  /// image does not have to be in memory at once to be saved. It does not
+  /// use teem. The file has an attached header and raw or gzip encoding.
+  /// See NrrdReader for an example.
+  class H3DUTIL_API NrrdWriter {
+  public:
+    /// Constructor.
+    NrrdWriter();
+
+    /// Destructor. Closes the file if it is open.
+    ~NrrdWriter();
+
+    /// Create a file and write the header for an image with the given
+    /// format. If compress is true the data is gzip compressed. Returns
+    /// false and prints a warning if the format cannot be saved or the file
+    /// could not be created.
+    bool open( const string &filename,
+               unsigned int width,
+               unsigned int height,
+               unsigned int depth,
+               unsigned int bits_per_pixel,
+               Image::PixelType pixel_type,
+               Image::PixelComponentType pixel_component_type,
+               const Vec3f &pixel_size,
+               bool compress = false );
+
+    /// Write the next nr_slices slices of the image from data. Returns
+    /// false on error or if it would write more slices than the image has.
+    bool writeSlices( const unsigned char *data, unsigned int nr_slices );
+
+    /// Finish and close the file. Returns false if not all slices have
+    /// been written or if writing the file failed.
+    bool close();
+
+    /// Returns true if a file is open.
+    inline bool isOpen() { return is_open; }
+
+    /// Returns the number of bytes in a slice.
+    inline size_t sliceSize() {
+      return ( (size_t) w * h * bits_per_pixel ) / 8;
+    }
+
+    /// Returns the index of the next slice that will be written.
+    inline unsigned int getNextSlice() { return next_slice; }
+
+  protected:
+    struct DeflateState;
+
+    /// Write size bytes of data to the file, compressing it if needed.
+    /// If finish is true the compressed stream is ended.
+    bool writeData( const unsigned char *data, size_t size, bool finish );
+
+    ofstream os;
+    string filename;
+    bool is_open;
+    bool compressed;
+    unsigned int w, h, d;
+    unsigned int bits_per_pixel;
+    unsigned int next_slice;
+
+    /// The state of the compression of compressed data.
+    DeflateState *deflate_state;
+
+  private:
+    // Not copyable.
+    NrrdWriter( const NrrdWriter & );
+    NrrdWriter &operator=( const NrrdWriter & );
+  };
+}
+
+#endif
@@ -0,0 +1,326 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file PagedImage.h
+/// \brief Header file for PagedImage, an image that keeps only some of
+/// its slices in memory.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __PAGEDIMAGE_H__
+#define __PAGEDIMAGE_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/Exception.h>
+#include <H3DUtil/Atomic.h>
+#include <H3DUtil/NrrdStream.h>
+#include <list>
+#include <vector>
+
+namespace H3DUtil {
+
+  /// \class PagedImage
+  /// An image that is too large to be kept in memory. The image is read
+  /// one z-slice at a time from a SliceSource when needed and at most
+  /// as many slices as fit in the memory budget are kept in memory. When
+  /// a slice is needed and the budget is used, the least recently used
+  /// slice is discarded.
+  ///
+  /// When consecutive slices are accessed in increasing or decreasing
+  /// order, the next slices in the same direction are read in advance by
+  /// the default ThreadPool so that e.g. a loop over all slices does not
+  /// have to wait for the file.
+  ///
+  /// getElement, getSample and getSamples work as for other images, but
+  /// getImageData returns NULL since the whole image is never in memory.
+  /// The image is read-only, setElement does nothing. Functions that
+  /// need the image data, e.g. convertToNormalizedFloatData, return NULL.
+  /// All functions can be called from several threads at once.
+  class H3DUTIL_API PagedImage: public Image {
+  public:
+    /// Thrown by the SliceSource constructors if the source could not be
+    /// opened.
+    H3D_VALUE_EXCEPTION( string, CouldNotOpenSource );
+
+    /// The source of the slices of a PagedImage.
+    class H3DUTIL_API SliceSource {
+    public:
+      /// Destructor.
+      virtual ~SliceSource() {}
+
+      /// Read slice z into data, which has room for one slice. The slices
+      /// of the image are ordered in the same way as by loadRawImage,
+      /// loadNrrdFile and loadDicomFile. Returns false on failure. Calls
+      /// are never made concurrently.
+      virtual bool readSlice( unsigned int z, unsigned char *data ) = 0;
+
+      unsigned int width, height, depth;
+      unsigned int bits_per_pixel;
+      PixelType pixel_type;
+      PixelComponentType pixel_component_type;
+      Vec3f pixel_size;
+    };
+
+    /// SliceSource reading an uncompressed raw file, e.g. the files read
+    /// by loadRawImage.
+    class H3DUTIL_API RawSliceSource: public SliceSource {
+    public:
+      /// Constructor. Throws CouldNotOpenSource if the file could not be
+      /// opened or is smaller than the image.
+      /// \param offset The position in the file of the first slice.
+      RawSliceSource( const string &filename,
+                      unsigned int width,
+                      unsigned int height,
+                      unsigned int depth,
+                      unsigned int bits_per_pixel,
+                      PixelType pixel_type,
+                      PixelComponentType pixel_component_type,
+                      const Vec3f &pixel_size = Vec3f( 0, 0, 0 ),
+                      H3DUInt64 offset = 0 );
+
+      virtual bool readSlice( unsigned int z, unsigned char *data );
+
+    protected:
+      ifstream is;
+      string filename;
+      H3DUInt64 offset;
+    };
+
+    /// SliceSource reading a Nrrd file with NrrdReader. Compressed files
+    /// are decompressed from the start of the data again when a slice
+    /// before the last read slice is needed, so they are best accessed in
+    /// increasing z order.
+    class H3DUTIL_API NrrdSliceSource: public SliceSource {
+    public:
+      /// Constructor. Throws CouldNotOpenSource if the file could not be
+      /// opened.
+      NrrdSliceSource( const string &url );
+
+      virtual bool readSlice( unsigned int z, unsigned char *data );
+
+    protected:
+      string url;
+      NrrdReader reader;
+    };
+
+#ifdef HAVE_DCMTK
+    /// SliceSource reading a DICOM series where each file is a slice.
+    class H3DUTIL_API DicomSliceSource: public SliceSource {
+    public:
+      /// Constructor. Uses the files of the series that url is part of, in
+      /// the same order as loadDicomFile. Throws CouldNotOpenSource if
+      /// no files were found or the first file could not be read.
+      DicomSliceSource( const string &url );
+
+      /// Constructor. Uses the given files as the slices of the image, in
+      /// the given order. Throws CouldNotOpenSource if files is empty or
+      /// the first file could not be read.
+      DicomSliceSource( const vector< string > &files );
+
+      virtual bool readSlice( unsigned int z, unsigned char *data );
+
+    protected:
+      /// Get the format of the image from the first file.
+      void init();
+
+      vector< string > files;
+    };
+#endif
+
+    /// Constructor.
+    /// \param source The source of the slices. It is deleted by the image.
+    /// \param memory_budget The maximum number of bytes used for slices.
+    /// At least one slice is always kept in memory.
+    /// \param prefetch_slices The number of slices to read in advance when
+    /// slices are accessed in order. 0 disables reading in advance.
+    PagedImage( SliceSource *source,
+                size_t memory_budget = 256 * 1024 * 1024,
+                unsigned int prefetch_slices = 2 );
+
+    /// Destructor. Waits for slices being read in advance.
+    virtual ~PagedImage();
+
+    virtual unsigned int width() { return source->width; }
+    virtual unsigned int height() { return source->height; }
+    virtual unsigned int depth() { return source->depth; }
+    virtual unsigned int bitsPerPixel() { return source->bits_per_pixel; }
+    virtual Vec3f pixelSize() { return source->pixel_size; }
+    virtual PixelType pixelType() { return source->pixel_type; }
+    virtual PixelComponentType pixelComponentType() {
+      return source->pixel_component_type;
+    }
+
+    /// Returns NULL since the image data is never in memory at once.
+    virtual void *getImageData() { return NULL; }
+
+    /// Get the value of a pixel/voxel. The slice is read if it is not in
+    /// memory. The value is set to 0 if the slice could not be read.
+    virtual void getElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    /// Does nothing since the image is read-only.
+    virtual void setElement( void *value, int x = 0, int y = 0, int z = 0 ) {}
+
+    using Image::readRegion;
+    using Image::writeRegion;
+
+    /// Copy the pixels in a box of the image to data. See
+    /// Image::readRegion. Each slice of the box is read once. Pixels in
+    /// slices that could not be read are set to 0.
+    virtual void readRegion( void *data,
+                             unsigned int x, unsigned int y, unsigned int z,
+                             unsigned int w, unsigned int h, unsigned int d );
+
+    /// Does nothing since the image is read-only.
+    virtual void writeRegion( const void *data,
+                              unsigned int x, unsigned int y, unsigned int z,
+                              unsigned int w, unsigned int h,
+                              unsigned int d ) {}
+
+    /// Copy slice z to data, which must have room for sliceSize() bytes.
+    /// Returns false if the slice could not be read.
+    bool getSlice( unsigned int z, unsigned char *data );
+
+    /// Returns the number of bytes in a slice.
+    inline size_t sliceSize() {
+      return ( (size_t) width() * height() * bitsPerPixel() ) / 8;
+    }
+
+    /// Set the maximum number of bytes used for slices. Slices are
+    /// discarded if needed.
+    void setMemoryBudget( size_t memory_budget );
+
+    /// Returns the maximum number of bytes used for slices.
+    inline size_t getMemoryBudget() { return memory_budget; }
+
+    /// Set the number of slices read in advance.
+    void setPrefetchSlices( unsigned int nr_slices );
+
+    /// Returns the number of slices in memory.
+    unsigned int getNrResidentSlices();
+
+    /// Returns the number of slices that have been read from the source.
+    inline unsigned int getNrSliceReads() {
+      return (unsigned int) Atomic::load( &nr_slice_reads );
+    }
+
+  protected:
+    /// The state of a slice.
+    typedef enum {
+      NOT_RESIDENT,
+      /// A task reading the slice in advance has been added to the
+      /// ThreadPool but has not started. A thread needing the slice before
+      /// that reads it itself, so that it never waits for a task that
+      /// might be queued behind itself.
+      PREFETCH_QUEUED,
+      LOADING,
+      RESIDENT
+    } SliceState;
+
+    struct Slice {
+      Slice(): state( NOT_RESIDENT ), data( NULL ), nr_users( 0 ) {}
+      SliceState state;
+      unsigned char *data;
+      /// The number of threads using data. A slice is only discarded when
+      /// it is unused.
+      unsigned int nr_users;
+      /// The position of the slice in lru if it is resident.
+      std::list< unsigned int >::iterator lru_position;
+    };
+
+    /// Data for a task reading a slice in advance.
+    struct PrefetchTask {
+      PagedImage *image;
+      unsigned int z;
+    };
+
+    /// Returns the data of slice z and marks it as used, reading it if
+    /// needed. Returns NULL if the slice could not be read. releaseSlice
+    /// must be called when done with the data.
+    unsigned char *acquireSlice( unsigned int z );
+
+    /// Mark slice z as unused.
+    void releaseSlice( unsigned int z );
+
+    /// Read slice z, which must be in the LOADING state, from the source
+    /// and make it resident. If use is true the slice is marked as used as
+    /// by acquireSlice. Called without slice_lock held.
+    bool loadSlice( unsigned int z, bool use );
+
+    /// Update the direction of the accesses when slice z is accessed and
+    /// start reading slices in advance if the accesses are in order.
+    /// Called with slice_lock held.
+    void updateAccessDirection( unsigned int z );
+
+    /// Start reading the slices after z in direction dir in advance.
+    /// Called with slice_lock held.
+    void prefetch( unsigned int z, int dir );
+
+    /// Discard the least recently used unused slices until the memory
+    /// budget is met. Called with slice_lock held.
+    void discardSlices();
+
+    /// ThreadPool task function reading a slice in advance.
+    static void prefetchTask( void *data );
+
+    /// The source of the slices.
+    SliceSource *source;
+
+    /// Serializes the calls to source.
+    MutexLock source_lock;
+
+    /// Lock for all members below. Threads wait on it for slices being
+    /// read by other threads.
+    ConditionLock slice_lock;
+
+    std::vector< Slice > slices;
+
+    /// The resident slices, most recently used first.
+    std::list< unsigned int > lru;
+
+    size_t memory_budget;
+    unsigned int max_resident_slices;
+    unsigned int prefetch_slices;
+
+    /// The last two different slices accessed and the direction of the
+    /// accesses. Going back to the slice before the last one, as when
+    /// interpolating between two slices, does not change the direction.
+    int last_z;
+    int previous_z;
+    int direction;
+
+    /// The number of prefetch tasks that have not finished.
+    unsigned int nr_prefetch_tasks;
+
+    /// Set by the destructor to make queued prefetch tasks do nothing.
+    bool destroying;
+
+    volatile int nr_slice_reads;
+
+  private:
+    // Not copyable.
+    PagedImage( const PagedImage & );
+    PagedImage &operator=( const PagedImage & );
+  };
+}
+
+#endif
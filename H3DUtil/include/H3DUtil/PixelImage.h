@@ -111,24 +111,94 @@ namespace H3DUtil {
       return pixel_component_type;
     }
         
-    /// Returns a pointer to the raw image data. 
+    /// Returns a pointer to the raw image data. The order of the pixels
+    /// is given by dataLayout().
     virtual void *getImageData() {
       return image_data;
     }
 
+    /// Returns the layout of the data returned by getImageData.
+    virtual DataLayout dataLayout() {
+      return data_layout;
+    }
+
+    /// Change the layout of the image data. The data is reordered to the
+    /// new layout.
+    ///
+    /// In BRICKED_LAYOUT the image is divided into bricks of
+    /// brick_size * brick_size * brick_size pixels(or brick_size * 
+    /// brick_size for 2D images). The pixels within a brick are stored 
+    /// in linear order and the bricks are stored one after the other in
+    /// linear order. This keeps neighbouring pixels in all directions
+    /// close in memory which makes random access sampling of large volumes
+    /// a lot more cache friendly. The image data is padded to a whole 
+    /// number of bricks in each direction.
+    ///
+    /// \param layout The new layout.
+    /// \param brick_size The size of the bricks in each direction. Must 
+    /// be a power of two.
+    void setDataLayout( DataLayout layout, unsigned int brick_size = 8 );
+
+    /// Returns the size of the bricks in BRICKED_LAYOUT.
+    inline unsigned int brickSize() {
+      return 1 << brick_shift;
+    }
+
+    /// Copy the image data in LINEAR_LAYOUT to data, regardless of the
+    /// current layout. data must have room for the whole image.
+    void getLinearImageData( unsigned char *data );
+
+    /// Get the value of a pixel/voxel. See Image::getElement.
+    virtual void getElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    /// Set the value of a pixel/voxel. See Image::setElement.
+    virtual void setElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    using Image::readRegion;
+    using Image::writeRegion;
+
+    /// Copy the pixels in a box of the image to data. See
+    /// Image::readRegion. In BRICKED_LAYOUT the part of each row within
+    /// a brick is copied at a time.
+    virtual void readRegion( void *data,
+                             unsigned int x, unsigned int y, unsigned int z,
+                             unsigned int w, unsigned int h, unsigned int d );
+
+    /// Set the pixels in a box of the image from data. See
+    /// Image::writeRegion.
+    virtual void writeRegion( const void *data,
+                              unsigned int x, unsigned int y, unsigned int z,
+                              unsigned int w, unsigned int h, unsigned int d );
+
+    /// Sample the image at n normalized positions. See Image::getSamples.
+    virtual void getSamples( const Vec3f *coords,
+                             size_t n,
+                             H3DUtil::RGBA *values,
+                             FilterType filter_type = LINEAR );
+
+    /// Sample the first color component of the image at n normalized 
+    /// positions. See Image::getSamples.
+    virtual void getSamples( const Vec3f *coords,
+                             size_t n,
+                             H3DFloat *values,
+                             FilterType filter_type = LINEAR );
+
     /// Set the height of the image in pixels.
     virtual void setHeight( unsigned int height ) {
       h = height;
+      imageDataChanged();
     }
 
     /// Set the width of the image in pixels.
     virtual void setWidth( unsigned int width ) {
       w = width;
+      imageDataChanged();
     }
 
     /// Set the depth of the image in pixels.
     virtual void setDepth( unsigned int depth ) {
       d = depth;
+      imageDataChanged();
     }
 
 
@@ -140,21 +210,26 @@ namespace H3DUtil {
     /// Set the number of bits used for each pixel in the image.
     virtual void setbitsPerPixel( unsigned int b ) {
       bits_per_pixel = b;
+      imageDataChanged();
     }
 
     /// Set the PixelType of the image.
     virtual void setPixelType( const PixelType &pt) {
       pixel_type = pt;
+      imageDataChanged();
     }
         
     /// Set the PixelComponentType of the image.
     virtual void setPixelComponentType( const PixelComponentType &pct ) {
       pixel_component_type = pct;
+      imageDataChanged();
     }
         
-    /// Set a pointer to the raw image data. 
+    /// Set a pointer to the raw image data. The data must be in 
+    /// LINEAR_LAYOUT.
     virtual void setImageData( unsigned char * data, bool copy_data = false ) {
-      if( image_data ) delete[] image_data;
+      if( image_data ) deleteImageData( image_data );
+      data_layout = LINEAR_LAYOUT;
       if( copy_data ) {
         unsigned int size = (w * h * d * bits_per_pixel)/8;
         image_data = new unsigned char[ size ];
@@ -162,6 +237,7 @@ namespace H3DUtil {
       } else {
         image_data = data;
       }
+      imageDataChanged();
     }
 
   protected:
@@ -171,6 +247,40 @@ namespace H3DUtil {
     PixelComponentType pixel_component_type;
     Vec3f pixel_size;
     unsigned char *image_data;
+
+    /// Free memory that has been used for image_data. Subclasses that
+    /// do not allocate image_data with new[] must override this function.
+    /// The destructor of PixelImage always uses delete[] so such subclasses
+    /// must free image_data and set it to NULL in their destructor.
+    virtual void deleteImageData( unsigned char *data ) {
+      delete [] data;
+    }
+
+    /// The layout of image_data.
+    DataLayout data_layout;
+
+    /// log2 of the brick size in BRICKED_LAYOUT.
+    unsigned int brick_shift;
+
+    /// Returns the index of the pixel at the given position in image_data
+    /// when in BRICKED_LAYOUT.
+    inline size_t brickedIndex( unsigned int x, 
+                                unsigned int y, 
+                                unsigned int z ) {
+      unsigned int sx = brick_shift;
+      unsigned int sy = h > 1 ? brick_shift : 0;
+      unsigned int sz = d > 1 ? brick_shift : 0;
+      unsigned int nr_bricks_x = ( w + ( 1 << sx ) - 1 ) >> sx;
+      unsigned int nr_bricks_y = ( h + ( 1 << sy ) - 1 ) >> sy;
+      size_t brick = 
+        ( (size_t)( z >> sz ) * nr_bricks_y + ( y >> sy ) ) * nr_bricks_x + 
+        ( x >> sx );
+      size_t local = 
+        ( ( ( z & ( ( 1 << sz ) - 1 ) ) << sy ) + 
+          ( y & ( ( 1 << sy ) - 1 ) ) ) << sx |
+        ( x & ( ( 1 << sx ) - 1 ) );
+      return ( brick << ( sx + sy + sz ) ) + local;
+    }
   };
 
     
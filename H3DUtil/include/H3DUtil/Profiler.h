@@ -0,0 +1,172 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file Profiler.h
+/// \brief Header file for Profiler, which records the time spent in
+/// zones of code in all threads.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <H3DUtil/H3DUtil.h>
+#include <H3DUtil/H3DBasicTypes.h>
+#include <H3DUtil/TimeStamp.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace H3DUtil {
+
+  /// The Profiler records when zones of code start and end in all threads
+  /// and saves them as a trace that can be viewed with a trace event
+  /// viewer, e.g. chrome://tracing in Chrome.
+  ///
+  /// A zone is recorded with a Profiler::Zone or the
+  /// H3DUTIL_PROFILE_ZONE macro, from its construction to the end of the
+  /// scope. PeriodicThread records each loop of the thread and each
+  /// callback as zones, so the time of a haptic loop can be broken down.
+  /// Recording is off until setEnabled( true ) is called, and a zone then
+  /// costs a check of a flag.
+  ///
+  /// Each thread records into its own ring buffer without locks. When the
+  /// buffer is full the oldest events are overwritten. The buffer of a
+  /// thread is allocated the first time it records a zone and is kept
+  /// until the program exits, so that the zones of threads that have
+  /// exited can still be saved.
+  class H3DUTIL_API Profiler {
+  public:
+    /// Records the time from construction to destruction as a zone.
+    /// \code
+    /// void HapticDevice::updateForces() {
+    ///   H3DUTIL_PROFILE_ZONE( "updateForces" );
+    ///   ...
+    /// }
+    /// \endcode
+    class Zone {
+    public:
+      /// Constructor.
+      /// \param _name The name of the zone. The pointer is stored, so it
+      /// must point to a string that exists until the trace is saved,
+      /// e.g. a string literal.
+      /// \param _id A number saved with the zone, -1 for none.
+      Zone( const char *_name, int _id = -1 ):
+        name( _name ),
+        id( _id ),
+        start( isEnabled() ? TimeStamp::getMonotonicNanoseconds() : -1 ) {
+      }
+
+      /// Destructor.
+      ~Zone() {
+        if( start >= 0 ) {
+          record( name, start, TimeStamp::getMonotonicNanoseconds(), id );
+        }
+      }
+
+    protected:
+      const char *name;
+      int id;
+      H3DInt64 start;
+    };
+
+    /// Enable or disable recording.
+    static void setEnabled( bool enabled );
+
+    /// Returns true if zones are recorded.
+    static inline bool isEnabled() {
+      return enabled != 0;
+    }
+
+    /// Record a zone in the calling thread.
+    /// \param name The name of the zone. See Zone.
+    /// \param start The start of the zone in the time of
+    /// TimeStamp::getMonotonicNanoseconds.
+    /// \param end The end of the zone.
+    /// \param id A number saved with the zone, -1 for none.
+    static void record( const char *name, H3DInt64 start, H3DInt64 end,
+                        int id = -1 );
+
+    /// Set the number of zones each thread buffer holds. Only affects
+    /// buffers allocated after the call.
+    static void setBufferSize( unsigned int nr_zones );
+
+    /// Set the name of a thread in the trace. ThreadBase::setThreadName
+    /// calls this function.
+    static void setThreadName( pthread_t thread, const std::string &name );
+
+    /// Forget all zones recorded so far.
+    static void clear();
+
+    /// Write the recorded zones in the Chrome trace event JSON format.
+    /// Can be called while zones are recorded.
+    static void writeChromeTrace( std::ostream &os );
+
+    /// Write the recorded zones to a file in the Chrome trace event JSON
+    /// format. Returns false if the file could not be written.
+    static bool saveChromeTrace( const std::string &filename );
+
+  protected:
+    /// A recorded zone.
+    struct Event {
+      const char *name;
+      int id;
+      H3DInt64 start;
+      H3DInt64 end;
+    };
+
+    /// The ring buffer of a thread.
+    struct ThreadBuffer {
+      /// The thread.
+      pthread_t thread;
+      /// The number used for the thread in the trace.
+      int tid;
+      /// The events. The size is a power of two.
+      std::vector< Event > events;
+      /// The number of events written. Only changed by the thread.
+      volatile int nr_written;
+      /// The value of nr_written when clear was last called.
+      volatile int nr_cleared;
+    };
+
+    /// Returns the buffer of the calling thread, allocating it if needed.
+    static ThreadBuffer *getThreadBuffer();
+
+    static volatile int enabled;
+
+    /// The buffers of all threads that have recorded a zone.
+    static std::vector< ThreadBuffer * > buffers;
+  };
+}
+
+#define H3DUTIL_PROFILE_CONCAT2( a, b ) a##b
+#define H3DUTIL_PROFILE_CONCAT( a, b ) H3DUTIL_PROFILE_CONCAT2( a, b )
+
+/// Record the time from this line to the end of the scope as a zone with
+/// the given name. See Profiler.
+#define H3DUTIL_PROFILE_ZONE( name ) \
+  H3DUtil::Profiler::Zone \
+  H3DUTIL_PROFILE_CONCAT( h3dutil_profile_zone_, __LINE__ )( name )
+
+#endif
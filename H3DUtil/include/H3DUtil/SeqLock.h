@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file SeqLock.h
+/// \brief Header file for SeqLock, a value that is written by one thread
+/// and read by others without locks.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __SEQLOCK_H__
+#define __SEQLOCK_H__
+
+#include <H3DUtil/Atomic.h>
+
+namespace H3DUtil {
+
+  /// SeqLock holds a value that is set by one thread and read by any
+  /// number of threads without locks, e.g. a device position or force
+  /// set each loop of a haptic thread and read by the graphics thread.
+  /// setValue never waits and getValue always returns the latest value
+  /// that has been completely set.
+  ///
+  /// The value is kept in two buffers, each with a sequence number that
+  /// is odd while the buffer is being written. setValue writes to the
+  /// buffer not holding the latest value and then makes it the latest.
+  /// getValue copies the latest buffer and copies it again if its
+  /// sequence number changed during the copy, which only happens if
+  /// setValue was called twice during the copy.
+  ///
+  /// Since a reader might copy a value while it is being written, T must
+  /// be a type that can be copied in any state, such as Vec3f, Matrix4f,
+  /// Rotation or a struct of such values, and not a type that owns memory
+  /// such as std::vector.
+  template< class T >
+  class SeqLock {
+  public:
+    /// Constructor.
+    SeqLock( const T &value = T() ):
+      latest( 0 ) {
+      buffers[0].sequence = 0;
+      buffers[0].value = value;
+      buffers[1].sequence = 0;
+      buffers[1].value = value;
+    }
+
+    /// Set the value. Must only be called from one thread at a time.
+    void setValue( const T &value ) {
+      Buffer &buffer = buffers[ ( latest + 1 ) & 1 ];
+      Atomic::increment( &buffer.sequence );
+      buffer.value = value;
+      Atomic::increment( &buffer.sequence );
+      Atomic::increment( &latest );
+    }
+
+    /// Get the latest value.
+    void getValue( T &value ) {
+      for( ; ; ) {
+        Buffer &buffer = buffers[ Atomic::load( &latest ) & 1 ];
+        int sequence = Atomic::load( &buffer.sequence );
+        if( sequence & 1 ) continue;
+        value = buffer.value;
+        Atomic::memoryBarrier();
+        if( buffer.sequence == sequence ) return;
+      }
+    }
+
+    /// Get the latest value.
+    T getValue() {
+      T value;
+      getValue( value );
+      return value;
+    }
+
+    /// Returns the number of times setValue has been called. Can be used to
+    /// check if there is a new value.
+    unsigned int getVersion() {
+      return (unsigned int) Atomic::load( &latest );
+    }
+
+  protected:
+    struct Buffer {
+      /// Incremented before and after value is changed, i.e. odd while it
+      /// is being changed.
+      volatile int sequence;
+      T value;
+    };
+
+    Buffer buffers[2];
+
+    /// The number of times setValue has been called. The latest value is
+    /// in buffers[ latest & 1 ].
+    volatile int latest;
+
+  private:
+    // Not copyable.
+    SeqLock( const SeqLock & );
+    SeqLock &operator=( const SeqLock & );
+  };
+}
+
+#endif
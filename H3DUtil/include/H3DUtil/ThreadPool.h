@@ -0,0 +1,230 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ThreadPool.h
+/// \brief Header file for ThreadPool, a pool of worker threads for
+/// running tasks in parallel.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <H3DUtil/Threads.h>
+#include <deque>
+
+namespace H3DUtil {
+
+  /// ThreadPool is a set of worker threads that execute tasks in parallel.
+  /// It is intended for CPU bound work that can be split up in smaller
+  /// parts, e.g. resampling or converting image data.
+  ///
+  /// Each worker thread has its own queue of tasks. Tasks added from a
+  /// worker thread are put in the queue of that thread and tasks added
+  /// from other threads are distributed between the queues. A worker takes
+  /// the latest added task from its own queue and when it is empty it
+  /// steals the oldest task from the queue of another worker.
+  ///
+  /// Example:
+  /// \code
+  /// void scale( int begin, int end, void *data ) {
+  ///   float *values = static_cast< float * >( data );
+  ///   for( int i = begin; i < end; ++i ) values[i] *= 2;
+  /// }
+  ///
+  /// ThreadPool::getDefaultPool()->parallelFor( 0, size, scale, values );
+  /// \endcode
+  class H3DUTIL_API ThreadPool: public ThreadBase {
+  protected:
+    struct TaskState;
+
+  public:
+    /// Task function type.
+    typedef void (*TaskFunc)( void *data );
+
+    /// Function type for parallelFor. The function should process the
+    /// indices in [begin, end).
+    typedef void (*RangeFunc)( int begin, int end, void *data );
+
+    /// A Future is a handle to a task added with addTask. It can be used
+    /// to check if the task is done or to wait for it to finish.
+    class H3DUTIL_API Future {
+    public:
+      /// Constructor. Creates a Future that is not connected to any task.
+      Future();
+
+      /// Copy constructor.
+      Future( const Future &f );
+
+      /// Destructor.
+      ~Future();
+
+      /// Assignment operator.
+      Future &operator=( const Future &f );
+
+      /// Returns true if the Future is connected to a task.
+      inline bool isValid() const { return state != NULL; }
+
+      /// Returns true if the task has finished executing. A Future that
+      /// is not connected to a task is always done.
+      bool isDone() const;
+
+      /// Wait until the task has finished executing. If called from a
+      /// worker thread of the pool other tasks are executed while waiting
+      /// in order to avoid dead locks.
+      void wait() const;
+
+    protected:
+      friend class ThreadPool;
+
+      /// Constructor.
+      Future( TaskState *_state, ThreadPool *_pool );
+
+      /// The state of the task.
+      TaskState *state;
+
+      /// The pool the task was added to.
+      ThreadPool *pool;
+    };
+
+    /// Constructor.
+    /// \param nr_threads The number of worker threads. If below 1 the
+    /// number of processors in the system is used.
+    ThreadPool( int nr_threads = -1 );
+
+    /// Destructor. Waits for all tasks that have been added to finish
+    /// before the worker threads are stopped.
+    virtual ~ThreadPool();
+
+    /// Add a task to be executed by one of the worker threads.
+    /// Returns a Future that can be used to wait for the task.
+    Future addTask( TaskFunc func, void *data );
+
+    /// Call func for all indices in [begin, end) split up in ranges that
+    /// are executed in parallel. The calling thread also executes ranges
+    /// and the function does not return until all ranges are done.
+    /// \param begin The first index.
+    /// \param end One past the last index.
+    /// \param func The function to call for each range.
+    /// \param data Data passed to func.
+    /// \param grain_size The number of indices in each range. If below 1
+    /// it is chosen depending on the number of threads in the pool.
+    void parallelFor( int begin, int end,
+                      RangeFunc func, void *data,
+                      int grain_size = 0 );
+
+    /// Returns the number of worker threads in the pool.
+    inline int getNrThreads() { return (int) workers.size(); }
+
+    /// Returns true if the call was made from one of the worker threads
+    /// of the pool.
+    inline bool inPoolThread() { return getWorkerIndex() != -1; }
+
+    /// Returns a pool with one thread per processor. It is created the
+    /// first time the function is called and exists as long as the
+    /// program is running.
+    static ThreadPool *getDefaultPool();
+
+    /// Returns the number of processors in the system.
+    static int getHardwareConcurrency();
+
+  protected:
+    /// The shared state between a task and its Futures.
+    struct TaskState {
+      /// Lock used to wait for the task to finish.
+      ConditionLock done_lock;
+      /// 1 when the task has finished.
+      volatile int done;
+      /// The number of Futures and tasks using the state.
+      volatile int ref_count;
+    };
+
+    /// A task in the queue of a worker.
+    struct Task {
+      TaskFunc func;
+      void *data;
+      TaskState *state;
+    };
+
+    /// A worker thread and its queue of tasks.
+    struct Worker {
+      /// The pool the worker belongs to.
+      ThreadPool *pool;
+      /// The index of the worker in workers.
+      int index;
+      /// The id of the thread.
+      ThreadId thread_id;
+      /// Lock for tasks.
+      MutexLock tasks_lock;
+      /// The tasks to execute. The owner adds and removes at the back
+      /// and other workers steal from the front.
+      std::deque< Task > tasks;
+    };
+
+    /// Add a task to the queue of a worker and wake up a sleeping worker.
+    void pushTask( const Task &task );
+
+    /// Remove a task from the queues. The worker with the given index
+    /// takes from its own queue first and then steals from the other
+    /// workers. Returns false if there were no tasks.
+    bool popTask( int worker_index, Task &task );
+
+    /// Execute a task and mark it as done.
+    void runTask( const Task &task );
+
+    /// Returns the index of the worker the call was made from or -1 if
+    /// not called from a worker thread.
+    int getWorkerIndex();
+
+    /// Decrease the reference count of state and delete it if unused.
+    static void releaseState( TaskState *state );
+
+    /// The function run by the worker threads.
+    static void *workerFunc( void *data );
+
+    /// The worker threads.
+    std::vector< Worker * > workers;
+
+    /// The number of tasks in the queues.
+    volatile int nr_queued_tasks;
+
+    /// The number of workers waiting for tasks.
+    volatile int nr_sleeping_workers;
+
+    /// The worker to put the next task added from outside the pool in.
+    volatile int next_worker;
+
+    /// Set to 0 when the pool is destroyed.
+    volatile int running;
+
+    /// Lock used by workers to wait for new tasks.
+    ConditionLock work_lock;
+
+  private:
+    // Not copyable.
+    ThreadPool( const ThreadPool & );
+    ThreadPool &operator=( const ThreadPool & );
+  };
+}
+
+#endif
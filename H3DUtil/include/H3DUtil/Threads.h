@@ -31,6 +31,8 @@
 #define __THREADS_H__
 
 #include <H3DUtil/H3DUtil.h>
+#include <H3DUtil/LockFreeQueue.h>
+#include <H3DUtil/SeqLock.h>
 #include <list>
 #include <vector>
 #include <string>
@@ -113,6 +115,166 @@ namespace H3DUtil {
     pthread_cond_t cond; 
   };
 
+  /// A MutexLock that spins for a while before blocking when the lock is
+  /// taken. The locks shared by the haptic and graphics threads are mostly
+  /// held for short times, and spinning then avoids putting the thread to
+  /// sleep and waking it up again. The number of spins adapts to how long
+  /// the threads have had to spin to get the lock recently, so a lock that
+  /// is held for long times soon stops spinning. No spinning is done on
+  /// single processor systems.
+  ///
+  /// lock is not virtual, so the lock only spins when it is locked through
+  /// an AdaptiveMutexLock and not through a MutexLock reference.
+  class H3DUTIL_API AdaptiveMutexLock: public MutexLock {
+  public:
+    /// Constructor.
+    /// \param _max_spin_count The maximum number of times the lock is
+    /// tried before blocking.
+    AdaptiveMutexLock( unsigned int _max_spin_count = 100 );
+
+    /// Locks the mutex. If already locked, spins and then waits until it is
+    /// unlocked and then locks it.
+    void lock();
+
+  protected:
+    /// The maximum number of times the lock is tried before blocking.
+    int max_spin_count;
+
+    /// Running average of the number of spins needed to get the lock.
+    /// Only changed while holding the lock.
+    volatile int spin_estimate;
+  };
+
+  /// A lock that can be held by several readers at once or by one writer,
+  /// for data that is mostly read. A thread waiting to write is preferred
+  /// over threads that want to start reading, so that e.g. a haptic thread
+  /// writing at 1 kHz is not kept waiting by the graphics thread reading.
+  /// Because of this a thread must not take the read lock again when it
+  /// already holds it.
+  ///
+  /// lock, unlock and tryLock work as for MutexLock and take the lock for
+  /// writing.
+  class H3DUTIL_API ReadWriteLock {
+  public:
+    /// Constructor.
+    ReadWriteLock();
+
+    /// Destructor.
+    ~ReadWriteLock();
+
+    /// Locks for writing. Waits until no other thread holds the lock.
+    void lock();
+
+    /// Unlocks the lock, both when it is held for reading and for writing.
+    void unlock();
+
+    /// Try to lock for writing, if the lock is not available false is
+    /// returned.
+    bool tryLock();
+
+    /// Locks for reading. Waits while another thread holds or is waiting
+    /// to get the lock for writing.
+    void readLock();
+
+    /// Try to lock for reading, if the lock is not available false is
+    /// returned.
+    bool tryReadLock();
+
+  protected:
+    pthread_rwlock_t rwlock;
+  };
+
+  /// A spin lock that is given to the waiting threads in the order they
+  /// asked for it, so no thread can be starved. Meant for critical
+  /// sections of a few instructions. A waiting thread spins, and yields to
+  /// other threads when the lock has not been released after a while.
+  class H3DUTIL_API TicketLock {
+  public:
+    /// Constructor.
+    TicketLock();
+
+    /// Locks the lock. If already locked, waits until it is unlocked and
+    /// then locks it.
+    void lock();
+
+    /// Unlocks the lock.
+    void unlock();
+
+    /// Try to lock the lock, if the lock is not available false is
+    /// returned.
+    bool tryLock();
+
+  protected:
+    /// The ticket the next thread calling lock gets.
+    volatile int next_ticket;
+
+    /// The ticket of the thread that holds or gets the lock.
+    volatile int now_serving;
+
+  private:
+    // Not copyable.
+    TicketLock( const TicketLock & );
+    TicketLock &operator=( const TicketLock & );
+  };
+
+  /// A Barrier makes a group of threads wait for each other. No thread
+  /// returns from wait() until all threads of the group have called it.
+  /// The barrier can be used again directly, a thread that calls wait()
+  /// again after returning waits for the next round.
+  ///
+  /// The barrier is sense-reversing: a round is ended by changing a sense
+  /// value instead of resetting a counter that the waiting threads test,
+  /// so a thread that is slow to leave one round is not confused by
+  /// threads arriving at the next. The sense is a round number rather than
+  /// a flag that flips between two values, so that a slow thread does not
+  /// miss the end of its round if the group changes and later rounds are
+  /// completed without it. Waiting threads check the sense spin_count
+  /// times before blocking, since a round is often over within
+  /// microseconds when the barrier is used between threads running at
+  /// haptic rates.
+  class H3DUTIL_API Barrier {
+  public:
+    /// Constructor.
+    /// \param nr_threads The number of threads in the group.
+    /// \param _spin_count The number of times a waiting thread checks if
+    /// the round is over before blocking.
+    Barrier( unsigned int nr_threads = 1, unsigned int _spin_count = 1000 );
+
+    /// Wait until all threads of the group have called wait. Returns true
+    /// in the last thread to arrive and false in the others.
+    bool wait();
+
+    /// Set the number of threads in the group. Must only be called when
+    /// no thread is waiting.
+    void setNrThreads( unsigned int nr_threads );
+
+    /// Returns the number of threads in the group.
+    inline unsigned int getNrThreads() {
+      return (unsigned int) Atomic::load( &nr_threads );
+    }
+
+  protected:
+    /// The number of threads in the group.
+    volatile int nr_threads;
+
+    /// The number of threads that have arrived in the current round.
+    volatile int nr_arrived;
+
+    /// Incremented when a round is over.
+    volatile int sense;
+
+    /// The number of checks before blocking.
+    unsigned int spin_count;
+
+    /// Lock and condition for threads that block.
+    ConditionLock lock;
+
+  private:
+    // Not copyable.
+    Barrier( const Barrier & );
+    Barrier &operator=( const Barrier & );
+  };
+
  
   /// The abstract base class for threads.
   class H3DUTIL_API ThreadBase {
@@ -144,12 +306,14 @@ namespace H3DUtil {
     /// Returns the thread id for this thread.
     inline ThreadId getThreadId() { return thread_id; }
 
-    /// Only for Windows Visual Studio users. Sets the name of the 
-    /// thread, specified by id, as it appears in the Visual Studio debugger.
+    /// Sets the name of the thread, specified by id, as it appears in
+    /// traces saved by Profiler and, for Windows Visual Studio users, in
+    /// the Visual Studio debugger.
     static void setThreadName( ThreadId id, const std::string &name );
 
-    /// Only for Windows Visual Studio users. Sets the name of the 
-    /// thread as it appears in the Visual Studio debugger.
+    /// Sets the name of the thread as it appears in traces saved by
+    /// Profiler and, for Windows Visual Studio users, in the Visual Studio
+    /// debugger.
     void setThreadName( const std::string &name );
   protected:
     /// the id of the thread.
@@ -193,28 +357,178 @@ namespace H3DUtil {
     /// Attempts to remove a callback. returns true if succeded. returns
     /// false if the callback does not exist. This function should be handled
     /// with care. It can remove the wrong callback if the callback that
-    /// returned the callback_handle id is removed and a new callback is added.
+    /// returned the callback_handle id is removed and the id counter has
+    /// wrapped around.
     /// Callbacks are removed if they return CALLBACK_DONE or a call to this
     /// function is made.
     virtual bool removeAsynchronousCallback( int callback_handle ) = 0;
 
   protected:
-    // internal function used to generate id for each callback.
+    // internal function used to generate id for each callback. Ids are
+    // not reused until the counter wraps around. Lock free so it can be
+    // called from any thread.
     inline int genCallbackId() {
-      if( free_ids.empty() ) {
-        return next_id++;
-      } else {
-        int id = free_ids.back();
-        free_ids.pop_back();
-        return id;
-      }
+      return Atomic::fetchAndAdd( &next_id, 1 ) & 0x7fffffff;
     }
 
     // the next id to use.
-    int next_id;
+    volatile int next_id;
+  };
+
+  /// A table of callback functions used by PeriodicThread. The callbacks
+  /// are stored in a contiguous array in the order they were added so
+  /// that calling all of them is a linear pass through memory, and no
+  /// heap allocations are made when callbacks are added, called or
+  /// removed unless the table has to grow.
+  ///
+  /// Each callback gets a handle that consists of the index of a slot in
+  /// the table and a generation counter for that slot. The generation is
+  /// incremented each time the slot is freed so an old handle will not
+  /// match a new callback that reuses the slot.
+  ///
+  /// reserveHandle() can be called from any thread without locking. All
+  /// other functions must only be called by one thread at a time, e.g.
+  /// by holding a lock.
+  class H3DUTIL_API CallbackTable {
+  public:
+    /// A callback in the table.
+    struct Entry {
+      /// The function to call. NULL if the callback has been removed.
+      PeriodicThreadBase::CallbackFunc func;
+      /// The argument to the function.
+      void *data;
+      /// The handle of the callback.
+      int handle;
+    };
+
+    /// Constructor.
+    CallbackTable();
+
+    /// Destructor.
+    ~CallbackTable();
+
+    /// Reserve a handle for a new callback. The callback has to be added
+    /// with add() before it is called. Lock free and can be used from any
+    /// thread. Returns -1 if the maximum number of callbacks is reached.
+    int reserveHandle();
+
+    /// Add a callback with a handle reserved with reserveHandle(). If
+    /// the handle has been removed before the callback was added the
+    /// callback is ignored.
+    void add( int handle, PeriodicThreadBase::CallbackFunc func, void *data );
+
+    /// Remove the callback with the given handle. Returns true if it
+    /// existed. Can be called for a reserved handle that has not been added
+    /// yet in which case the callback will never be added.
+    bool remove( int handle );
+
+    /// Remove all callbacks that have been added.
+    void clear();
+
+    /// Call all callbacks once in the order they were added. Callbacks
+    /// that return CALLBACK_DONE are removed. The execution time of each
+    /// callback is measured.
+    void callAll();
+
+    /// Returns true if there are no callbacks in the table.
+    inline bool empty() {
+      return entries.size() == nr_removed_entries;
+    }
+
+    /// Execution time statistics for a callback. Times are in seconds.
+    struct Statistics {
+      /// The handle of the callback.
+      int handle;
+      /// The number of times the callback has been called.
+      unsigned int nr_calls;
+      /// The total time spent in the callback.
+      double total_time;
+      /// The longest time spent in one call.
+      double max_time;
+    };
+
+    /// Get the statistics for all callbacks currently in the table. Lock
+    /// free and can be called from any thread while callAll() is running.
+    void getStatistics( std::vector< Statistics > &stats );
+
+  protected:
+    /// Bookkeeping for a handle.
+    struct Slot {
+      /// The current generation of the slot.
+      int generation;
+      /// Index of the callback in entries or one of the SlotState values.
+      int position;
+      /// The next slot in the list of free slots.
+      volatile int next_free;
+      /// Incremented before and after stats is changed, i.e. odd while
+      /// it is being changed.
+      volatile int stats_sequence;
+      /// Statistics of the callback using the slot. The handle is -1
+      /// if the slot is not used.
+      Statistics stats;
+    };
+
+    /// Values of Slot::position when the slot is not used by an added
+    /// callback.
+    enum SlotState {
+      SLOT_FREE = -1,
+      SLOT_RESERVED = -2,
+      SLOT_CANCELLED = -3
+    };
+
+    /// Returns the slot with the given index.
+    inline Slot &getSlot( int index ) {
+      return chunks[ index >> CHUNK_BITS ][ index & ( CHUNK_SIZE - 1 ) ];
+    }
 
-    // if an id have been used and is freed it is stored here.
-    std::list< int > free_ids;
+    /// Returns the slot for a handle or NULL if the handle is not valid.
+    Slot *getSlotForHandle( int handle );
+
+    /// Increment the generation of a slot and put it in the list of free
+    /// slots.
+    void freeSlot( int index );
+
+    /// Add a new chunk of free slots. Returns false if the maximum number
+    /// of slots is reached.
+    bool grow();
+
+    /// Remove the entries of removed callbacks from entries, keeping the
+    /// order of the remaining ones.
+    void compact();
+
+    /// Slots are allocated in chunks of CHUNK_SIZE that are never moved
+    /// so they can be read while another chunk is added.
+    static const int CHUNK_BITS = 8;
+    static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const int MAX_CHUNKS = 256;
+    static const int HANDLE_INDEX_BITS = 16;
+    static const int HANDLE_INDEX_MASK = ( 1 << HANDLE_INDEX_BITS ) - 1;
+    static const int GENERATION_MASK = 0x7fff;
+
+    /// The callbacks in the order they were added.
+    std::vector< Entry > entries;
+
+    /// The number of entries in entries that have been removed.
+    size_t nr_removed_entries;
+
+    /// The chunks of slots.
+    Slot *chunks[ MAX_CHUNKS ];
+
+    /// The number of allocated chunks.
+    volatile int nr_chunks;
+
+    /// The first slot in the list of free slots in the low 32 bits and a
+    /// counter that is incremented on each change in the high 32 bits to
+    /// avoid the ABA problem.
+    volatile H3DInt64 free_head;
+
+    /// Lock used when adding new chunks.
+    MutexLock grow_lock;
+
+  private:
+    // Not copyable.
+    CallbackTable( const CallbackTable & );
+    CallbackTable &operator=( const CallbackTable & );
   };
 
   /// The interface base class for all threads that are used for haptics
@@ -230,30 +544,70 @@ namespace H3DUtil {
     /// Add a callback function that is to be executed when all the haptic
     /// threads have been synchronised, so it will be a thread safe 
     /// callback between all haptic threads.
+    ///
+    /// Each haptic thread is paused in the first loop that starts after
+    /// the call, after the callbacks added to it before the call have been
+    /// run. func is run in the calling thread when all haptic threads are
+    /// paused and they continue as soon as it returns. If called from a
+    /// haptic thread, that thread is not paused since it is running func.
     static void synchronousHapticCB( PeriodicThreadBase::CallbackFunc func, 
                                      void *data );
 
     /// Returns true if the call was made from within a HapticThreadBase
-    /// thread.
+    /// thread. The result is stored for each thread, so only the first
+    /// call in a thread has to look through the haptic threads.
     static bool inHapticThread();
   protected:
-    // Callback function for synchronising all haptic threads.
+    /// Mark the calling thread as the thread of this object for
+    /// inHapticThread and synchronousHapticCB. HapticThread does this in
+    /// its thread when it starts, other subclasses should call it from
+    /// their thread before it uses inHapticThread.
+    void setInHapticThread();
+
+    /// Returns the haptic thread the call was made from, or NULL if it is
+    /// not made from a haptic thread.
+    static HapticThreadBase *getCurrentHapticThread();
+
+    /// Remove the thread from the haptic threads. Waits for a call to
+    /// synchronousHapticCB that is in progress, so it must be called
+    /// while the thread is still running, e.g. in the destructor of a
+    /// subclass that stops the thread. The thread is not paused by
+    /// synchronizations made after the call.
+    void removeHapticThread();
+
+    // Pause the calling thread, which is the thread of this object, if
+    // synchronousHapticCB has requested it.
+    void pauseIfRequested();
+
+    // Callback function that calls pauseIfRequested on the
+    // HapticThreadBase given as data.
     static PeriodicThreadBase::CallbackCode sync_haptics( void * );
 
+    // Callback function that calls setInHapticThread on the
+    // HapticThreadBase given as data.
+    static PeriodicThreadBase::CallbackCode markHapticThread( void * );
+
+    // Set to 1 by synchronousHapticCB when the thread is to be paused and
+    // back to 0 by the thread when it pauses. A thread waiting to make a
+    // synchronization itself pauses while it waits, the sync_haptics
+    // callback then does nothing.
+    volatile int pause_requested;
+
     // The haptic threads that have been created.
     static std::vector< HapticThreadBase * > threads;
 
-    // Lock used to get the haptic threads to wait for the callback 
-    // function to finish.
-    static ConditionLock haptic_lock; 
+    // Lock for threads.
+    static MutexLock threads_lock;
 
-    // Lock used to get the thread calling the synchronousHapticCB
-    // function to wait for all the haptic threads to synchronize.
+    // Lock held during synchronousHapticCB, so that only one
+    // synchronization is made at a time and no haptic thread is removed
+    // during a synchronization.
     static ConditionLock sg_lock; 
 
-    // Counter used when synchronizing haptic threads. It tells how
-    // many more haptic threads that are left to synchronize.
-    static int haptic_threads_left;
+    // The barrier that the paused haptic threads and the thread calling
+    // synchronousHapticCB wait at, once when all have been paused and once
+    // when the callback function is done.
+    static Barrier sync_barrier;
   };
 
   /// The SimpleThread class creates a new thread to run a function. The
@@ -319,15 +673,10 @@ namespace H3DUtil {
     /// not wait for the callback function to execute.
     /// Returns a handle to the callback that can be used to remove
     /// the callback.
-    /// When subclassing this function all callbacks should be
-    /// added to the callbacks_added variable and use the callback_added_lock
-    /// around the commands if frequency of the thread if above 0. Otherwise 
-    /// the calling thread might have to be synchronized with the
-    /// PeriodicThread to add the callbacks. If frequency is below 0 then this
-    /// approach can not be used because the thread might be waiting for new
-    /// callbacks and there is no safe way to check if the callback_lock is
-    /// waiting for new callbacks or waiting in the synchronousCallback
-    /// function.
+    /// The callback is put in the lock free callbacks_added queue so the
+    /// calling thread never has to wait for the callback_lock unless the
+    /// queue is full. When subclassing this function all callbacks should
+    /// be added with the addCallback function.
     virtual int asynchronousCallback( CallbackFunc func, void *data );
 
     /// Add several asynchronous callbacks at once in order to minimize
@@ -339,33 +688,17 @@ namespace H3DUtil {
     template< class InputIterator >
     void asynchronousCallbacks( InputIterator begin, 
                                                 InputIterator end ) {
-      if( frequency < 0 ) {
-        callback_lock.lock();
-        // signal the thread that a new callback is available if it is waiting
-        // for one.
-        if( callbacks.size() == 0 ) callback_lock.signal();
-        
-        for( InputIterator i = begin; i != end; i++ ) {
-          int cb_id = genCallbackId();
-          // add the new callback
-          callbacks.push_back( make_pair( cb_id, *i ) );
-        }
-        callback_lock.unlock();
-      } else {
-        callbacks_added_lock.lock();
-        for( InputIterator i = begin; i != end; i++ ) {
-          int cb_id = genCallbackId();
-          // add the new callback
-          callbacks_added.push_back( make_pair( cb_id, *i ) );
-        }
-        callbacks_added_lock.unlock();
+      for( InputIterator i = begin; i != end; i++ ) {
+        addCallback( (*i).first, (*i).second );
       }
+      wakeUpThread();
     }
 
     /// Attempts to remove a callback. returns true if succeded. returns
-    /// false if the callback does not exist. This function should be handled
-    /// with care. It can remove the wrong callback if the callback that
-    /// returned the callback_handle id is removed and a new callback is added.
+    /// false if the callback does not exist. The handle contains a
+    /// generation counter so a handle to a callback that has already been
+    /// removed will not remove a new callback that reuses the same slot
+    /// (unless the slot has been reused 32768 times).
     /// Callbacks are removed if they return CALLBACK_DONE or a call to this
     /// function is made.
     virtual bool removeAsynchronousCallback( int callback_handle );
@@ -378,36 +711,159 @@ namespace H3DUtil {
       thread_func_is_running = false;
     }
 
+    /// Modes for how a thread with a frequency above 0 waits for the
+    /// start of the next loop.
+    typedef enum {
+      /// Sleep for the time left of the period, measured from when the
+      /// previous loop started.
+      RELATIVE_SLEEP,
+      /// Sleep until an absolute deadline of a monotonic clock. Each
+      /// deadline is exactly one period after the previous one so the loop
+      /// frequency does not drift. Only available on Linux, other systems
+      /// use RELATIVE_SLEEP.
+      ABSOLUTE_DEADLINE
+    } SchedulingMode;
+
+    /// Set the mode used to wait for the start of each loop.
+    /// \param mode The scheduling mode to use.
+    /// \param _spin_time Only used in ABSOLUTE_DEADLINE mode. The time in
+    /// seconds before each deadline that the thread busy waits instead of
+    /// sleeping. Setting e.g. 50e-6 reduces the jitter caused by the
+    /// wake up latency of the system at the cost of more CPU usage.
+    void setSchedulingMode( SchedulingMode mode, double _spin_time = 0 );
+
+    /// Get the mode used to wait for the start of each loop.
+    inline SchedulingMode getSchedulingMode() {
+      return scheduling_mode;
+    }
+
+    /// Returns the frequency in Hz that the thread loop has actually
+    /// been running at. Updated once every second.
+    inline double getAchievedFrequency() {
+      return achieved_frequency;
+    }
+
+    /// Returns the number of loops that started later than their
+    /// scheduled time, i.e. when the previous loop took longer than
+    /// the period of the thread. Always 0 if frequency is below 0.
+    inline unsigned int getNrOverruns() {
+      return (unsigned int) nr_overruns;
+    }
+
+    /// Timing statistics for the loop of a PeriodicThread during a window
+    /// of one second. All times are in seconds.
+    struct LoopStatistics {
+      /// The number of buckets in period_histogram.
+      static const int NR_PERIOD_BUCKETS = 64;
+      /// The number of buckets in jitter_histogram.
+      static const int NR_JITTER_BUCKETS = 256;
+
+      /// The number of loops measured.
+      unsigned int nr_loops;
+      /// The number of loops with a measured period, i.e. the number of
+      /// values in period_histogram and jitter_histogram.
+      unsigned int nr_periods;
+      /// The period the thread is supposed to run at. 0 if frequency
+      /// is below 0.
+      double nominal_period;
+      /// The shortest time between the start of two loops.
+      double min_period;
+      /// The longest time between the start of two loops.
+      double max_period;
+      /// The mean time between the start of two loops.
+      double mean_period;
+      /// The width of each bucket in period_histogram.
+      double period_bucket_size;
+      /// period_histogram[i] is the number of loops with a period in 
+      /// [i * period_bucket_size, (i+1) * period_bucket_size). The last
+      /// bucket also contains all longer periods.
+      unsigned int period_histogram[ NR_PERIOD_BUCKETS ];
+      /// The jitter of a loop is the absolute difference between its
+      /// period and nominal_period. jitter_histogram[i] is the number of
+      /// loops with a jitter between i and i+1 microseconds. The last bucket
+      /// also contains all larger values.
+      unsigned int jitter_histogram[ NR_JITTER_BUCKETS ];
+      /// The largest jitter.
+      double max_jitter;
+      /// The median of the jitter.
+      double median_jitter;
+      /// The 99th percentile of the jitter.
+      double jitter_99th_percentile;
+      /// The 99.9th percentile of the jitter.
+      double jitter_999th_percentile;
+      /// The number of loops that started later than scheduled.
+      unsigned int nr_overruns;
+      /// The total time the thread has waited to lock the callback_lock.
+      double lock_wait_time;
+      /// The longest time the thread has waited to lock the callback_lock.
+      double max_lock_wait_time;
+    };
+
+    /// Execution time statistics for a callback.
+    typedef CallbackTable::Statistics CallbackStatistics;
+
+    /// Get the timing statistics of the thread loop during the last
+    /// complete window of one second, so that they reflect its recent
+    /// behaviour. The statistics are all 0 until the first window after
+    /// the thread was started or resetLoopStatistics was called is
+    /// complete. Lock free and can be called from any thread without
+    /// affecting the thread loop.
+    void getLoopStatistics( LoopStatistics &stats );
+
+    /// Get the execution time statistics of all current callbacks. Lock
+    /// free and can be called from any thread without affecting the 
+    /// thread loop.
+    void getCallbackStatistics( std::vector< CallbackStatistics > &stats ) {
+      callbacks.getStatistics( stats );
+    }
+
+    /// Reset the loop statistics. The statistics are cleared and a new
+    /// window is started by the thread at the start of its next loop.
+    inline void resetLoopStatistics() {
+      Atomic::store( &reset_loop_statistics, 1 );
+    }
+
   protected:
     // The function that handles callbacks. Is also the main function that
     // is run in the thread.
     static void *thread_func( void * );
 
-    typedef std::list< std::pair< int, std::pair< CallbackFunc, void * > > >
-      CallbackList;
-    // A list of the callback functions to run.
-    CallbackList callbacks;
+    // The callback functions to run.
+    CallbackTable callbacks;
     
     // A lock for synchronizing changes to the callbacks member.
     ConditionLock callback_lock;
 
-    // A list of the callback functions to add to the callbacks variable
-    // when the callback_lock is released. 
-    CallbackList callbacks_added;
+    // A lock free queue of the callback functions to add to the callbacks
+    // variable the next time the thread holds the callback_lock. Any
+    // thread can add to it but only the thread holding the callback_lock
+    // may remove from it.
+    LockFreeQueue< CallbackTable::Entry > callbacks_added;
+
+    // Set to 1 by the thread when it is waiting on the callback_lock for
+    // new callbacks. Only used if frequency is below 0.
+    volatile int waiting_for_callbacks;
 
-    // A lock used when modifying callbacks_added variable.
-    MutexLock callbacks_added_lock;
+    // The number of times the thread has gone through the callbacks list.
+    // Used by synchronousCallback to know when its callback has been run.
+    unsigned int nr_callback_passes;
+
+    // Add a callback to the callbacks_added queue and return its handle. If
+    // the queue is full the callback is added directly to the callbacks
+    // table instead. Does not wake up the thread, use wakeUpThread for that.
+    int addCallback( CallbackFunc func, void *data );
+
+    // Wake up the thread if it is waiting for new callbacks to be added.
+    void wakeUpThread();
 
     // A function that transfers the content of callbacks_added to callbacks.
     // DO NOT use this function anywhere unless you really know what you are
     // doing. It assumes that the callback_lock is locked when used.
     inline void transferCallbackList() {
-      callbacks_added_lock.lock();
-      for( CallbackList::iterator i = callbacks_added.begin();
-           i != callbacks_added.end(); i++ )
-        callbacks.push_back( *i );
-      callbacks_added.clear();
-      callbacks_added_lock.unlock();
+      CallbackTable::Entry cb;
+      while( callbacks_added.pop( cb ) ) {
+        callbacks.add( cb.handle, cb.func, cb.data );
+      }
     }
 
     /// The priority of the thread.
@@ -420,6 +876,41 @@ namespace H3DUtil {
     /// set to false.
     bool thread_func_is_running;
 
+    /// The mode used to wait for the start of each loop.
+    volatile SchedulingMode scheduling_mode;
+
+    /// Time in seconds to busy wait before each deadline in
+    /// ABSOLUTE_DEADLINE mode.
+    volatile double spin_time;
+
+    /// The measured frequency of the thread loop.
+    volatile double achieved_frequency;
+
+    /// The number of loops that started later than scheduled.
+    volatile int nr_overruns;
+
+    /// Loop statistics of the current window that are updated by the
+    /// thread each loop.
+    LoopStatistics loop_statistics;
+
+    /// The time the current window of loop_statistics started, in seconds
+    /// of the monotonic clock.
+    double loop_statistics_window_start;
+
+    /// Copy of loop_statistics that is published by the thread at the end
+    /// of each window and read by getLoopStatistics.
+    SeqLock< LoopStatistics > published_loop_statistics;
+
+    /// Set to 1 to make the thread reset loop_statistics.
+    volatile int reset_loop_statistics;
+
+    /// Update the loop statistics with the measurements of one loop that
+    /// started at the time now, and publish them if the window is complete.
+    void updateLoopStatistics( double now,
+                               double period,
+                               bool overrun,
+                               double lock_wait_time );
+
   };
 
   /// HapticThread is a thread class that should be used by haptics devices
@@ -432,11 +923,20 @@ namespace H3DUtil {
     HapticThread( Priority thread_priority = NORMAL_PRIORITY,
                   int thread_frequency = -1 ):
       PeriodicThread( thread_priority, thread_frequency ) {
+      asynchronousCallback( markHapticThread,
+                            static_cast< HapticThreadBase * >( this ) );
     }
     /// Deprecated.
     HapticThread( int thread_priority,
                   int thread_frequency = -1 ):
       PeriodicThread( thread_priority, thread_frequency ) {
+      asynchronousCallback( markHapticThread,
+                            static_cast< HapticThreadBase * >( this ) );
+    }
+
+    /// Destructor.
+    virtual ~HapticThread() {
+      removeHapticThread();
     }
   };
 }
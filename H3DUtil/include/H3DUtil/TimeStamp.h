@@ -25,13 +25,15 @@
 /// \brief Routines to handle time stamping of the field network
 ///
 /// TimeStamp stores an internal time value that represents the seconds
-/// elapsed since January 1, 1970.
+/// elapsed since January 1, 1970. The current time is measured with a
+/// monotonic clock.
 //
 //////////////////////////////////////////////////////////////////////////////
 #ifndef __TIMESTAMP_H__
 #define __TIMESTAMP_H__
 
 #include <H3DUtil/H3DUtil.h>
+#include <H3DUtil/H3DBasicTypes.h>
 
 #ifdef WIN32
 #include <sys/timeb.h>
@@ -49,6 +51,13 @@ namespace H3DUtil {
   /// This struct stores time and contains routines to get system time.
   /// It stores an internal time value that represents the seconds
   /// elapsed since January 1, 1970.
+  ///
+  /// The current time is the time of the system clock when it was first
+  /// asked for, plus the time of a monotonic clock since then. It never
+  /// goes backwards and does not jump when the system clock is adjusted,
+  /// so the difference of two TimeStamps is a reliable time interval. Use
+  /// getWallClockTime for the time of the system clock and
+  /// getMonotonicNanoseconds for intervals with nanosecond resolution.
   struct H3DUTIL_API TimeStamp {
     H3D_API_EXCEPTION( PerformanceCounterNotSupported );
 
@@ -65,6 +74,16 @@ namespace H3DUtil {
       return TimeStamp( getCurrentTime() );
     }
 
+    /// Returns the time of a monotonic clock in nanoseconds since an
+    /// unspecified point in time. The clock is not affected by changes of
+    /// the system clock.
+    static H3DInt64 getMonotonicNanoseconds();
+
+    /// Returns the time of the system clock in seconds elapsed since
+    /// January 1, 1970. It follows adjustments of the system clock, e.g.
+    /// by NTP, so it can jump forwards and backwards.
+    static double getWallClockTime();
+
     /// Get the time stored in a timestamp.
     operator double() const { return time; }
     /// Comparasion operator of the time in two Timestamps.
@@ -87,10 +106,15 @@ namespace H3DUtil {
     /// Get time in seconds elapsed since January 1, 1970.
     static double getCurrentTime();
 
-#ifdef WIN32
+    /// Set when start_time and start_nanoseconds have been set by the
+    /// first call to getCurrentTime.
     static bool init_done;
+    /// The system clock time at the first call to getCurrentTime.
     static double start_time;
-    static LARGE_INTEGER start_perf_count;
+    /// The monotonic clock time at the first call to getCurrentTime.
+    static H3DInt64 start_nanoseconds;
+
+#ifdef WIN32
     static LARGE_INTEGER perf_freq;
 #endif
   };
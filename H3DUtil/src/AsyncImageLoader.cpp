@@ -0,0 +1,349 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file AsyncImageLoader.cpp
+/// \brief cpp file for AsyncImageLoader.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/AsyncImageLoader.h>
+#include <H3DUtil/Atomic.h>
+
+using namespace H3DUtil;
+
+AsyncImageLoader::Handle::Handle():
+  request( NULL ) {
+}
+
+AsyncImageLoader::Handle::Handle( Request *_request ):
+  request( _request ) {
+  if( request ) Atomic::increment( &request->ref_count );
+}
+
+AsyncImageLoader::Handle::Handle( const Handle &h ):
+  request( h.request ) {
+  if( request ) Atomic::increment( &request->ref_count );
+}
+
+AsyncImageLoader::Handle::~Handle() {
+  if( request ) releaseRequest( request );
+}
+
+AsyncImageLoader::Handle &
+AsyncImageLoader::Handle::operator=( const Handle &h ) {
+  if( h.request ) Atomic::increment( &h.request->ref_count );
+  if( request ) releaseRequest( request );
+  request = h.request;
+  return *this;
+}
+
+string AsyncImageLoader::Handle::getUrl() const {
+  return request ? request->url : string( "" );
+}
+
+AsyncImageLoader::Status AsyncImageLoader::Handle::getStatus() const {
+  if( !request ) return CANCELLED;
+  request->lock.lock();
+  Status status = request->status;
+  request->lock.unlock();
+  return status;
+}
+
+bool AsyncImageLoader::Handle::isDone() const {
+  Status status = getStatus();
+  return status != QUEUED && status != LOADING;
+}
+
+H3DFloat AsyncImageLoader::Handle::getProgress() const {
+  if( !request ) return 0;
+  request->lock.lock();
+  H3DFloat progress = request->status == DONE ? 1 : request->progress;
+  request->lock.unlock();
+  return progress;
+}
+
+void AsyncImageLoader::Handle::wait() const {
+  if( !request ) return;
+  request->lock.lock();
+  while( request->status == QUEUED || request->status == LOADING ) {
+    request->lock.wait();
+  }
+  request->lock.unlock();
+}
+
+Image *AsyncImageLoader::Handle::getImage() const {
+  if( !request ) return NULL;
+  request->lock.lock();
+  Image *image = request->status == DONE ? request->image.get() : NULL;
+  request->lock.unlock();
+  return image;
+}
+
+bool AsyncImageLoader::Handle::cancel() {
+  if( !request ) return false;
+  request->lock.lock();
+  if( request->status != QUEUED && request->status != LOADING ) {
+    request->lock.unlock();
+    return false;
+  }
+  request->cancelled = true;
+  request->lock.unlock();
+
+  // If the request is still in the queue it is finished here, otherwise
+  // the loading thread will discard the image when done.
+  AsyncImageLoader *loader = request->loader;
+  loader->queue_lock.lock();
+  bool removed = request->queued;
+  if( removed ) {
+    loader->queue.erase( request );
+    request->queued = false;
+  }
+  loader->queue_lock.unlock();
+
+  if( removed ) {
+    finishRequest( request, NULL );
+    releaseRequest( request );
+  }
+  return true;
+}
+
+void AsyncImageLoader::Handle::setPriority( int priority ) {
+  if( !request || getStatus() != QUEUED ) return;
+  AsyncImageLoader *loader = request->loader;
+  loader->queue_lock.lock();
+  if( request->queued ) {
+    // the position in the queue depends on the priority so the request
+    // has to be removed while changing it.
+    loader->queue.erase( request );
+    request->priority = priority;
+    loader->queue.insert( request );
+  } else {
+    request->priority = priority;
+  }
+  loader->queue_lock.unlock();
+}
+
+AsyncImageLoader::AsyncImageLoader( unsigned int nr_threads ):
+  next_sequence_number( 0 ),
+  running( true ) {
+  if( nr_threads < 1 ) nr_threads = 1;
+  threads.resize( nr_threads );
+  for( unsigned int i = 0; i < nr_threads; ++i ) {
+    pthread_create( &threads[i], NULL, threadFunc, this );
+  }
+}
+
+AsyncImageLoader::~AsyncImageLoader() {
+  queue_lock.lock();
+  running = false;
+  RequestQueue cancelled_requests;
+  cancelled_requests.swap( queue );
+  for( RequestQueue::iterator i = cancelled_requests.begin();
+       i != cancelled_requests.end(); ++i ) {
+    (*i)->queued = false;
+  }
+  queue_lock.broadcast();
+  queue_lock.unlock();
+
+  for( RequestQueue::iterator i = cancelled_requests.begin();
+       i != cancelled_requests.end(); ++i ) {
+    Request *request = *i;
+    request->lock.lock();
+    request->cancelled = true;
+    request->lock.unlock();
+    finishRequest( request, NULL );
+    releaseRequest( request );
+  }
+
+  for( unsigned int i = 0; i < threads.size(); ++i ) {
+    pthread_join( threads[i], NULL );
+  }
+}
+
+AsyncImageLoader::Handle AsyncImageLoader::load( const string &url,
+                                                 LoadFunc func,
+                                                 void *func_data,
+                                                 int priority,
+                                                 DoneFunc done_func,
+                                                 void *done_data ) {
+  Request *request = new Request;
+  request->url = url;
+  request->func = func;
+  request->func_data = func_data;
+  request->done_func = done_func;
+  request->done_data = done_data;
+  request->raw_image_info = NULL;
+  request->priority = priority;
+  return addRequest( request );
+}
+
+AsyncImageLoader::Handle
+AsyncImageLoader::loadRaw( const string &url,
+                           const RawImageInfo &raw_image_info,
+                           int priority,
+                           DoneFunc done_func,
+                           void *done_data ) {
+  Request *request = new Request;
+  request->url = url;
+  request->func = loadRawFunc;
+  request->raw_image_info = new RawImageInfo( raw_image_info );
+  request->func_data = request->raw_image_info;
+  request->done_func = done_func;
+  request->done_data = done_data;
+  request->priority = priority;
+  return addRequest( request );
+}
+
+unsigned int AsyncImageLoader::getNrQueued() {
+  queue_lock.lock();
+  unsigned int nr_queued = (unsigned int) queue.size();
+  queue_lock.unlock();
+  return nr_queued;
+}
+
+AsyncImageLoader::Handle AsyncImageLoader::addRequest( Request *request ) {
+  request->loader = this;
+  request->status = QUEUED;
+  request->cancelled = false;
+  request->progress = 0;
+  // one reference for the queue, released when the request is done.
+  request->ref_count = 1;
+  Handle handle( request );
+
+  queue_lock.lock();
+  request->sequence_number = next_sequence_number++;
+  request->queued = true;
+  queue.insert( request );
+  queue_lock.signal();
+  queue_lock.unlock();
+  return handle;
+}
+
+void AsyncImageLoader::releaseRequest( Request *request ) {
+  if( Atomic::decrement( &request->ref_count ) == 0 ) {
+    delete request->raw_image_info;
+    delete request;
+  }
+}
+
+void AsyncImageLoader::finishRequest( Request *request, Image *image ) {
+  request->lock.lock();
+  if( request->cancelled ) {
+    request->status = CANCELLED;
+    // the image has not been referenced by anyone so it is deleted.
+    delete image;
+  } else if( image ) {
+    request->status = DONE;
+    request->image.reset( image );
+  } else {
+    request->status = FAILED;
+  }
+  request->lock.broadcast();
+  request->lock.unlock();
+
+  if( request->done_func ) {
+    request->done_func( Handle( request ), request->done_data );
+  }
+}
+
+bool AsyncImageLoader::progressFunc( H3DFloat progress, void *data ) {
+  Request *request = static_cast< Request * >( data );
+  request->lock.lock();
+  request->progress = progress;
+  bool cancelled = request->cancelled;
+  request->lock.unlock();
+  return !cancelled;
+}
+
+Image *AsyncImageLoader::loadRawFunc( const string &url,
+                                      LoadImageProgressFunc progress_func,
+                                      void *progress_data,
+                                      void *data ) {
+  return loadRawImage( url, *static_cast< RawImageInfo * >( data ),
+                       progress_func, progress_data );
+}
+
+#ifdef HAVE_FREEIMAGE
+Image *AsyncImageLoader::loadFreeImageFunc( const string &url,
+                                            LoadImageProgressFunc,
+                                            void *,
+                                            void * ) {
+  // FreeImage gives no progress information.
+  return loadFreeImage( url );
+}
+#endif
+
+Image *AsyncImageLoader::loadNrrdFileFunc( const string &url,
+                                           LoadImageProgressFunc progress_func,
+                                           void *progress_data,
+                                           void * ) {
+  return loadNrrdFile( url, progress_func, progress_data );
+}
+
+#ifdef HAVE_DCMTK
+Image *AsyncImageLoader::loadDicomFileFunc( const string &url,
+                                            LoadImageProgressFunc progress_func,
+                                            void *progress_data,
+                                            void * ) {
+  return loadDicomFile( url, true, progress_func, progress_data );
+}
+
+Image *AsyncImageLoader::loadDicomSeriesFunc( const string &url,
+                                              LoadImageProgressFunc progress_func,
+                                              void *progress_data,
+                                              void * ) {
+  return loadDicomFile( url, false, progress_func, progress_data );
+}
+#endif
+
+void *AsyncImageLoader::threadFunc( void *data ) {
+  AsyncImageLoader *loader = static_cast< AsyncImageLoader * >( data );
+  for( ; ; ) {
+    loader->queue_lock.lock();
+    while( loader->queue.empty() && loader->running ) {
+      loader->queue_lock.wait();
+    }
+    if( !loader->running ) {
+      loader->queue_lock.unlock();
+      break;
+    }
+    Request *request = *loader->queue.begin();
+    loader->queue.erase( loader->queue.begin() );
+    request->queued = false;
+    loader->queue_lock.unlock();
+
+    request->lock.lock();
+    bool cancelled = request->cancelled;
+    if( !cancelled ) request->status = LOADING;
+    request->lock.unlock();
+
+    Image *image = NULL;
+    if( !cancelled ) {
+      image = request->func( request->url, progressFunc, request,
+                             request->func_data );
+    }
+    finishRequest( request, image );
+    releaseRequest( request );
+  }
+  return NULL;
+}
@@ -43,9 +43,31 @@
 #include <dcmtk/dcmjpeg/djdecode.h>
 
 #include <H3DUtil/LinAlgTypes.h>
+#include <H3DUtil/Threads.h>
 
 using namespace H3DUtil;
 
+namespace DicomImageInternals {
+  // Protects nr_codec_registrations and the DCMTK codec registration,
+  // which is not thread safe.
+  MutexLock codec_lock;
+  int nr_codec_registrations = 0;
+}
+
+void H3DUtil::DicomImage::registerCodecs() {
+  using namespace DicomImageInternals;
+  codec_lock.lock();
+  if( nr_codec_registrations++ == 0 ) DJDecoderRegistration::registerCodecs();
+  codec_lock.unlock();
+}
+
+void H3DUtil::DicomImage::unregisterCodecs() {
+  using namespace DicomImageInternals;
+  codec_lock.lock();
+  if( --nr_codec_registrations == 0 ) DJDecoderRegistration::cleanup();
+  codec_lock.unlock();
+}
+
 H3DUtil::DicomImage::DicomImage( const string &url ):
   PixelImage( 0,0,0,0,RGB, UNSIGNED, NULL ) {
 
@@ -95,13 +117,15 @@ H3DUtil::DicomImage::DicomImage( const string &url ):
 }
 
 void H3DUtil::DicomImage::loadImage( const string &url ) {
-  DJDecoderRegistration::registerCodecs();
+  registerCodecs();
 
   ::DicomImage *image = new ::DicomImage( url.c_str() );
-  if (image->getStatus() != EIS_Normal)
-    throw CouldNotLoadDicomImage( url,
-                                  ::DicomImage::getString(image->getStatus()),
-                                  H3D_FULL_LOCATION );
+  if (image->getStatus() != EIS_Normal) {
+    string status = ::DicomImage::getString(image->getStatus());
+    delete image;
+    unregisterCodecs();
+    throw CouldNotLoadDicomImage( url, status, H3D_FULL_LOCATION );
+  }
   w = image->getWidth();
   h = image->getHeight();
   d = image->getFrameCount();
@@ -186,7 +210,7 @@ void H3DUtil::DicomImage::loadImage( const string &url ) {
   }
 
   delete image;
-  DJDecoderRegistration::cleanup();
+  unregisterCodecs();
 }
 
 void H3DUtil::DicomImage::loadImage( const vector< string > &urls ) {
@@ -29,10 +29,13 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include <H3DUtil/Image.h>
+#include <H3DUtil/ImageView.h>
+#include <H3DUtil/ThreadPool.h>
 #ifdef WIN32
 #undef max
 #endif
 #include <limits>
+#include <vector>
 
 using namespace H3DUtil;
 
@@ -109,6 +112,222 @@ void Image::getSample( void *value,
   }
 }
 
+namespace ImageInternals {
+  // The number of positions handled at a time by getSamples.
+  const size_t SAMPLE_BLOCK_SIZE = 64;
+
+  // Information about the image data used when sampling.
+  struct SampleInfo {
+    const void *data;
+    unsigned int width, height, depth;
+    // the number of components in each pixel.
+    unsigned int nr_components;
+    // the first component to sample.
+    unsigned int first_component;
+    // the number of components to sample.
+    unsigned int nr_sampled_components;
+  };
+
+  // Sample the image at n <= SAMPLE_BLOCK_SIZE positions and put the
+  // normalized component values in values, nr_sampled_components values
+  // for each position. T is the type of each component. The pixel 
+  // positions and weights are computed for all positions first and then
+  // the pixel values are gathered.
+  template< class T >
+  void sampleBlock( const SampleInfo &info,
+                    const Vec3f *coords,
+                    size_t n,
+                    Image::FilterType filter_type,
+                    H3DFloat *values ) {
+    const T *data = static_cast< const T * >( info.data );
+    const int w = info.width, h = info.height, d = info.depth;
+    const size_t row_size = (size_t) w * info.nr_components;
+    const size_t slice_size = row_size * h;
+    const unsigned int nc = info.nr_sampled_components;
+    const H3DFloat scale = ComponentTypeTraits< T >::normalize( (T) 1 );
+
+    if( filter_type == Image::NEAREST ) {
+      for( size_t i = 0; i < n; ++i ) {
+        const Vec3f &c = coords[i];
+        int x = c.x <= 0 ? 0 : c.x >= 1 ? w - 1 : (int) H3DFloor( w * c.x );
+        int y = c.y <= 0 ? 0 : c.y >= 1 ? h - 1 : (int) H3DFloor( h * c.y );
+        int z = c.z <= 0 ? 0 : c.z >= 1 ? d - 1 : (int) H3DFloor( d * c.z );
+        const T *p = data + z * slice_size + y * row_size + 
+          x * info.nr_components + info.first_component;
+        for( unsigned int j = 0; j < nc; ++j ) 
+          values[ i * nc + j ] = p[j] * scale;
+      }
+      return;
+    }
+
+    size_t offset[ SAMPLE_BLOCK_SIZE ];
+    size_t dx[ SAMPLE_BLOCK_SIZE ], dy[ SAMPLE_BLOCK_SIZE ];
+    size_t dz[ SAMPLE_BLOCK_SIZE ];
+    H3DFloat xd[ SAMPLE_BLOCK_SIZE ], yd[ SAMPLE_BLOCK_SIZE ];
+    H3DFloat zd[ SAMPLE_BLOCK_SIZE ];
+
+    for( size_t i = 0; i < n; ++i ) {
+      H3DFloat px = coords[i].x * w - 0.5f;
+      H3DFloat py = coords[i].y * h - 0.5f;
+      H3DFloat pz = coords[i].z * d - 0.5f;
+      px = H3DMax( (H3DFloat) 0, H3DMin( px, (H3DFloat)( w - 1 ) ) );
+      py = H3DMax( (H3DFloat) 0, H3DMin( py, (H3DFloat)( h - 1 ) ) );
+      pz = H3DMax( (H3DFloat) 0, H3DMin( pz, (H3DFloat)( d - 1 ) ) );
+      int fx = (int) px, fy = (int) py, fz = (int) pz;
+      xd[i] = px - fx;
+      yd[i] = py - fy;
+      zd[i] = pz - fz;
+      offset[i] = fz * slice_size + fy * row_size + 
+        fx * info.nr_components + info.first_component;
+      dx[i] = fx + 1 < w ? info.nr_components : 0;
+      dy[i] = fy + 1 < h ? row_size : 0;
+      dz[i] = fz + 1 < d ? slice_size : 0;
+    }
+
+    for( size_t i = 0; i < n; ++i ) {
+      const T *p = data + offset[i];
+      for( unsigned int j = 0; j < nc; ++j ) {
+        const T *q = p + j;
+        H3DFloat fff = q[0];
+        H3DFloat ffc = q[ dz[i] ];
+        H3DFloat fcf = q[ dy[i] ];
+        H3DFloat fcc = q[ dy[i] + dz[i] ];
+        H3DFloat cff = q[ dx[i] ];
+        H3DFloat cfc = q[ dx[i] + dz[i] ];
+        H3DFloat ccf = q[ dx[i] + dy[i] ];
+        H3DFloat ccc = q[ dx[i] + dy[i] + dz[i] ];
+
+        H3DFloat i1 = fff + ( ffc - fff ) * zd[i];
+        H3DFloat i2 = fcf + ( fcc - fcf ) * zd[i];
+        H3DFloat j1 = cff + ( cfc - cff ) * zd[i];
+        H3DFloat j2 = ccf + ( ccc - ccf ) * zd[i];
+        H3DFloat w1 = i1 + ( i2 - i1 ) * yd[i];
+        H3DFloat w2 = j1 + ( j2 - j1 ) * yd[i];
+        values[ i * nc + j ] = ( w1 + ( w2 - w1 ) * xd[i] ) * scale;
+      }
+    }
+  }
+
+  typedef void (*SampleBlockFunc)( const SampleInfo &info,
+                                   const Vec3f *coords,
+                                   size_t n,
+                                   Image::FilterType filter_type,
+                                   H3DFloat *values );
+
+  // Returns the sampling function to use for the image or NULL if the 
+  // image format is not supported. info is set up to sample all 
+  // components.
+  SampleBlockFunc getSampleBlockFunc( Image *image, SampleInfo &info ) {
+    if( image->dataLayout() != Image::LINEAR_LAYOUT ) return NULL;
+    info.data = image->getImageData();
+    info.nr_components = image->nrPixelComponents();
+    unsigned int bits_per_pixel = image->bitsPerPixel();
+    if( !info.data || info.nr_components == 0 ||
+        bits_per_pixel % ( 8 * info.nr_components ) != 0 ) return NULL;
+    info.width = image->width();
+    info.height = image->height();
+    info.depth = image->depth();
+    info.first_component = 0;
+    info.nr_sampled_components = info.nr_components;
+
+    unsigned int bytes_per_component = 
+      bits_per_pixel / ( 8 * info.nr_components );
+    switch( image->pixelComponentType() ) {
+    case Image::UNSIGNED:
+      if( bytes_per_component == 1 ) return sampleBlock< unsigned char >;
+      if( bytes_per_component == 2 ) return sampleBlock< unsigned short >;
+      if( bytes_per_component == 4 ) return sampleBlock< unsigned int >;
+      break;
+    case Image::SIGNED:
+      if( bytes_per_component == 1 ) return sampleBlock< signed char >;
+      if( bytes_per_component == 2 ) return sampleBlock< short >;
+      if( bytes_per_component == 4 ) return sampleBlock< int >;
+      break;
+    case Image::RATIONAL:
+      if( bytes_per_component == 4 ) return sampleBlock< float >;
+      if( bytes_per_component == 8 ) return sampleBlock< double >;
+      break;
+    }
+    return NULL;
+  }
+
+  // Convert n pixels of normalized component values to RGBA.
+  template< Image::PixelType P >
+  void componentsToRGBA( const H3DFloat *values, size_t n, RGBA *rgba ) {
+    for( size_t i = 0; i < n; ++i ) {
+      rgba[i] = PixelTypeTraits< P >::toRGBA( 
+        values + i * PixelTypeTraits< P >::nr_components );
+    }
+  }
+
+  typedef void (*ComponentsToRGBAFunc)( const H3DFloat *values,
+                                        size_t n,
+                                        RGBA *rgba );
+
+  ComponentsToRGBAFunc getComponentsToRGBAFunc( Image::PixelType type ) {
+    switch( type ) {
+    case Image::LUMINANCE: return componentsToRGBA< Image::LUMINANCE >;
+    case Image::LUMINANCE_ALPHA: 
+      return componentsToRGBA< Image::LUMINANCE_ALPHA >;
+    case Image::RGB: return componentsToRGBA< Image::RGB >;
+    case Image::VEC3: return componentsToRGBA< Image::VEC3 >;
+    case Image::BGR: return componentsToRGBA< Image::BGR >;
+    case Image::RGBA: return componentsToRGBA< Image::RGBA >;
+    case Image::BGRA: return componentsToRGBA< Image::BGRA >;
+    }
+    return NULL;
+  }
+}
+
+void Image::getSamples( const Vec3f *coords,
+                        size_t n,
+                        H3DUtil::RGBA *values,
+                        FilterType filter_type ) {
+  using namespace ImageInternals;
+  SampleInfo info;
+  SampleBlockFunc sample_func = getSampleBlockFunc( this, info );
+  ComponentsToRGBAFunc to_rgba_func = getComponentsToRGBAFunc( pixelType() );
+  if( !sample_func || !to_rgba_func ) {
+    for( size_t i = 0; i < n; ++i ) {
+      values[i] = getSample( coords[i].x, coords[i].y, coords[i].z,
+                             filter_type );
+    }
+    return;
+  }
+
+  H3DFloat components[ SAMPLE_BLOCK_SIZE * 4 ];
+  for( size_t i = 0; i < n; i += SAMPLE_BLOCK_SIZE ) {
+    size_t block_size = H3DMin( SAMPLE_BLOCK_SIZE, n - i );
+    sample_func( info, coords + i, block_size, filter_type, components );
+    to_rgba_func( components, block_size, values + i );
+  }
+}
+
+void Image::getSamples( const Vec3f *coords,
+                        size_t n,
+                        H3DFloat *values,
+                        FilterType filter_type ) {
+  using namespace ImageInternals;
+  SampleInfo info;
+  SampleBlockFunc sample_func = getSampleBlockFunc( this, info );
+  if( !sample_func ) {
+    for( size_t i = 0; i < n; ++i ) {
+      values[i] = getSample( coords[i].x, coords[i].y, coords[i].z,
+                             filter_type ).r;
+    }
+    return;
+  }
+
+  // the red component is the last one for BGR images.
+  PixelType type = pixelType();
+  info.first_component = type == BGR || type == BGRA ? 2 : 0;
+  info.nr_sampled_components = 1;
+  for( size_t i = 0; i < n; i += SAMPLE_BLOCK_SIZE ) {
+    size_t block_size = H3DMin( SAMPLE_BLOCK_SIZE, n - i );
+    sample_func( info, coords + i, block_size, filter_type, values + i );
+  }
+}
+
 
 namespace ImageInternals {
   inline H3DFloat getSignedValueAsFloat( void *i, 
@@ -714,77 +933,131 @@ unsigned int Image::nrPixelComponents() {
 }
 
 namespace ImageInternals {
+  // The number of values converted in each task by convertToNormalizedData.
+  const size_t normalize_block_size = 64 * 1024;
+
+  template< class FloatType >
+  struct NormalizeInfo {
+    const void *src;
+    FloatType *dst;
+    size_t nr_elements;
+  };
+
+  // RangeFunc normalizing the integer values in blocks [begin, end).
+  // Multiplying with the inverse and clamping with a conditional
+  // expression keeps the loop simple enough for the compiler to
+  // vectorize it.
   template< class A, class FloatType >
-  void buildNormalizedData( FloatType *normalized_data, 
-			    void *orig_data,
-			    unsigned int nr_elements,
-			    float scale,
-			    float bias ) {
-    A *d = (A*) orig_data;
-    
-    for (unsigned int i = 0; i < nr_elements; i++) {
-      normalized_data[i] = 
-	(d[ i ] / FloatType( numeric_limits<A >::max() ) ) * scale + bias;
-      if( normalized_data[i] < 0 ) normalized_data[i] = 0;
+  void normalizeIntegerRange( int begin, int end, void *data ) {
+    NormalizeInfo< FloatType > *info =
+      static_cast< NormalizeInfo< FloatType > * >( data );
+    const A *src = static_cast< const A * >( info->src );
+    FloatType *dst = info->dst;
+    size_t first = begin * normalize_block_size;
+    size_t last = end * normalize_block_size;
+    if( last > info->nr_elements ) last = info->nr_elements;
+    const FloatType inv_max =
+      FloatType( 1 ) / FloatType( numeric_limits< A >::max() );
+    for( size_t i = first; i < last; ++i ) {
+      FloatType v = FloatType( src[i] ) * inv_max;
+      dst[i] = v < 0 ? FloatType( 0 ) : v;
+    }
+  }
+
+  // RangeFunc clamping the rational values in blocks [begin, end) to
+  // [0,1].
+  template< class A, class FloatType >
+  void normalizeRationalRange( int begin, int end, void *data ) {
+    NormalizeInfo< FloatType > *info =
+      static_cast< NormalizeInfo< FloatType > * >( data );
+    const A *src = static_cast< const A * >( info->src );
+    FloatType *dst = info->dst;
+    size_t first = begin * normalize_block_size;
+    size_t last = end * normalize_block_size;
+    if( last > info->nr_elements ) last = info->nr_elements;
+    for( size_t i = first; i < last; ++i ) {
+      FloatType v = FloatType( src[i] );
+      v = v < 0 ? FloatType( 0 ) : v;
+      dst[i] = v > 1 ? FloatType( 1 ) : v;
     }
   }
-  
+
+  // Returns the function to use for normalizing the values of image or
+  // NULL if the format is not supported.
   template< class FloatType >
-  FloatType *convertToNormalizedData( Image *image ) {
-    int width = image->width();
-    int height = image->height();
-    int depth = image->depth();
-    int nr_voxels = width*height*depth;
-    
-    int scale = 1;
-    int bias = 0;
-    Image::PixelComponentType pixel_component_type = image->pixelComponentType();
+  ThreadPool::RangeFunc getNormalizeFunction( Image *image ) {
+    unsigned int nr_components = image->nrPixelComponents();
     unsigned int bits_per_pixel = image->bitsPerPixel();
+    if( nr_components == 0 ) return NULL;
+
+    switch( image->pixelComponentType() ) {
+    case Image::UNSIGNED:
+      if( bits_per_pixel == 8 * nr_components )
+        return normalizeIntegerRange< unsigned char, FloatType >;
+      if( bits_per_pixel == 16 * nr_components )
+        return normalizeIntegerRange< unsigned short, FloatType >;
+      if( bits_per_pixel == 32 * nr_components )
+        return normalizeIntegerRange< unsigned int, FloatType >;
+      if( bits_per_pixel == 64 * nr_components )
+        return normalizeIntegerRange< H3DUInt64, FloatType >;
+      break;
+    case Image::SIGNED:
+      if( bits_per_pixel == 8 * nr_components )
+        return normalizeIntegerRange< signed char, FloatType >;
+      if( bits_per_pixel == 16 * nr_components )
+        return normalizeIntegerRange< short, FloatType >;
+      if( bits_per_pixel == 32 * nr_components )
+        return normalizeIntegerRange< int, FloatType >;
+      if( bits_per_pixel == 64 * nr_components )
+        return normalizeIntegerRange< H3DInt64, FloatType >;
+      break;
+    case Image::RATIONAL:
+      if( bits_per_pixel == 32 * nr_components )
+        return normalizeRationalRange< float, FloatType >;
+      if( bits_per_pixel == 64 * nr_components )
+        return normalizeRationalRange< double, FloatType >;
+      break;
+    }
+    return NULL;
+  }
+
+  template< class FloatType >
+  FloatType *convertToNormalizedData( Image *image ) {
+    if( image->dataLayout() != Image::LINEAR_LAYOUT ||
+        !image->getImageData() ) return NULL;
+    ThreadPool::RangeFunc func = getNormalizeFunction< FloatType >( image );
+    if( !func ) return NULL;
+
+    size_t nr_elements = (size_t) image->width() * image->height() *
+      image->depth() * image->nrPixelComponents();
 
-    unsigned int nr_components = image->nrPixelComponents();
-    
     // allocate memory for normalized data.
     FloatType *normalized_data = NULL;
     try {
-      normalized_data = new FloatType[nr_voxels];
+      normalized_data = new FloatType[nr_elements];
     } catch (bad_alloc& ba) {
       Console(4) << ba.what() << endl;
       return NULL;
     }
-    
-    if( pixel_component_type ==Image::UNSIGNED ) {
-      if( bits_per_pixel == 8*nr_components ) {
-	  buildNormalizedData< unsigned char >( normalized_data, image->getImageData(), 
-						nr_voxels * nr_components, (float)scale, (float)bias ); 
-      } else if( bits_per_pixel == 16*nr_components ) {
-	buildNormalizedData< unsigned short >( normalized_data, image->getImageData(), 
-					       nr_voxels * nr_components, (float)scale, (float)bias );
-      } else if( bits_per_pixel == 32*nr_components ) {
-	  buildNormalizedData< unsigned int >( normalized_data, image->getImageData(), 
-					       nr_voxels * nr_components, (float)scale, (float)bias ); 
-      } else {
-	return NULL;
-      }
-    } else if( pixel_component_type == Image::SIGNED ) { 
-      if( bits_per_pixel == 8*nr_components ) {
-	buildNormalizedData< char >( normalized_data, image->getImageData(), 
-				     nr_voxels * nr_components, (float)scale, (float)bias ); 
-      } else if( bits_per_pixel == 16*nr_components ) {
-	buildNormalizedData< short >( normalized_data, image->getImageData(), 
-				      nr_voxels * nr_components, (float)scale, (float)bias );
-      } else if( bits_per_pixel == 32*nr_components ) {
-	buildNormalizedData< int >( normalized_data, image->getImageData(), 
-				    nr_voxels * nr_components, (float)scale, (float)bias ); 
-      } else { 
-	return NULL;
-      }
+
+    NormalizeInfo< FloatType > info;
+    info.src = image->getImageData();
+    info.dst = normalized_data;
+    info.nr_elements = nr_elements;
+    int nr_blocks =
+      (int)( ( nr_elements + normalize_block_size - 1 ) / normalize_block_size );
+    if( nr_blocks > 1 ) {
+      ThreadPool::getDefaultPool()->parallelFor( 0, nr_blocks, func, &info, 1 );
     } else {
-      return NULL;
+      func( 0, nr_blocks, &info );
     }
     return normalized_data;
   }
 }
-  
+
+Image::~Image() {
+}
+
 float *Image::convertToNormalizedFloatData() {
   return ImageInternals::convertToNormalizedData< float >( this );
 }
@@ -792,3 +1065,233 @@ float *Image::convertToNormalizedFloatData() {
 double *Image::convertToNormalizedDoubleData() {
   return ImageInternals::convertToNormalizedData< double >( this );
 }
+
+AutoRef< Image::NormalizedFloatData > Image::getNormalizedFloatData() {
+  normalized_data_lock.lock();
+  int version = Atomic::load( &data_version );
+  if( !normalized_float_data.get() ||
+      normalized_float_data_version != version ) {
+    // the previous data is deleted when no caller references it.
+    float *data = convertToNormalizedFloatData();
+    normalized_float_data.reset( data ? new NormalizedFloatData( data ) :
+                                 NULL );
+    normalized_float_data_version = version;
+  }
+  AutoRef< NormalizedFloatData > data( normalized_float_data );
+  normalized_data_lock.unlock();
+  return data;
+}
+
+namespace ImageInternals {
+  // An image without data, used to convert pixel values to and from a
+  // pixel format with RGBAToImageValue and imageValueToRGBA.
+  class PixelFormat: public Image {
+  public:
+    PixelFormat( Image::PixelType _pixel_type,
+                 Image::PixelComponentType _pixel_component_type,
+                 unsigned int _bits_per_pixel ):
+      pixel_type( _pixel_type ),
+      pixel_component_type( _pixel_component_type ),
+      bits_per_pixel( _bits_per_pixel ) {}
+
+    virtual unsigned int width() { return 1; }
+    virtual unsigned int height() { return 1; }
+    virtual unsigned int depth() { return 1; }
+    virtual unsigned int bitsPerPixel() { return bits_per_pixel; }
+    virtual PixelType pixelType() { return pixel_type; }
+    virtual PixelComponentType pixelComponentType() {
+      return pixel_component_type;
+    }
+    virtual void *getImageData() { return NULL; }
+
+  protected:
+    Image::PixelType pixel_type;
+    Image::PixelComponentType pixel_component_type;
+    unsigned int bits_per_pixel;
+  };
+
+  // Returns true if the image has the given pixel format.
+  bool hasPixelFormat( Image *image,
+                       Image::PixelType pixel_type,
+                       Image::PixelComponentType pixel_component_type,
+                       unsigned int bits_per_pixel ) {
+    return
+      image->pixelType() == pixel_type &&
+      image->pixelComponentType() == pixel_component_type &&
+      image->bitsPerPixel() == bits_per_pixel;
+  }
+}
+
+void Image::readRegionElements( unsigned char *data,
+                                unsigned int x, unsigned int y, unsigned int z,
+                                unsigned int w, unsigned int h,
+                                unsigned int d ) {
+  unsigned int bytes_per_pixel = ( bitsPerPixel() + 7 ) / 8;
+  for( unsigned int zi = 0; zi < d; ++zi ) {
+    for( unsigned int yi = 0; yi < h; ++yi ) {
+      for( unsigned int xi = 0; xi < w; ++xi ) {
+        getElement( data, x + xi, y + yi, z + zi );
+        data += bytes_per_pixel;
+      }
+    }
+  }
+}
+
+void Image::writeRegionElements( const unsigned char *data,
+                                 unsigned int x, unsigned int y, unsigned int z,
+                                 unsigned int w, unsigned int h,
+                                 unsigned int d ) {
+  unsigned int bytes_per_pixel = ( bitsPerPixel() + 7 ) / 8;
+  for( unsigned int zi = 0; zi < d; ++zi ) {
+    for( unsigned int yi = 0; yi < h; ++yi ) {
+      for( unsigned int xi = 0; xi < w; ++xi ) {
+        setElement( const_cast< unsigned char * >( data ),
+                    x + xi, y + yi, z + zi );
+        data += bytes_per_pixel;
+      }
+    }
+  }
+}
+
+void Image::readRegion( void *_data,
+                        unsigned int x, unsigned int y, unsigned int z,
+                        unsigned int w, unsigned int h, unsigned int d ) {
+  unsigned char *data = static_cast< unsigned char * >( _data );
+  unsigned char *image_data = static_cast< unsigned char * >( getImageData() );
+  if( dataLayout() != LINEAR_LAYOUT || !image_data ||
+      bitsPerPixel() % 8 != 0 ) {
+    readRegionElements( data, x, y, z, w, h, d );
+    return;
+  }
+
+  size_t bytes_per_pixel = bitsPerPixel() / 8;
+  size_t image_row_size = width() * bytes_per_pixel;
+  size_t image_slice_size = image_row_size * height();
+  size_t row_size = w * bytes_per_pixel;
+  const unsigned char *src = image_data + z * image_slice_size +
+    y * image_row_size + x * bytes_per_pixel;
+
+  if( w == width() && h == height() ) {
+    // the region is whole slices.
+    memcpy( data, src, row_size * h * d );
+    return;
+  }
+
+  for( unsigned int zi = 0; zi < d; ++zi ) {
+    const unsigned char *slice = src + zi * image_slice_size;
+    if( w == width() ) {
+      // the rows of the slice are contiguous.
+      memcpy( data, slice, row_size * h );
+      data += row_size * h;
+    } else {
+      for( unsigned int yi = 0; yi < h; ++yi ) {
+        memcpy( data, slice + yi * image_row_size, row_size );
+        data += row_size;
+      }
+    }
+  }
+}
+
+void Image::writeRegion( const void *_data,
+                         unsigned int x, unsigned int y, unsigned int z,
+                         unsigned int w, unsigned int h, unsigned int d ) {
+  const unsigned char *data = static_cast< const unsigned char * >( _data );
+  unsigned char *image_data = static_cast< unsigned char * >( getImageData() );
+  if( dataLayout() != LINEAR_LAYOUT || !image_data ||
+      bitsPerPixel() % 8 != 0 ) {
+    writeRegionElements( data, x, y, z, w, h, d );
+    return;
+  }
+
+  size_t bytes_per_pixel = bitsPerPixel() / 8;
+  size_t image_row_size = width() * bytes_per_pixel;
+  size_t image_slice_size = image_row_size * height();
+  size_t row_size = w * bytes_per_pixel;
+  unsigned char *dst = image_data + z * image_slice_size +
+    y * image_row_size + x * bytes_per_pixel;
+
+  if( w == width() && h == height() ) {
+    memcpy( dst, data, row_size * h * d );
+  } else {
+    for( unsigned int zi = 0; zi < d; ++zi ) {
+      unsigned char *slice = dst + zi * image_slice_size;
+      if( w == width() ) {
+        memcpy( slice, data, row_size * h );
+        data += row_size * h;
+      } else {
+        for( unsigned int yi = 0; yi < h; ++yi ) {
+          memcpy( slice + yi * image_row_size, data, row_size );
+          data += row_size;
+        }
+      }
+    }
+  }
+  imageDataChanged();
+}
+
+void Image::readRegion( void *_data,
+                        unsigned int x, unsigned int y, unsigned int z,
+                        unsigned int w, unsigned int h, unsigned int d,
+                        PixelType pixel_type,
+                        PixelComponentType pixel_component_type,
+                        unsigned int bits_per_pixel ) {
+  using namespace ImageInternals;
+  if( hasPixelFormat( this, pixel_type, pixel_component_type,
+                      bits_per_pixel ) ) {
+    readRegion( _data, x, y, z, w, h, d );
+    return;
+  }
+  if( w == 0 || h == 0 || d == 0 ) return;
+
+  unsigned char *data = static_cast< unsigned char * >( _data );
+  PixelFormat format( pixel_type, pixel_component_type, bits_per_pixel );
+  unsigned int src_bytes_per_pixel = bitsPerPixel() / 8;
+  unsigned int dst_bytes_per_pixel = bits_per_pixel / 8;
+
+  // read and convert a row at a time.
+  std::vector< unsigned char > row( (size_t) w * src_bytes_per_pixel );
+  for( unsigned int zi = 0; zi < d; ++zi ) {
+    for( unsigned int yi = 0; yi < h; ++yi ) {
+      readRegion( &row[0], x, y + yi, z + zi, w, 1, 1 );
+      for( unsigned int xi = 0; xi < w; ++xi ) {
+        H3DUtil::RGBA rgba =
+          imageValueToRGBA( &row[ (size_t) xi * src_bytes_per_pixel ] );
+        format.RGBAToImageValue( rgba, data );
+        data += dst_bytes_per_pixel;
+      }
+    }
+  }
+}
+
+void Image::writeRegion( const void *_data,
+                         unsigned int x, unsigned int y, unsigned int z,
+                         unsigned int w, unsigned int h, unsigned int d,
+                         PixelType pixel_type,
+                         PixelComponentType pixel_component_type,
+                         unsigned int bits_per_pixel ) {
+  using namespace ImageInternals;
+  if( hasPixelFormat( this, pixel_type, pixel_component_type,
+                      bits_per_pixel ) ) {
+    writeRegion( _data, x, y, z, w, h, d );
+    return;
+  }
+  if( w == 0 || h == 0 || d == 0 ) return;
+
+  unsigned char *data = (unsigned char *) _data;
+  PixelFormat format( pixel_type, pixel_component_type, bits_per_pixel );
+  unsigned int src_bytes_per_pixel = bits_per_pixel / 8;
+  unsigned int dst_bytes_per_pixel = bitsPerPixel() / 8;
+
+  // convert and write a row at a time.
+  std::vector< unsigned char > row( (size_t) w * dst_bytes_per_pixel );
+  for( unsigned int zi = 0; zi < d; ++zi ) {
+    for( unsigned int yi = 0; yi < h; ++yi ) {
+      for( unsigned int xi = 0; xi < w; ++xi ) {
+        H3DUtil::RGBA rgba = format.imageValueToRGBA( data );
+        RGBAToImageValue( rgba, &row[ (size_t) xi * dst_bytes_per_pixel ] );
+        data += src_bytes_per_pixel;
+      }
+      writeRegion( &row[0], x, y + yi, z + zi, w, 1, 1 );
+    }
+  }
+}
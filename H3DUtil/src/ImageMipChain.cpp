@@ -0,0 +1,316 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImageMipChain.cpp
+/// \brief cpp file for functions building mipmap chains of images.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/ImageMipChain.h>
+#include <H3DUtil/ThreadPool.h>
+#include <H3DUtil/H3DMath.h>
+#include <string.h>
+
+using namespace H3DUtil;
+
+namespace ImageMipChainInternals {
+  // The source pixels and weights used along one axis. Pixel i of the
+  // result is the weighted sum of the source pixels
+  // i * factor + offset[k], clamped to the image.
+  struct Taps {
+    unsigned int factor;
+    unsigned int nr_taps;
+    int offset[4];
+    float weight[4];
+  };
+
+  // Set up the taps for an axis with source size src_size.
+  void setTaps( Taps &taps, unsigned int src_size, MipFilterType filter_type ) {
+    if( src_size < 2 ) {
+      taps.factor = 1;
+      taps.nr_taps = 1;
+      taps.offset[0] = 0;
+      taps.weight[0] = 1;
+    } else if( filter_type == GAUSSIAN_MIP_FILTER ) {
+      taps.factor = 2;
+      taps.nr_taps = 4;
+      taps.offset[0] = -1; taps.weight[0] = 0.125f;
+      taps.offset[1] = 0;  taps.weight[1] = 0.375f;
+      taps.offset[2] = 1;  taps.weight[2] = 0.375f;
+      taps.offset[3] = 2;  taps.weight[3] = 0.125f;
+    } else {
+      taps.factor = 2;
+      taps.nr_taps = 2;
+      taps.offset[0] = 0; taps.weight[0] = 0.5f;
+      taps.offset[1] = 1; taps.weight[1] = 0.5f;
+    }
+  }
+
+  inline unsigned int clampIndex( int i, unsigned int size ) {
+    if( i < 0 ) return 0;
+    if( i >= (int) size ) return size - 1;
+    return (unsigned int) i;
+  }
+
+  // The type used to accumulate weighted values of type T. float is
+  // precise enough for 8 and 16 bit values.
+  template< class T > struct AccumType { typedef double Type; };
+  template<> struct AccumType< unsigned char > { typedef float Type; };
+  template<> struct AccumType< signed char > { typedef float Type; };
+  template<> struct AccumType< unsigned short > { typedef float Type; };
+  template<> struct AccumType< short > { typedef float Type; };
+  template<> struct AccumType< float > { typedef float Type; };
+
+  // Convert an accumulated value to T, rounding to the nearest integer
+  // for integer types.
+  template< class T, class A >
+  inline T fromAccum( A v ) {
+    return (T) H3DFloor( v + (A) 0.5 );
+  }
+
+  template<>
+  inline float fromAccum< float, float >( float v ) {
+    return v;
+  }
+
+  template<>
+  inline double fromAccum< double, double >( double v ) {
+    return v;
+  }
+
+  struct DownsampleInfo {
+    // the source slices [src_z_begin, src_depth) in LINEAR_LAYOUT.
+    const unsigned char *src;
+    unsigned char *dst;
+    unsigned int src_z_begin;
+    unsigned int src_width, src_height, src_depth;
+    unsigned int dst_width, dst_height;
+    unsigned int bytes_per_pixel;
+    Taps x, y, z;
+  };
+
+  // RangeFunc computing the rows [begin, end) of the result, where row
+  // r is row r % dst_height of slice r / dst_height. The source rows are
+  // first combined along z and y into one row, which is then filtered
+  // along x. The inner loops over the combined row are simple enough for
+  // the compiler to vectorize.
+  template< class T, unsigned int N >
+  void downsampleRows( int begin, int end, void *data ) {
+    typedef typename AccumType< T >::Type A;
+    DownsampleInfo *info = static_cast< DownsampleInfo * >( data );
+    const T *src = reinterpret_cast< const T * >( info->src );
+    T *dst = reinterpret_cast< T * >( info->dst );
+    size_t row_size = (size_t) info->src_width * N;
+    std::vector< A > row( row_size );
+
+    for( int r = begin; r < end; ++r ) {
+      unsigned int z = r / info->dst_height;
+      unsigned int y = r % info->dst_height;
+
+      for( size_t i = 0; i < row_size; ++i ) row[i] = 0;
+      for( unsigned int kz = 0; kz < info->z.nr_taps; ++kz ) {
+        unsigned int sz = clampIndex( z * info->z.factor + info->z.offset[kz],
+                                      info->src_depth );
+        for( unsigned int ky = 0; ky < info->y.nr_taps; ++ky ) {
+          unsigned int sy =
+            clampIndex( y * info->y.factor + info->y.offset[ky],
+                        info->src_height );
+          A w = (A) ( info->z.weight[kz] * info->y.weight[ky] );
+          const T *s = src + ( (size_t) ( sz - info->src_z_begin ) *
+                               info->src_height + sy ) * row_size;
+          for( size_t i = 0; i < row_size; ++i ) row[i] += w * s[i];
+        }
+      }
+
+      T *d = dst + (size_t) r * info->dst_width * N;
+      for( unsigned int x = 0; x < info->dst_width; ++x ) {
+        A v[N];
+        for( unsigned int c = 0; c < N; ++c ) v[c] = 0;
+        for( unsigned int kx = 0; kx < info->x.nr_taps; ++kx ) {
+          unsigned int sx =
+            clampIndex( x * info->x.factor + info->x.offset[kx],
+                        info->src_width );
+          A w = (A) info->x.weight[kx];
+          for( unsigned int c = 0; c < N; ++c ) v[c] += w * row[ sx * N + c ];
+        }
+        for( unsigned int c = 0; c < N; ++c ) {
+          d[ x * N + c ] = fromAccum< T, A >( v[c] );
+        }
+      }
+    }
+  }
+
+  // RangeFunc for images without a specialized filter function. Each
+  // result pixel is a copy of the source pixel at (2x, 2y, 2z).
+  void pickRows( int begin, int end, void *data ) {
+    DownsampleInfo *info = static_cast< DownsampleInfo * >( data );
+    unsigned int bpp = info->bytes_per_pixel;
+    for( int r = begin; r < end; ++r ) {
+      unsigned int sz = ( r / info->dst_height ) * info->z.factor;
+      unsigned int sy = ( r % info->dst_height ) * info->y.factor;
+      unsigned char *d = info->dst + (size_t) r * info->dst_width * bpp;
+      for( unsigned int x = 0; x < info->dst_width; ++x ) {
+        unsigned int sx = x * info->x.factor;
+        memcpy( d + x * bpp,
+                info->src + ( ( (size_t) ( sz - info->src_z_begin ) *
+                                info->src_height + sy ) *
+                              info->src_width + sx ) * bpp,
+                bpp );
+      }
+    }
+  }
+
+  template< class T >
+  ThreadPool::RangeFunc getDownsampleFunction( unsigned int nr_components ) {
+    switch( nr_components ) {
+    case 1: return downsampleRows< T, 1 >;
+    case 2: return downsampleRows< T, 2 >;
+    case 3: return downsampleRows< T, 3 >;
+    case 4: return downsampleRows< T, 4 >;
+    default: return NULL;
+    }
+  }
+
+  // Returns the function to use for downsampling the given image or NULL
+  // if there is no specialized function for the format of the image.
+  ThreadPool::RangeFunc getDownsampleFunction( Image *image ) {
+    unsigned int nr_components = image->nrPixelComponents();
+    unsigned int bits_per_pixel = image->bitsPerPixel();
+    if( nr_components == 0 || bits_per_pixel % ( 8 * nr_components ) != 0 )
+      return NULL;
+    unsigned int bytes_per_component = bits_per_pixel / ( 8 * nr_components );
+
+    switch( image->pixelComponentType() ) {
+    case Image::UNSIGNED:
+      if( bytes_per_component == 1 )
+        return getDownsampleFunction< unsigned char >( nr_components );
+      if( bytes_per_component == 2 )
+        return getDownsampleFunction< unsigned short >( nr_components );
+      if( bytes_per_component == 4 )
+        return getDownsampleFunction< unsigned int >( nr_components );
+      break;
+    case Image::SIGNED:
+      if( bytes_per_component == 1 )
+        return getDownsampleFunction< signed char >( nr_components );
+      if( bytes_per_component == 2 )
+        return getDownsampleFunction< short >( nr_components );
+      if( bytes_per_component == 4 )
+        return getDownsampleFunction< int >( nr_components );
+      break;
+    case Image::RATIONAL:
+      if( bytes_per_component == 4 )
+        return getDownsampleFunction< float >( nr_components );
+      if( bytes_per_component == 8 )
+        return getDownsampleFunction< double >( nr_components );
+      break;
+    }
+    return NULL;
+  }
+
+  inline unsigned int downsampledSize( unsigned int size ) {
+    return size > 1 ? size / 2 : 1;
+  }
+}
+
+PixelImage *H3DUtil::downsampleImage( Image *image,
+                                      MipFilterType filter_type ) {
+  using namespace ImageMipChainInternals;
+  unsigned int w = downsampledSize( image->width() );
+  unsigned int h = downsampledSize( image->height() );
+  unsigned int d = downsampledSize( image->depth() );
+  Vec3f pixel_size = image->pixelSize();
+  pixel_size.x *= (H3DFloat) image->width() / w;
+  pixel_size.y *= (H3DFloat) image->height() / h;
+  pixel_size.z *= (H3DFloat) image->depth() / d;
+
+  size_t size = ( (size_t) w * h * d * image->bitsPerPixel() ) / 8;
+  PixelImage *result = new PixelImage( w, h, d,
+                                       image->bitsPerPixel(),
+                                       image->pixelType(),
+                                       image->pixelComponentType(),
+                                       new unsigned char[ size ],
+                                       false,
+                                       pixel_size );
+  downsampleImageSlices( image, result, 0, d, filter_type );
+  return result;
+}
+
+void H3DUtil::downsampleImageSlices( Image *src,
+                                     PixelImage *dst,
+                                     unsigned int begin,
+                                     unsigned int end,
+                                     MipFilterType filter_type ) {
+  using namespace ImageMipChainInternals;
+  if( begin >= end ) return;
+
+  DownsampleInfo info;
+  info.src_z_begin = 0;
+  info.src_width = src->width();
+  info.src_height = src->height();
+  info.src_depth = src->depth();
+  info.dst_width = dst->width();
+  info.dst_height = dst->height();
+  info.bytes_per_pixel = src->bitsPerPixel() / 8;
+  info.dst = static_cast< unsigned char * >( dst->getImageData() );
+  setTaps( info.x, info.src_width, filter_type );
+  setTaps( info.y, info.src_height, filter_type );
+  setTaps( info.z, info.src_depth, filter_type );
+
+  ThreadPool::RangeFunc func = getDownsampleFunction( src );
+  if( !func ) func = pickRows;
+  info.src = static_cast< const unsigned char * >( src->getImageData() );
+  // the filter functions need the data in linear layout, so other images
+  // have the source slices that are used copied with readRegion.
+  std::vector< unsigned char > linear_data;
+  if( src->dataLayout() != Image::LINEAR_LAYOUT || !info.src ) {
+    info.src_z_begin =
+      clampIndex( begin * info.z.factor + info.z.offset[0], info.src_depth );
+    unsigned int z_end =
+      clampIndex( ( end - 1 ) * info.z.factor +
+                  info.z.offset[ info.z.nr_taps - 1 ], info.src_depth ) + 1;
+    unsigned int nr_slices = z_end - info.src_z_begin;
+    linear_data.resize( (size_t) info.src_width * info.src_height *
+                        nr_slices * ( ( src->bitsPerPixel() + 7 ) / 8 ) );
+    src->readRegion( &linear_data[0], 0, 0, info.src_z_begin,
+                     info.src_width, info.src_height, nr_slices );
+    info.src = &linear_data[0];
+  }
+
+  ThreadPool::getDefaultPool()->parallelFor( (int)( begin * info.dst_height ),
+                                             (int)( end * info.dst_height ),
+                                             func, &info );
+}
+
+void H3DUtil::buildMipChain( Image *image,
+                             std::vector< AutoRef< PixelImage > > &levels,
+                             MipFilterType filter_type,
+                             unsigned int max_levels ) {
+  levels.clear();
+  Image *level = image;
+  while( level->width() > 1 || level->height() > 1 || level->depth() > 1 ) {
+    if( max_levels != 0 && levels.size() >= max_levels ) break;
+    PixelImage *next = downsampleImage( level, filter_type );
+    levels.push_back( AutoRef< PixelImage >( next ) );
+    level = next;
+  }
+}
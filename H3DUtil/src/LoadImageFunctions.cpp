@@ -59,13 +59,31 @@
 #include <dirent.h>
 #endif
 #include <algorithm>
+#include <sstream>
+#include <locale>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef H3D_WINDOWS
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include <H3DUtil/ThreadPool.h>
 
 #endif // HAVE_DCMTK
 
 #include <H3DUtil/PixelImage.h>
 #include <H3DUtil/DicomImage.h>
+#include <H3DUtil/MappedRawImage.h>
+#include <H3DUtil/MultiResolutionImage.h>
+#include <H3DUtil/NrrdStream.h>
 #include <fstream>
 #include <memory>
+#include <vector>
+#include <string.h>
 
 using namespace H3DUtil;
 
@@ -153,123 +171,284 @@ Image *H3DUtil::loadFreeImage( const string &url ) {
 }
 #endif
 
-Image *H3DUtil::loadRawImage( const string &url,
-                              RawImageInfo &raw_image_info ) {
-  Image::PixelType pixel_type;
-  if( raw_image_info.pixel_type_string == "LUMINANCE" )
-    pixel_type = Image::LUMINANCE;
-  else if( raw_image_info.pixel_type_string == "LUMINANCE_ALPHA" )
-    pixel_type = Image::LUMINANCE_ALPHA;
-  else if( raw_image_info.pixel_type_string == "RGB" ) 
-    pixel_type = Image::RGB;
-  else if( raw_image_info.pixel_type_string == "RGBA" ) 
-    pixel_type = Image::RGBA;
-  else if( raw_image_info.pixel_type_string == "BGR" ) 
-    pixel_type = Image::BGR;
-  else if( raw_image_info.pixel_type_string == "BGRA" ) 
-    pixel_type = Image::BGRA;
-  else if( raw_image_info.pixel_type_string == "VEC3" ) 
-    pixel_type = Image::VEC3;
-  else {
-    Console(3) << "Warning: Invalid pixelType value \"" << raw_image_info.pixel_type_string
-               << "\" in  RawImageLoader. " << endl;
-    return NULL;
+namespace LoadImageFunctionsInternal {
+#ifdef HAVE_ZLIB
+  // The size of the chunks of compressed data read from file.
+  const size_t inflate_chunk_size = 128 * 1024;
+
+  // Function called by inflateRawFile after each chunk with the number
+  // of bytes inflated so far. Inflating stops if it returns false.
+  typedef bool (*InflateChunkFunc)( size_t nr_inflated, void *data );
+
+  // Inflate a gzip or zlib compressed stream from is into data. The
+  // file is read and inflated one chunk at a time directly into data so
+  // the compressed file never has to be in memory at once. Returns false
+  // if the stream could not be inflated into exactly size bytes or if
+  // chunk_func returned false.
+  bool inflateRawFile( istream &is,
+                       const string &url,
+                       unsigned char *data,
+                       size_t size,
+                       InflateChunkFunc chunk_func = NULL,
+                       void *chunk_data = NULL ) {
+    z_stream strm;
+    memset( &strm, 0, sizeof( strm ) );
+
+    // 47 = 15 bit window + 32 to detect gzip or zlib header automatically.
+    int err = inflateInit2( &strm, 47 );
+    if( err == Z_MEM_ERROR ) {
+      Console(3) << "Warning: zlib memory error." << endl;
+      return false;
+    }
+    if( err != Z_OK ) {
+      Console(3) << "Warning: zlib version error." << endl;
+      return false;
+    }
+
+    vector< unsigned char > chunk( inflate_chunk_size );
+    size_t nr_inflated = 0;
+    err = Z_OK;
+    while( err != Z_STREAM_END ) {
+      if( strm.avail_in == 0 ) {
+        is.read( (char *)&chunk[0], chunk.size() );
+        strm.avail_in = (uInt) is.gcount();
+        strm.next_in = &chunk[0];
+        if( strm.avail_in == 0 ) break;
+      }
+
+      // avail_out is an uInt so large images are inflated in several
+      // steps. When the image is full, inflate into a dummy byte to
+      // detect if the stream contains more data than the image.
+      size_t remaining = size - nr_inflated;
+      uInt avail_out = remaining > 0x40000000 ? 0x40000000 : (uInt) remaining;
+      unsigned char extra_data;
+      strm.next_out = remaining > 0 ? data + nr_inflated : &extra_data;
+      strm.avail_out = remaining > 0 ? avail_out : 1;
+      err = inflate( &strm, Z_NO_FLUSH );
+      if( remaining == 0 && strm.avail_out == 0 ) {
+        Console(3) << "Warning: Compressed data in " << url
+                   << " is larger than the image size." << endl;
+        err = Z_DATA_ERROR;
+        break;
+      }
+      if( remaining > 0 ) nr_inflated += avail_out - strm.avail_out;
+      if( chunk_func && !chunk_func( nr_inflated, chunk_data ) ) {
+        inflateEnd( &strm );
+        return false;
+      }
+
+      if( err == Z_NEED_DICT || err == Z_DATA_ERROR ) {
+        Console(3) << "Warning: zlib unrecognizable data error in "
+                   << url << "." << endl;
+        break;
+      }
+      if( err == Z_MEM_ERROR ) {
+        Console(3) << "Warning: zlib memory error." << endl;
+        break;
+      }
+      if( err == Z_STREAM_ERROR ) {
+        Console(3) << "Warning: zlib stream error." << endl;
+        break;
+      }
+      // Z_BUF_ERROR only means that no progress was possible, which
+      // is handled by reading more input above.
+    }
+    inflateEnd( &strm );
+
+    if( err != Z_STREAM_END ) {
+      // Z_OK or Z_BUF_ERROR means that the file ended before the
+      // stream did, other errors have been reported above.
+      if( err == Z_OK || err == Z_BUF_ERROR ) {
+        Console(3) << "Warning: Compressed data in " << url
+                   << " is incomplete." << endl;
+      }
+      return false;
+    }
+
+    if( nr_inflated < size ) {
+      Console(3) << "Warning: Compressed data in " << url
+                 << " is smaller than the image size." << endl;
+      return false;
+    }
+    return true;
+  }
+#endif
+
+  // Get the pixel type and pixel component type from the strings in
+  // raw_image_info. Returns false if they are invalid.
+  bool getRawImageFormat( const RawImageInfo &raw_image_info,
+                          Image::PixelType &pixel_type,
+                          Image::PixelComponentType &pixel_component_type ) {
+    if( raw_image_info.pixel_type_string == "LUMINANCE" )
+      pixel_type = Image::LUMINANCE;
+    else if( raw_image_info.pixel_type_string == "LUMINANCE_ALPHA" )
+      pixel_type = Image::LUMINANCE_ALPHA;
+    else if( raw_image_info.pixel_type_string == "RGB" ) 
+      pixel_type = Image::RGB;
+    else if( raw_image_info.pixel_type_string == "RGBA" ) 
+      pixel_type = Image::RGBA;
+    else if( raw_image_info.pixel_type_string == "BGR" ) 
+      pixel_type = Image::BGR;
+    else if( raw_image_info.pixel_type_string == "BGRA" ) 
+      pixel_type = Image::BGRA;
+    else if( raw_image_info.pixel_type_string == "VEC3" ) 
+      pixel_type = Image::VEC3;
+    else {
+      Console(3) << "Warning: Invalid pixelType value \"" << raw_image_info.pixel_type_string
+                 << "\" in  RawImageLoader. " << endl;
+      return false;
+    }
+
+    if( raw_image_info.pixel_component_type_string == "SIGNED" ) 
+      pixel_component_type = Image::SIGNED; 
+    else if( raw_image_info.pixel_component_type_string == "UNSIGNED" )
+      pixel_component_type = Image::UNSIGNED;
+    else if( raw_image_info.pixel_component_type_string == "RATIONAL" )
+      pixel_component_type = Image::RATIONAL;
+    else {
+      Console(3) << "Warning: Invalid pixelComponentType value \"" 
+                 << raw_image_info.pixel_component_type_string
+                 << "\" in  RawImageLoader. " << endl;
+      return false;
+    }
+    return true;
+  }
+}
+
+namespace LoadImageFunctionsInternal {
+  // The approximate number of bytes read from file between each update of
+  // a progressively loaded image or report of progress.
+  const size_t progressive_read_size = 4 * 1024 * 1024;
+
+  // The progress function of a loadRawImage call.
+  struct RawLoadProgress {
+    LoadImageProgressFunc func;
+    void *data;
+    size_t size;
+  };
+
+#ifdef HAVE_ZLIB
+  // InflateChunkFunc reporting the fraction inflated to the
+  // RawLoadProgress given as data.
+  bool reportInflateProgress( size_t nr_inflated, void *data ) {
+    RawLoadProgress *progress = static_cast< RawLoadProgress * >( data );
+    return progress->func( (H3DFloat) nr_inflated / progress->size,
+                           progress->data );
+  }
+#endif
+
+  // Returns true if the stream starts with a gzip or zlib header. Raw
+  // image data can start with the same two bytes, e.g. a 16 bit value
+  // 0x8b1f, so a header is only taken to mean a compressed file if the
+  // file does not have exactly the size of the image. The stream is left
+  // at its start.
+  bool isCompressedRawFile( istream &is,
+                            size_t file_size,
+                            size_t image_size ) {
+    unsigned char header[2];
+    is.seekg( 0, ios::beg );
+    is.read( (char *)header, 2 );
+    bool header_read = is.gcount() == 2;
+    is.clear();
+    is.seekg( 0, ios::beg );
+    if( !header_read || file_size == image_size ) return false;
+    bool gzip_header = header[0] == 0x1f && header[1] == 0x8b;
+    // deflate with at most a 32K window, no preset dictionary and a valid
+    // check value.
+    bool zlib_header = ( header[0] & 0x0f ) == 8 && ( header[0] >> 4 ) <= 7 &&
+      !( header[1] & 0x20 ) && ( header[0] * 256 + header[1] ) % 31 == 0;
+    return gzip_header || zlib_header;
   }
+}
 
+Image *H3DUtil::loadRawImage( const string &url,
+                              RawImageInfo &raw_image_info,
+                              LoadImageProgressFunc progress_func,
+                              void *progress_data ) {
+  Image::PixelType pixel_type;
   Image::PixelComponentType pixel_component_type;
-  if( raw_image_info.pixel_component_type_string == "SIGNED" ) 
-    pixel_component_type = Image::SIGNED; 
-  else if( raw_image_info.pixel_component_type_string == "UNSIGNED" )
-    pixel_component_type = Image::UNSIGNED;
-  else if( raw_image_info.pixel_component_type_string == "RATIONAL" )
-    pixel_component_type = Image::RATIONAL;
-  else {
-    Console(3) << "Warning: Invalid pixelComponentType value \"" 
-               << raw_image_info.pixel_component_type_string
-               << "\" in  RawImageLoader. " << endl;
+  if( !LoadImageFunctionsInternal::getRawImageFormat( raw_image_info,
+                                                      pixel_type,
+                                                      pixel_component_type ) )
     return NULL;
-  }
-    
-  unsigned int expected_size = 
-    raw_image_info.width * raw_image_info.height * raw_image_info.depth *
+
+  size_t expected_size = 
+    (size_t) raw_image_info.width * raw_image_info.height * raw_image_info.depth *
     ( raw_image_info.bits_per_pixel / 8 );
 
-  unsigned char * data = new unsigned char[expected_size];
-  
   ifstream is( url.c_str(), ios::in | ios::binary );
   if( !is.good() ) {
     return NULL;
   }
-  
-  is.read( (char *)data, expected_size );
-  unsigned int actual_size = (unsigned int) is.gcount();
-  is.close();
-  
-#ifdef HAVE_ZLIB
-  
-  if( actual_size < expected_size ){
-    
-    unsigned char * data2 = new unsigned char[expected_size];
-//    unsigned long int uncompressed_size = expected_size;
-    
-    int err;
-    z_stream strm = {
-      data, (uInt)actual_size, 0,
-      data2, expected_size, 0
-    };
-    
-    err = inflateInit2(&strm,47);
-    
-    if( err == Z_MEM_ERROR ){
-      Console(3) << "Warning: zlib memory error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    if( err == Z_VERSION_ERROR ){
-      Console(3) << "Warning: zlib version error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    
-    err = inflate(&strm,Z_FINISH);
-    
-    if( err == Z_DATA_ERROR ){
-      Console(3) << "Warning: zlib unrecognizable data error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    if( err == Z_STREAM_ERROR ){
-      Console(3) << "Warning: zlib stream error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    if( err == Z_BUF_ERROR ){
-      Console(3) << "Warning: zlib out of memory error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
+
+  is.seekg( 0, ios::end );
+  size_t file_size = (size_t) is.tellg();
+  bool compressed = 
+    LoadImageFunctionsInternal::isCompressedRawFile( is, file_size,
+                                                     expected_size );
+
+  // Uncompressed files are memory mapped so that the data is only read
+  // when used and can be shared between processes.
+  if( !compressed ) {
+    try {
+      return new MappedRawImage( url,
+                                 raw_image_info.width,
+                                 raw_image_info.height,
+                                 raw_image_info.depth,
+                                 raw_image_info.bits_per_pixel,
+                                 pixel_type,
+                                 pixel_component_type,
+                                 raw_image_info.pixel_size );
+    } catch( const MappedRawImage::CouldNotMapFile & ) {
     }
-    
-    err = inflateEnd(&strm);
-    
-    if( err == Z_STREAM_ERROR ){
-      Console(3) << "Warning: zlib stream error." << endl;
+  }
+
+  unsigned char * data = new unsigned char[expected_size];
+
+  if( compressed ) {
+#ifdef HAVE_ZLIB
+    LoadImageFunctionsInternal::RawLoadProgress progress;
+    progress.func = progress_func;
+    progress.data = progress_data;
+    progress.size = expected_size;
+    if( !LoadImageFunctionsInternal::inflateRawFile(
+          is, url, data, expected_size,
+          progress_func ? LoadImageFunctionsInternal::reportInflateProgress :
+          NULL,
+          &progress ) ) {
       delete[] data;
-      delete[] data2;
       return NULL;
     }
-    
     Console(2) << "Inflated compressed raw file." << endl;
+#else
+    Console(3) << "Warning: Raw file " << url << " is compressed but "
+               << "H3DUtil is built without zlib." << endl;
     delete[] data;
-    data = data2;
-  }
-  
+    return NULL;
 #endif
-  
+  } else {
+    // read a part at a time to be able to report the progress.
+    size_t read_size = LoadImageFunctionsInternal::progressive_read_size;
+    for( size_t offset = 0; offset < expected_size; offset += read_size ) {
+      size_t nr_bytes = expected_size - offset;
+      if( nr_bytes > read_size ) nr_bytes = read_size;
+      is.read( (char *)data + offset, nr_bytes );
+      if( (size_t) is.gcount() != nr_bytes ) {
+        Console(3) << "Warning: Raw file " << url
+                   << " is smaller than the image size." << endl;
+        delete[] data;
+        return NULL;
+      }
+      if( progress_func &&
+          !progress_func( (H3DFloat)( offset + nr_bytes ) / expected_size,
+                          progress_data ) ) {
+        delete[] data;
+        return NULL;
+      }
+    }
+  }
+  is.close();
+
   return new PixelImage( raw_image_info.width,
                          raw_image_info.height,
                          raw_image_info.depth,
@@ -281,8 +460,150 @@ Image *H3DUtil::loadRawImage( const string &url,
                          raw_image_info.pixel_size );
 }
 
+namespace LoadImageFunctionsInternal {
+  // Data for loading a raw file into a MultiResolutionImage.
+  struct ProgressiveRawLoad {
+    string url;
+    MultiResolutionImage *image;
+    size_t slice_size;
+  };
+
+#ifdef HAVE_ZLIB
+  // InflateChunkFunc adding the slices that have been completely inflated
+  // to the image.
+  bool addInflatedSlices( size_t nr_inflated, void *data ) {
+    ProgressiveRawLoad *load = static_cast< ProgressiveRawLoad * >( data );
+    unsigned int nr_slices = (unsigned int)( nr_inflated / load->slice_size );
+    unsigned int nr_added = load->image->getNrAddedSlices();
+    if( nr_slices > nr_added ) load->image->slicesAdded( nr_slices - nr_added );
+    return !load->image->loadingAborted();
+  }
+#endif
+
+  // MultiResolutionImage::LoadFunc loading a raw file. Uncompressed files
+  // first get a preview from a few slices read from the whole volume.
+  void loadRawProgressive( MultiResolutionImage *image, void *data ) {
+    std::auto_ptr< ProgressiveRawLoad >
+      load( static_cast< ProgressiveRawLoad * >( data ) );
+    load->image = image;
+    size_t size = load->slice_size * image->depth();
+    unsigned char *image_data = (unsigned char *) image->getImageData();
+
+    ifstream is( load->url.c_str(), ios::in | ios::binary );
+    if( !is.good() ) {
+      image->setLoadFailed();
+      return;
+    }
+    is.seekg( 0, ios::end );
+    size_t file_size = (size_t) is.tellg();
+    bool compressed = isCompressedRawFile( is, file_size, size );
+
+#ifdef HAVE_ZLIB
+    if( compressed ) {
+      // The slices of a compressed file can only be read in order, so
+      // there is no preview and the image is only sampled when complete.
+      if( !inflateRawFile( is, load->url, image_data, size,
+                           addInflatedSlices, load.get() ) &&
+          !image->loadingAborted() ) {
+        image->setLoadFailed();
+      }
+      return;
+    }
+#else
+    if( compressed ) {
+      Console(3) << "Warning: Raw file " << load->url << " is compressed "
+                 << "but H3DUtil is built without zlib." << endl;
+      image->setLoadFailed();
+      return;
+    }
+#endif
+    if( file_size < size ) {
+      Console(3) << "Warning: Raw file " << load->url
+                 << " is smaller than the image size." << endl;
+      image->setLoadFailed();
+      return;
+    }
+
+    // Read one slice for each slice in the preview level.
+    vector< unsigned char > slice( load->slice_size );
+    PixelImage *preview = image->getPreview();
+    for( unsigned int z = 0; z < preview->depth(); ++z ) {
+      if( image->loadingAborted() ) return;
+      is.seekg( (streamoff) image->getPreviewSourceSlice( z ) *
+                load->slice_size, ios::beg );
+      is.read( (char *)&slice[0], load->slice_size );
+      if( (size_t) is.gcount() != load->slice_size ) {
+        image->setLoadFailed();
+        return;
+      }
+      image->setPreviewSlice( z, &slice[0] );
+    }
+    image->setPreviewDone();
+
+    // Read the full resolution data a few slices at a time.
+    is.seekg( 0, ios::beg );
+    unsigned int slices_per_read =
+      (unsigned int)( progressive_read_size / load->slice_size );
+    if( slices_per_read < 1 ) slices_per_read = 1;
+    for( unsigned int z = 0; z < image->depth(); z += slices_per_read ) {
+      if( image->loadingAborted() ) return;
+      unsigned int nr_slices = image->depth() - z;
+      if( nr_slices > slices_per_read ) nr_slices = slices_per_read;
+      size_t read_size = nr_slices * load->slice_size;
+      is.read( (char *)image_data + z * load->slice_size, read_size );
+      if( (size_t) is.gcount() != read_size ) {
+        image->setLoadFailed();
+        return;
+      }
+      image->slicesAdded( nr_slices );
+    }
+  }
+}
+
+MultiResolutionImage *
+H3DUtil::loadRawImageProgressive( const string &url,
+                                  RawImageInfo &raw_image_info ) {
+  Image::PixelType pixel_type;
+  Image::PixelComponentType pixel_component_type;
+  if( !LoadImageFunctionsInternal::getRawImageFormat( raw_image_info,
+                                                      pixel_type,
+                                                      pixel_component_type ) )
+    return NULL;
+
+  if( raw_image_info.width <= 0 || raw_image_info.height <= 0 ||
+      raw_image_info.depth <= 0 || raw_image_info.bits_per_pixel <= 0 ||
+      raw_image_info.bits_per_pixel % 8 != 0 )
+    return NULL;
+
+  ifstream is( url.c_str(), ios::in | ios::binary );
+  if( !is.good() ) {
+    return NULL;
+  }
+  is.close();
+
+  MultiResolutionImage *image =
+    new MultiResolutionImage( raw_image_info.width,
+                              raw_image_info.height,
+                              raw_image_info.depth,
+                              raw_image_info.bits_per_pixel,
+                              pixel_type,
+                              pixel_component_type,
+                              raw_image_info.pixel_size );
+
+  LoadImageFunctionsInternal::ProgressiveRawLoad *load =
+    new LoadImageFunctionsInternal::ProgressiveRawLoad;
+  load->url = url;
+  load->image = image;
+  load->slice_size = (size_t) raw_image_info.width * raw_image_info.height *
+    ( raw_image_info.bits_per_pixel / 8 );
+  image->startLoading( LoadImageFunctionsInternal::loadRawProgressive, load );
+  return image;
+}
+
 #ifdef HAVE_TEEM
-Image *H3DUtil::loadNrrdFile( const string &url ) {
+Image *H3DUtil::loadNrrdFile( const string &url,
+                              LoadImageProgressFunc progress_func,
+                              void *progress_data ) {
   Nrrd *nin;
   
   /* create a new nrrd */
@@ -419,137 +740,845 @@ Image *H3DUtil::loadNrrdFile( const string &url ) {
                                   false, spacing );
   // free nrrd struct memory but not data.
   nrrdNix(nin);
+  // teem reads all data in one call so there is nothing to stop.
+  if( progress_func ) progress_func( 1, progress_data );
   return image;
 }
 
-int H3DUtil::saveImageAsNrrdFile( const string &filename,
-                                  Image *image ) {
-    Nrrd *nin;
-  
-  /* create a new nrrd */
-  nin = nrrdNew();
+#else
+Image *H3DUtil::loadNrrdFile( const string &url,
+                              LoadImageProgressFunc progress_func,
+                              void *progress_data ) {
+  NrrdReader reader;
+  if( !reader.open( url ) ) return NULL;
+  size_t slice_size = reader.sliceSize();
+  unsigned char *data = new unsigned char[ slice_size * reader.depth() ];
+
+  // read a few slices at a time to be able to report the progress.
+  unsigned int slices_per_read = (unsigned int)
+    ( LoadImageFunctionsInternal::progressive_read_size / slice_size );
+  if( slices_per_read < 1 ) slices_per_read = 1;
+  for( unsigned int z = 0; z < reader.depth(); z += slices_per_read ) {
+    unsigned int nr_slices = reader.depth() - z;
+    if( nr_slices > slices_per_read ) nr_slices = slices_per_read;
+    if( !reader.readSlices( data + z * slice_size, nr_slices ) ||
+        ( progress_func &&
+          !progress_func( (H3DFloat)( z + nr_slices ) / reader.depth(),
+                          progress_data ) ) ) {
+      delete [] data;
+      return NULL;
+    }
+  }
+  return new PixelImage( reader.width(), reader.height(), reader.depth(),
+                         reader.bitsPerPixel(),
+                         reader.pixelType(), reader.pixelComponentType(),
+                         data, false, reader.pixelSize() );
+}
+#endif
 
-  unsigned int bits_per_pixel = image->bitsPerPixel();
- 
-  Image::PixelComponentType component_type = image->pixelComponentType();
-  Image::PixelType pixel_type = image->pixelType();
-  const Vec3f &voxel_size = image->pixelSize(); 
-
-  // dimensions
-  unsigned int nr_components = 1;
-  if( pixel_type == Image::LUMINANCE ) {
-    nr_components = 1;
-  } else if( pixel_type == Image::LUMINANCE_ALPHA ) {
-    nr_components = 2;
-  } else if( pixel_type == Image::BGR || pixel_type == Image::RGB || 
-             pixel_type == Image::VEC3) {
-    nr_components = 3;
-  } else if( pixel_type == Image::RGBA || pixel_type == Image::BGRA ) {
-    nr_components = 4;
-  } else {
+namespace LoadImageFunctionsInternal {
+  // MultiResolutionImage::LoadFunc loading a Nrrd file with the
+  // NrrdReader given as data. Uncompressed files first get a preview
+  // from a few slices read from the whole volume. Compressed files can
+  // only be read in order, so they get no preview.
+  void loadNrrdProgressive( MultiResolutionImage *image, void *data ) {
+    std::auto_ptr< NrrdReader > reader( static_cast< NrrdReader * >( data ) );
+    unsigned char *image_data = (unsigned char *) image->getImageData();
+    size_t slice_size = reader->sliceSize();
+
+    if( reader->isSeekable() ) {
+      vector< unsigned char > slice( slice_size );
+      PixelImage *preview = image->getPreview();
+      for( unsigned int z = 0; z < preview->depth(); ++z ) {
+        if( image->loadingAborted() ) return;
+        if( !reader->seekSlice( image->getPreviewSourceSlice( z ) ) ||
+            !reader->readSlices( &slice[0], 1 ) ) {
+          image->setLoadFailed();
+          return;
+        }
+        image->setPreviewSlice( z, &slice[0] );
+      }
+      image->setPreviewDone();
+      reader->seekSlice( 0 );
+    }
+
+    unsigned int slices_per_read =
+      (unsigned int)( progressive_read_size / slice_size );
+    if( slices_per_read < 1 ) slices_per_read = 1;
+    for( unsigned int z = 0; z < image->depth(); z += slices_per_read ) {
+      if( image->loadingAborted() ) return;
+      unsigned int nr_slices = image->depth() - z;
+      if( nr_slices > slices_per_read ) nr_slices = slices_per_read;
+      if( !reader->readSlices( image_data + z * slice_size, nr_slices ) ) {
+        image->setLoadFailed();
+        return;
+      }
+      image->slicesAdded( nr_slices );
+    }
+  }
+}
+
+MultiResolutionImage *H3DUtil::loadNrrdFileProgressive( const string &url ) {
+  NrrdReader *reader = new NrrdReader;
+  if( !reader->open( url ) ) {
+    delete reader;
+    return NULL;
+  }
+  MultiResolutionImage *image =
+    new MultiResolutionImage( reader->width(),
+                              reader->height(),
+                              reader->depth(),
+                              reader->bitsPerPixel(),
+                              reader->pixelType(),
+                              reader->pixelComponentType(),
+                              reader->pixelSize() );
+  image->startLoading( LoadImageFunctionsInternal::loadNrrdProgressive,
+                       reader );
+  return image;
+}
+
+int H3DUtil::saveImageAsNrrdFile( const string &filename,
+                                  Image *image,
+                                  bool compress ) {
+  NrrdWriter writer;
+  if( !writer.open( filename,
+                    image->width(), image->height(), image->depth(),
+                    image->bitsPerPixel(),
+                    image->pixelType(), image->pixelComponentType(),
+                    image->pixelSize(),
+                    compress ) ) {
     return -1;
   }
 
-  int bytes_per_component =  bits_per_pixel / (nr_components * 8);
-  if( bits_per_pixel % (nr_components * 8) > 0 ) bytes_per_component++;
-
-  // save the type
-  if( component_type == Image::SIGNED ) {
-    if( bytes_per_component == 1 ) nin->type = nrrdTypeChar;
-    else if( bytes_per_component == 2 ) nin->type = nrrdTypeShort;
-    else if( bytes_per_component == 4 ) nin->type = nrrdTypeInt;
-    else if( bytes_per_component == 8 ) nin->type = nrrdTypeLLong;
-    else return -1; 
-  } else if( component_type == Image::UNSIGNED ) {
-    if( bytes_per_component == 1 ) nin->type = nrrdTypeUChar;
-    else if( bytes_per_component == 2 ) nin->type = nrrdTypeUShort;
-    else if( bytes_per_component == 4 ) nin->type = nrrdTypeUInt;
-    else if( bytes_per_component == 8 ) nin->type = nrrdTypeULLong;
-    else return -1; 
-  } else  if( component_type == Image::RATIONAL ) {
-    if(  bytes_per_component == 4 ) nin->type = nrrdTypeFloat;
-    else if( bytes_per_component == 8 ) nin->type = nrrdTypeDouble;
-    else return -1; 
-  } else {
-    return -1; 
+  // Images without directly accessible data in linear layout, e.g.
+  // bricked or paged images, are copied a few slices at a time.
+  const unsigned char *data = NULL;
+  if( image->dataLayout() == Image::LINEAR_LAYOUT ) {
+    data = static_cast< const unsigned char * >( image->getImageData() );
+  }
+  vector< unsigned char > slab;
+
+  size_t slice_size = writer.sliceSize();
+  unsigned int slices_per_write = (unsigned int)
+    ( LoadImageFunctionsInternal::progressive_read_size / slice_size );
+  if( slices_per_write < 1 ) slices_per_write = 1;
+  for( unsigned int z = 0; z < image->depth(); z += slices_per_write ) {
+    unsigned int nr_slices = image->depth() - z;
+    if( nr_slices > slices_per_write ) nr_slices = slices_per_write;
+    const unsigned char *slab_data;
+    if( data ) {
+      slab_data = data + z * slice_size;
+    } else {
+      slab.resize( nr_slices * slice_size );
+      image->readRegion( &slab[0], 0, 0, z,
+                         image->width(), image->height(), nr_slices );
+      slab_data = &slab[0];
+    }
+    if( !writer.writeSlices( slab_data, nr_slices ) ) break;
   }
+  return writer.close() ? 0 : -1;
+}
 
+#ifdef HAVE_DCMTK
+namespace LoadImageFunctionsInternal {
+  // Reports the progress of a loader running on several threads. The
+  // progress function is called with lock held so that calls are never
+  // concurrent and the reported values are increasing.
+  struct LoadProgress {
+    LoadProgress( LoadImageProgressFunc _func, void *_data ):
+      func( _func ), data( _data ), nr_steps( 1 ), nr_done( 0 ),
+      start( 0 ), end( 1 ), stopped( 0 ) {}
+
+    // Start a new stage with the given number of steps covering the
+    // progress from _start to _end.
+    void setStage( int _nr_steps, H3DFloat _start, H3DFloat _end ) {
+      lock.lock();
+      nr_steps = _nr_steps > 0 ? _nr_steps : 1;
+      nr_done = 0;
+      start = _start;
+      end = _end;
+      lock.unlock();
+    }
 
+    // Mark one step of the current stage as done.
+    void stepDone() {
+      if( !func ) return;
+      lock.lock();
+      ++nr_done;
+      if( !func( start + ( end - start ) * nr_done / nr_steps, data ) ) {
+        Atomic::store( &stopped, 1 );
+      }
+      lock.unlock();
+    }
 
-  nin->dim = 4;
-  nin->axis[0].size = nr_components;
-  nin->axis[1].size = image->width();
-  nin->axis[2].size = image->height();
-  nin->axis[3].size = image->depth();
+    // Returns true if the progress function has asked to stop loading.
+    bool isStopped() {
+      return Atomic::load( &stopped ) != 0;
+    }
 
-  nin->axis[1].spacing = voxel_size.x;
-  nin->axis[2].spacing = voxel_size.y;
-  nin->axis[3].spacing = voxel_size.z;
+    LoadImageProgressFunc func;
+    void *data;
+    int nr_steps;
+    int nr_done;
+    H3DFloat start, end;
+    volatile int stopped;
+    MutexLock lock;
+  };
+
+  // Header information for one file in a DICOM series.
+  struct DicomSliceInfo {
+    DicomSliceInfo():
+      index( 0 ),
+      modification_time( 0 ),
+      file_size( 0 ),
+      cached( false ),
+      valid( false ),
+      has_position( false ),
+      has_orientation( false ),
+      has_format( false ),
+      width( 0 ),
+      height( 0 ),
+      bits_per_pixel( 0 ),
+      pixel_type( Image::LUMINANCE ),
+      component_type( Image::UNSIGNED ),
+      sort_value( 0 ) {}
+
+    // The name of the file without the directory.
+    string name;
+    string filename;
+    // the index of the file in the directory listing.
+    unsigned int index;
+    H3DInt64 modification_time;
+    H3DInt64 file_size;
+    // true if the information was found in the header cache.
+    bool cached;
+    // true if the file could be read as a DICOM file.
+    bool valid;
+    string series_instance_UID;
+    bool has_position;
+    Vec3f position;
+    bool has_orientation;
+    Vec3f row_direction;
+    Vec3f column_direction;
+    // The format of the decoded slice. Only known for files that have
+    // been decoded as part of a series once.
+    bool has_format;
+    unsigned int width;
+    unsigned int height;
+    unsigned int bits_per_pixel;
+    Image::PixelType pixel_type;
+    Image::PixelComponentType component_type;
+    Vec3f pixel_size;
+    // the position projected on the slice normal.
+    H3DFloat sort_value;
+  };
+
+  // Set the format of info from a decoded slice.
+  void setDicomSliceFormat( DicomSliceInfo &info, DicomImage &image ) {
+    info.has_format = true;
+    info.width = image.width();
+    info.height = image.height();
+    info.bits_per_pixel = image.bitsPerPixel();
+    info.pixel_type = image.pixelType();
+    info.component_type = image.pixelComponentType();
+    info.pixel_size = image.pixelSize();
+  }
 
-  nin->data = image->getImageData();
+  // Copy the format of a decoded slice from one info to another.
+  void copyDicomSliceFormat( DicomSliceInfo &info,
+                             const DicomSliceInfo &from ) {
+    info.has_format = from.has_format;
+    info.width = from.width;
+    info.height = from.height;
+    info.bits_per_pixel = from.bits_per_pixel;
+    info.pixel_type = from.pixel_type;
+    info.component_type = from.component_type;
+    info.pixel_size = from.pixel_size;
+  }
 
-  int res = nrrdSave( filename.c_str(), nin, NULL );
-  char *err = biffGetDone( NRRD );
+  // Get the size and modification time of a file. Returns false if the
+  // file does not exist.
+  bool getFileStatus( const string &filename,
+                      H3DInt64 &modification_time,
+                      H3DInt64 &file_size ) {
+    struct stat file_info;
+    if( stat( filename.c_str(), &file_info ) != 0 ) return false;
+    modification_time = (H3DInt64) file_info.st_mtime;
+    file_size = (H3DInt64) file_info.st_size;
+    return true;
+  }
 
-  // free nrrd struct memory but not data.
-  nrrdNix( nin );
+  MutexLock dicom_header_cache_lock;
+  string dicom_header_cache_dir;
 
-  return res;
-}
+  // Version of the index file format. Increase when the format changes.
+  const int dicom_header_index_version = 1;
+
+  // Counter making the names of temporary index files unique within the
+  // process.
+  volatile int dicom_header_index_tmp_counter = 0;
+
+  // The absolute path of the directory path with symbolic links and "."
+  // and ".." resolved, so that all ways of naming a directory share one
+  // index. Returns path unchanged if it cannot be resolved.
+  string getCanonicalPath( const string &path ) {
+    string dir = path.empty() ? string( "." ) : path;
+#ifdef H3D_WINDOWS
+    char *full_path = _fullpath( NULL, dir.c_str(), 0 );
+#else
+    char *full_path = realpath( dir.c_str(), NULL );
 #endif
+    if( !full_path ) return path;
+    string result( full_path );
+    free( full_path );
+    return result;
+  }
 
-#ifdef HAVE_DCMTK
-H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
-                                           bool load_single_file ) {
-  if( load_single_file ) {
-   try {
-     // dicom data is specified from topleft corner. we have to convert it so
-     // it is specified from the bottomleft corner
-     auto_ptr< DicomImage > slice_2d( new DicomImage( url ) );
+  // The name of the index file for a directory of DICOM files. The name
+  // is a FNV-1a hash of the canonical directory path. The path is also
+  // stored in the file to detect collisions.
+  string getDicomHeaderIndexFilename( const string &cache_dir,
+                                      const string &path ) {
+    H3DUInt64 hash = 14695981039346656037ULL;
+    for( unsigned int i = 0; i < path.size(); ++i ) {
+      hash ^= (unsigned char) path[i];
+      hash *= 1099511628211ULL;
+    }
+    ostringstream s;
+    s << cache_dir << "/dicom_" << hex << hash << ".idx";
+    return s.str();
+  }
 
-     // get properties from dicom image
-     unsigned int width  = slice_2d->width();
-     unsigned int height = slice_2d->height();
-     // depth will be incremented below depending on the number of slices
-     // used
-     unsigned int depth = 1;
-     Vec3f pixel_size = slice_2d->pixelSize();
-     Image::PixelType pixel_type = slice_2d->pixelType();
-     unsigned int bits_per_pixel = slice_2d->bitsPerPixel();
-     Image::PixelComponentType component_type = 
-       slice_2d->pixelComponentType();    
-     
-     unsigned bytes_per_pixel = 
-       bits_per_pixel % 8 == 0 ? 
-       bits_per_pixel / 8 : bits_per_pixel / 8 + 1;
-     
-     // allocate and copy data into correct order.
-     unsigned char *data = 
-       new unsigned char[ width * height * bytes_per_pixel ];
-     
-     unsigned char * slice_data = (unsigned char *)slice_2d->getImageData();
-     for( unsigned int row = 0; row < height; row++ ) {
-       memcpy( data + row*width* bytes_per_pixel, 
-               slice_data + (height - row - 1 ) * width * bytes_per_pixel,
-               width * bytes_per_pixel );
-     }
+  // Read the index for the directory path. Entries are stored by file
+  // name. Returns false if there is no valid index.
+  bool readDicomHeaderIndex( const string &index_filename,
+                             const string &path,
+                             map< string, DicomSliceInfo > &entries ) {
+    ifstream is( index_filename.c_str() );
+    if( !is.good() ) return false;
+    is.imbue( std::locale::classic() );
+
+    string magic, line;
+    int version;
+    is >> magic >> version;
+    getline( is, line );
+    if( magic != "H3DUtilDicomHeaderIndex" ||
+        version != dicom_header_index_version ) return false;
+
+    getline( is, line );
+    if( line != path ) return false;
+
+    // Each entry is the file name on one line followed by its values on
+    // the next line.
+    string name;
+    while( getline( is, name ) && getline( is, line ) ) {
+      istringstream values( line );
+      values.imbue( std::locale::classic() );
+      DicomSliceInfo info;
+      int valid, has_position, has_orientation, has_format;
+      int pixel_type, component_type;
+      values >> info.modification_time >> info.file_size
+             >> valid >> info.series_instance_UID
+             >> has_position
+             >> info.position.x >> info.position.y >> info.position.z
+             >> has_orientation
+             >> info.row_direction.x >> info.row_direction.y
+             >> info.row_direction.z
+             >> info.column_direction.x >> info.column_direction.y
+             >> info.column_direction.z
+             >> has_format >> info.width >> info.height
+             >> info.bits_per_pixel >> pixel_type >> component_type
+             >> info.pixel_size.x >> info.pixel_size.y >> info.pixel_size.z;
+      if( values.fail() ) return false;
+      // the series instance UID is written as - when empty.
+      if( info.series_instance_UID == "-" ) info.series_instance_UID = "";
+      info.valid = valid != 0;
+      info.has_position = has_position != 0;
+      info.has_orientation = has_orientation != 0;
+      info.has_format = has_format != 0;
+      info.pixel_type = (Image::PixelType) pixel_type;
+      info.component_type = (Image::PixelComponentType) component_type;
+      info.name = name;
+      entries[ name ] = info;
+    }
+    return true;
+  }
 
-     // return new image with the correct row order.
-     return new PixelImage( width, height, depth, 
-                            bits_per_pixel, pixel_type, component_type,
-                            data, false, pixel_size );
+  // Write the index for the directory path containing the given files.
+  // The index is written to a temporary file that is then renamed so that
+  // other processes never read a partially written index.
+  void writeDicomHeaderIndex( const string &index_filename,
+                              const string &path,
+                              const vector< DicomSliceInfo > &slices ) {
+    // the temporary name includes the process id and a counter since
+    // several processes or threads may write the same index at once.
+#ifdef H3D_WINDOWS
+    int pid = _getpid();
+#else
+    int pid = (int) getpid();
+#endif
+    ostringstream tmp_name;
+    tmp_name << index_filename << "." << pid << "."
+             << Atomic::increment( &dicom_header_index_tmp_counter )
+             << ".tmp";
+    string tmp_filename = tmp_name.str();
+    {
+      ofstream os( tmp_filename.c_str() );
+      if( !os.good() ) return;
+      os.imbue( std::locale::classic() );
+      os.precision( 9 );
+      os << "H3DUtilDicomHeaderIndex " << dicom_header_index_version << "\n"
+         << path << "\n";
+      for( unsigned int i = 0; i < slices.size(); ++i ) {
+        const DicomSliceInfo &info = slices[i];
+        os << info.name << "\n"
+           << info.modification_time << " " << info.file_size << " "
+           << info.valid << " "
+           << ( info.series_instance_UID.empty() ?
+                string( "-" ) : info.series_instance_UID ) << " "
+           << info.has_position << " "
+           << info.position.x << " " << info.position.y << " "
+           << info.position.z << " "
+           << info.has_orientation << " "
+           << info.row_direction.x << " " << info.row_direction.y << " "
+           << info.row_direction.z << " "
+           << info.column_direction.x << " " << info.column_direction.y << " "
+           << info.column_direction.z << " "
+           << info.has_format << " " << info.width << " " << info.height << " "
+           << info.bits_per_pixel << " " << (int) info.pixel_type << " "
+           << (int) info.component_type << " "
+           << info.pixel_size.x << " " << info.pixel_size.y << " "
+           << info.pixel_size.z << "\n";
+      }
+      if( !os.good() ) {
+        os.close();
+        remove( tmp_filename.c_str() );
+        return;
+      }
+    }
+#ifdef H3D_WINDOWS
+    // rename does not replace existing files on Windows.
+    remove( index_filename.c_str() );
+#endif
+    if( rename( tmp_filename.c_str(), index_filename.c_str() ) != 0 ) {
+      remove( tmp_filename.c_str() );
+    }
+  }
 
-    } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
-      cerr << e << endl;
+  // Parse nr_values backslash separated values from a DICOM decimal
+  // string. DICOM always uses . as decimal separator so the classic
+  // locale is used regardless of the current locale.
+  bool parseDicomDecimals( const OFString &s,
+                           H3DFloat *values,
+                           unsigned int nr_values ) {
+    istringstream is( string( s.c_str() ) );
+    is.imbue( std::locale::classic() );
+    for( unsigned int i = 0; i < nr_values; ++i ) {
+      if( i > 0 ) {
+        char separator;
+        if( !( is >> separator ) || separator != '\\' ) return false;
+      }
+      if( !( is >> values[i] ) ) return false;
+    }
+    return true;
+  }
+
+  // Read the header information of info.filename into info.
+  void readDicomSliceInfo( DicomSliceInfo &info ) {
+    // Elements larger than the default max read length, such as the
+    // pixel data, are not loaded into memory by loadFile.
+    DcmFileFormat fileformat;
+    if( !fileformat.loadFile( info.filename.c_str() ).good() ) return;
+    info.valid = true;
+
+    DcmDataset *dataset = fileformat.getDataset();
+    OFString value;
+    if( dataset->findAndGetOFString( DCM_SeriesInstanceUID,
+                                     value ).good() ) {
+      info.series_instance_UID = value.c_str();
+    }
+
+    H3DFloat v[6];
+    if( dataset->findAndGetOFStringArray( DCM_ImagePositionPatient,
+                                          value ).good() &&
+        parseDicomDecimals( value, v, 3 ) ) {
+      info.has_position = true;
+      info.position = Vec3f( v[0], v[1], v[2] );
+    }
+
+    if( dataset->findAndGetOFStringArray( DCM_ImageOrientationPatient,
+                                          value ).good() &&
+        parseDicomDecimals( value, v, 6 ) ) {
+      info.has_orientation = true;
+      info.row_direction = Vec3f( v[0], v[1], v[2] );
+      info.column_direction = Vec3f( v[3], v[4], v[5] );
+    }
+  }
+
+  struct ReadDicomSliceInfoData {
+    vector< DicomSliceInfo * > slices;
+    LoadProgress *progress;
+  };
+
+  // RangeFunc reading the headers of a range of slices.
+  void readDicomSliceInfoRange( int begin, int end, void *data ) {
+    ReadDicomSliceInfoData *d = static_cast< ReadDicomSliceInfoData * >( data );
+    for( int i = begin; i < end; ++i ) {
+      if( d->progress->isStopped() ) return;
+      readDicomSliceInfo( *d->slices[i] );
+      d->progress->stepDone();
+    }
+  }
+
+  // Sort function placing the slice with the highest sort value first.
+  bool higherSortValue( const DicomSliceInfo &a, const DicomSliceInfo &b ) {
+    return a.sort_value > b.sort_value;
+  }
+
+  struct DecodeDicomSliceData {
+    vector< DicomSliceInfo > *slices;
+    unsigned char *data;
+    unsigned int width;
+    unsigned int height;
+    unsigned int bits_per_pixel;
+    Image::PixelType pixel_type;
+    Image::PixelComponentType component_type;
+    LoadProgress *progress;
+    // set to 1 if any slice failed to load.
+    volatile int failed;
+    // the error message of the first slice that failed.
+    string error;
+    MutexLock error_lock;
+  };
+
+  // RangeFunc decoding a range of slices directly into their place in
+  // the image data.
+  void decodeDicomSliceRange( int begin, int end, void *data ) {
+    DecodeDicomSliceData *d = static_cast< DecodeDicomSliceData * >( data );
+    unsigned int bytes_per_pixel =
+      d->bits_per_pixel % 8 == 0 ?
+      d->bits_per_pixel / 8 : d->bits_per_pixel / 8 + 1;
+    size_t row_size = (size_t) d->width * bytes_per_pixel;
+    size_t slice_size = row_size * d->height;
+
+    for( int i = begin; i < end; ++i ) {
+      if( Atomic::load( &d->failed ) || d->progress->isStopped() ) return;
+      DicomSliceInfo &info = (*d->slices)[i];
+      string error;
+      try {
+        DicomImage slice_2d( info.filename );
+        setDicomSliceFormat( info, slice_2d );
+        if( info.width != d->width ||
+            info.height != d->height ||
+            info.bits_per_pixel != d->bits_per_pixel ||
+            info.pixel_type != d->pixel_type ||
+            info.component_type != d->component_type ) {
+          error = "Slice " + info.filename +
+            " has a different format than the rest of the series";
+        } else {
+          // dicom data is specified from topleft corner. we have to convert
+          // it so it is specified from the bottomleft corner
+          unsigned char *slice_data =
+            (unsigned char *)slice_2d.getImageData();
+          unsigned char *dest = d->data + slice_size * i;
+          for( unsigned int row = 0; row < d->height; row++ ) {
+            memcpy( dest + row * row_size,
+                    slice_data + ( d->height - row - 1 ) * row_size,
+                    row_size );
+          }
+        }
+      } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
+        ostringstream s;
+        s << e;
+        error = s.str();
+      }
+
+      if( !error.empty() ) {
+        d->error_lock.lock();
+        if( !d->failed ) d->error = error;
+        Atomic::store( &d->failed, 1 );
+        d->error_lock.unlock();
+        return;
+      }
+      d->progress->stepDone();
+    }
+  }
+
+  // The files of a DICOM series and the format of the image they form.
+  struct DicomSeries {
+    // all files in the directory of the series.
+    vector< DicomSliceInfo > all_slices;
+    // the slices of the series, in the order they are stacked.
+    vector< DicomSliceInfo > slices;
+    unsigned int width;
+    unsigned int height;
+    Vec3f pixel_size;
+    Image::PixelType pixel_type;
+    unsigned int bits_per_pixel;
+    Image::PixelComponentType component_type;
+    // the header cache index file of the directory, empty if no cache is
+    // used.
+    string index_filename;
+    // the canonical path of the directory, identifying it in the index.
+    string index_path;
+    // true if the index has to be written.
+    bool index_changed;
+  };
+
+  // Find the DICOM files in names, the files in directory path, that
+  // belong to the same series as url and sort them into the order they
+  // are stacked. url_name is the name of url without the directory.
+  // Reading the headers is reported as the first half of progress.
+  // Returns false if no series was found or the progress function asked
+  // to stop.
+  bool findDicomSeries( const string &url,
+                        const string &url_name,
+                        const string &path,
+                        const vector< string > &names,
+                        LoadProgress &progress,
+                        DicomSeries &series ) {
+    vector< DicomSliceInfo > &all_slices = series.all_slices;
+    all_slices.resize( names.size() );
+    for( unsigned int i = 0; i < names.size(); ++i ) {
+      DicomSliceInfo &info = all_slices[i];
+      info.name = names[i];
+      info.filename = path.empty() ? names[i] : path + "/" + names[i];
+      info.index = i;
+      getFileStatus( info.filename, info.modification_time, info.file_size );
+    }
+
+    // use header information from the cache for files that have not
+    // changed since it was written.
+    dicom_header_cache_lock.lock();
+    string cache_dir = dicom_header_cache_dir;
+    dicom_header_cache_lock.unlock();
+    string &index_filename = series.index_filename;
+    bool &index_changed = series.index_changed;
+    index_changed = false;
+    if( !cache_dir.empty() ) {
+      series.index_path = getCanonicalPath( path );
+      index_filename = getDicomHeaderIndexFilename( cache_dir,
+                                                    series.index_path );
+      map< string, DicomSliceInfo > entries;
+      readDicomHeaderIndex( index_filename, series.index_path, entries );
+      for( unsigned int i = 0; i < all_slices.size(); ++i ) {
+        DicomSliceInfo &info = all_slices[i];
+        map< string, DicomSliceInfo >::iterator e = entries.find( info.name );
+        if( e != entries.end() &&
+            e->second.modification_time == info.modification_time &&
+            e->second.file_size == info.file_size ) {
+          string filename = info.filename;
+          unsigned int index = info.index;
+          info = e->second;
+          info.filename = filename;
+          info.index = index;
+          info.cached = true;
+        }
+      }
+      index_changed = entries.size() != all_slices.size();
+    }
+
+    ThreadPool *pool = ThreadPool::getDefaultPool();
+
+    // read the headers of all files not in the cache in parallel.
+    ReadDicomSliceInfoData read_data;
+    read_data.progress = &progress;
+    for( unsigned int i = 0; i < all_slices.size(); ++i ) {
+      if( !all_slices[i].cached ) read_data.slices.push_back( &all_slices[i] );
+    }
+    if( !read_data.slices.empty() ) index_changed = true;
+    progress.setStage( (int) read_data.slices.size(), 0, 0.5f );
+    pool->parallelFor( 0, (int) read_data.slices.size(),
+                       readDicomSliceInfoRange, &read_data, 1 );
+    if( progress.isStopped() ) return false;
+
+    DicomSliceInfo *url_info = NULL;
+    for( unsigned int i = 0; i < all_slices.size(); ++i ) {
+      if( all_slices[i].name == url_name ) url_info = &all_slices[i];
+    }
+
+    // url might not be part of the listing, e.g. if it is not a regular
+    // file. It is then only used to get the format of the series.
+    DicomSliceInfo extra_info;
+    if( !url_info ) {
+      extra_info.filename = url;
+      readDicomSliceInfo( extra_info );
+      url_info = &extra_info;
+    }
+
+    // read the original slice in order to get image information unless
+    // it is known from the cache.
+    if( !url_info->has_format ) {
+      try {
+        DicomImage slice_2d( url );
+        setDicomSliceFormat( *url_info, slice_2d );
+        index_changed = true;
+      } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
+        Console(3) << e << endl;
+        return false;
+      }
+    }
+
+    series.width = url_info->width;
+    series.height = url_info->height;
+    series.pixel_size = url_info->pixel_size;
+    series.pixel_type = url_info->pixel_type;
+    series.bits_per_pixel = url_info->bits_per_pixel;
+    series.component_type = url_info->component_type;
+
+    // only use the files that match the series instance of the original
+    // file.
+    string orig_series_instance_UID = url_info->series_instance_UID;
+    bool use_all_files = orig_series_instance_UID == "";
+    vector< DicomSliceInfo > &slices = series.slices;
+    bool all_have_position = true;
+    for( unsigned int i = 0; i < all_slices.size(); ++i ) {
+      const DicomSliceInfo &info = all_slices[i];
+      if( info.valid &&
+          ( use_all_files ||
+            info.series_instance_UID == orig_series_instance_UID ) ) {
+        slices.push_back( info );
+        if( !info.has_position ) all_have_position = false;
+      }
+    }
+
+    if( slices.empty() ) return false;
+
+    if( all_have_position ) {
+      // Sort the slices along the slice normal. The default orientation
+      // gives the normal ( 0, 0, 1 ), i.e. sorting on the z-value.
+      Vec3f normal( 0, 0, 1 );
+      for( unsigned int i = 0; i < slices.size(); ++i ) {
+        if( slices[i].has_orientation ) {
+          const Vec3f &row = slices[i].row_direction;
+          const Vec3f &column = slices[i].column_direction;
+          if( H3DAbs( row.x - 1 ) > Constants::f_epsilon ||
+              H3DAbs( row.y - 0 ) > Constants::f_epsilon ||
+              H3DAbs( row.z - 0 ) > Constants::f_epsilon ||
+              H3DAbs( column.x - 0 ) > Constants::f_epsilon ||
+              H3DAbs( column.y - 1 ) > Constants::f_epsilon ||
+              H3DAbs( column.z - 0 ) > Constants::f_epsilon ) {
+            Console(3) << "Warning: ImageOrientationPatient is not "
+                       << "the assumed default. Dicom image might not "
+                       << "be read correctly." << endl;
+          }
+          Vec3f n = row % column;
+          if( n.lengthSqr() > Constants::f_epsilon ) {
+            n.normalize();
+            normal = n;
+          }
+          break;
+        }
+      }
+
+      for( unsigned int i = 0; i < slices.size(); ++i ) {
+        slices[i].sort_value = slices[i].position * normal;
+      }
+      std::stable_sort( slices.begin(), slices.end(), higherSortValue );
+
+      // use ImagePositionPatient to set pixel_size z. If it does not
+      // exist SliceThickness is used.
+      if( slices.size() > 1 ) {
+        H3DFloat slice_distance =
+          ( slices.front().sort_value - slices.back().sort_value ) /
+          ( slices.size() - 1 );
+        if( slice_distance > 0 )
+          series.pixel_size.z = slice_distance * 1e-3f; // to metres
+      }
+    }
+    return true;
+  }
+
+  // Load the DICOM files in names, the files in directory path, that
+  // belong to the same series as url and compose them into one 3D image.
+  // url_name is the name of url without the directory.
+  Image *loadDicomSeries( const string &url,
+                          const string &url_name,
+                          const string &path,
+                          const vector< string > &names,
+                          LoadImageProgressFunc progress_func,
+                          void *progress_data ) {
+    LoadProgress progress( progress_func, progress_data );
+    DicomSeries series;
+    if( !findDicomSeries( url, url_name, path, names, progress, series ) )
+      return NULL;
+
+    vector< DicomSliceInfo > &slices = series.slices;
+    unsigned int width  = series.width;
+    unsigned int height = series.height;
+    Image::PixelType pixel_type = series.pixel_type;
+    unsigned int bits_per_pixel = series.bits_per_pixel;
+    Image::PixelComponentType component_type = series.component_type;
+
+    unsigned bytes_per_pixel =
+      bits_per_pixel % 8 == 0 ?
+      bits_per_pixel / 8 : bits_per_pixel / 8 + 1;
+
+    unsigned int depth = (unsigned int) slices.size();
+    unsigned char *data =
+      new unsigned char[ (size_t) width * height * depth * bytes_per_pixel ];
+
+    // decode all slices in parallel directly into the image data.
+    progress.setStage( (int) slices.size(), 0.5f, 1 );
+    DecodeDicomSliceData decode_data;
+    decode_data.slices = &slices;
+    decode_data.data = data;
+    decode_data.width = width;
+    decode_data.height = height;
+    decode_data.bits_per_pixel = bits_per_pixel;
+    decode_data.pixel_type = pixel_type;
+    decode_data.component_type = component_type;
+    decode_data.progress = &progress;
+    decode_data.failed = 0;
+    // keep the codecs registered while the slices are decoded, otherwise
+    // each DicomImage registers and removes them while other threads
+    // decode.
+    DicomImage::registerCodecs();
+    ThreadPool::getDefaultPool()->parallelFor( 0, (int) slices.size(),
+                                               decodeDicomSliceRange,
+                                               &decode_data, 1 );
+    DicomImage::unregisterCodecs();
+
+    if( !series.index_filename.empty() ) {
+      // store the formats found while decoding in the index.
+      for( unsigned int i = 0; i < slices.size(); ++i ) {
+        DicomSliceInfo &info = series.all_slices[ slices[i].index ];
+        if( slices[i].has_format && !info.has_format ) {
+          copyDicomSliceFormat( info, slices[i] );
+          series.index_changed = true;
+        }
+      }
+      if( series.index_changed ) {
+        writeDicomHeaderIndex( series.index_filename, series.index_path,
+                               series.all_slices );
+      }
+    }
+
+    if( decode_data.failed ) {
+      Console(3) << decode_data.error << endl;
+      delete [] data;
       return NULL;
     }
-  } else {
-    // the filenames for all files to compose.
-    vector< string > filenames;
 
-    // divide url into path and filename
+    if( progress.isStopped() ) {
+      delete [] data;
+      return NULL;
+    }
+
+    return new PixelImage( width, height, depth,
+                           bits_per_pixel, pixel_type, component_type,
+                           data, false, series.pixel_size );
+  }
+
+  // Split url into directory path and file name and get the names of the
+  // files in the directory that might belong to the same series, i.e.
+  // the files starting with the same three characters, in alphabetical
+  // order.
+  void listDicomSeriesCandidates( const string &url,
+                                  string &path,
+                                  string &filename,
+                                  vector< string > &names ) {
     size_t found = url.find_last_of("/\\");
-    string path, filename;
 
     if( found != string::npos ) {
       path = url.substr(0,found);
@@ -566,13 +1595,11 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
     HANDLE handle = FindFirstFile( 
       (path + "/" + filename.substr( 0,3 ) +"*" ).c_str(), find_data );
     if( handle != INVALID_HANDLE_VALUE ) {
-      string name = path + "\\" + find_data->cFileName;
-      filenames.push_back( name );
-      //Console(3) << name << endl;
+      names.push_back( find_data->cFileName );
       while( FindNextFile(handle, find_data) ) {
-        //Console(3) << find_data->cFileName << endl;
-        filenames.push_back( string( path + "\\" + find_data->cFileName ) );
+        names.push_back( find_data->cFileName );
       }
+      FindClose( handle );
     }
     delete find_data;
 #else
@@ -583,7 +1610,7 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
       while ((dirp = readdir(dp)) != NULL) {
         string name = string(dirp->d_name);
         if( prefix == name.substr( 0,3 ) ) {
-          filenames.push_back( string( path.c_str() ) + "/" + name );
+          names.push_back( name );
         }
       }
       closedir(dp);
@@ -591,181 +1618,112 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
 #endif
 
     // sort them in alphabetical order
-    std::sort( filenames.begin(), filenames.end() );
-
-    if( filenames.empty() ) return NULL;
-
-    auto_ptr< DicomImage > slice_2d;
-    
-    // read the original slice in order to get image information
-    try {
-      slice_2d.reset( new DicomImage( url ) );
-    } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
-      Console(3) << e << endl;
-      return NULL;
-    }
-
-    unsigned int width  = slice_2d->width();
-    unsigned int height = slice_2d->height();
-    // depth will be incremented below depending on the number of slices
-    // used
-    unsigned int depth = 0;
-    Vec3f pixel_size = slice_2d->pixelSize();
-    Image::PixelType pixel_type = slice_2d->pixelType();
-    unsigned int bits_per_pixel = slice_2d->bitsPerPixel();
-    Image::PixelComponentType component_type = 
-      slice_2d->pixelComponentType();    
-
-    unsigned bytes_per_pixel = 
-      bits_per_pixel % 8 == 0 ? 
-      bits_per_pixel / 8 : bits_per_pixel / 8 + 1;
+    std::sort( names.begin(), names.end() );
+  }
+}
 
-    unsigned char *data = 
-      new unsigned char[ width * height * filenames.size() * bytes_per_pixel ];
+H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
+                                           bool load_single_file,
+                                           LoadImageProgressFunc progress_func,
+                                           void *progress_data ) {
+  if( load_single_file ) {
+   try {
+     // dicom data is specified from topleft corner. we have to convert it so
+     // it is specified from the bottomleft corner
+     auto_ptr< DicomImage > slice_2d( new DicomImage( url ) );
 
-    DcmDataset *orig_data_set = slice_2d->getDicomFileInfo().getDataset();
+     // get properties from dicom image
+     unsigned int width  = slice_2d->width();
+     unsigned int height = slice_2d->height();
+     // depth will be incremented below depending on the number of slices
+     // used
+     unsigned int depth = 1;
+     Vec3f pixel_size = slice_2d->pixelSize();
+     Image::PixelType pixel_type = slice_2d->pixelType();
+     unsigned int bits_per_pixel = slice_2d->bitsPerPixel();
+     Image::PixelComponentType component_type = 
+       slice_2d->pixelComponentType();    
+     
+     unsigned bytes_per_pixel = 
+       bits_per_pixel % 8 == 0 ? 
+       bits_per_pixel / 8 : bits_per_pixel / 8 + 1;
+     
+     // allocate and copy data into correct order.
+     unsigned char *data = 
+       new unsigned char[ width * height * bytes_per_pixel ];
+     
+     unsigned char * slice_data = (unsigned char *)slice_2d->getImageData();
+     for( unsigned int row = 0; row < height; row++ ) {
+       memcpy( data + row*width* bytes_per_pixel, 
+               slice_data + (height - row - 1 ) * width * bytes_per_pixel,
+               width * bytes_per_pixel );
+     }
 
-    // get the series unique id for the original file
-    OFString orig_series_instance_UID;
-    OFCondition res = orig_data_set->findAndGetOFString( DCM_SeriesInstanceUID, 
-                                                         orig_series_instance_UID );
-   
+     if( progress_func ) progress_func( 1, progress_data );
 
-    bool use_all_files = (res != EC_Normal || orig_series_instance_UID == "" );
-
-    // Checking the z value of the ImagePositionPatient to know in which
-    // order the dicom files should be read.
-    // In the future these might be changed to Vec3f and we check
-    // the entire vector to know which order to read the images.
-    H3DFloat patient_pos1;
-    H3DFloat patient_pos2;
-    H3DFloat patient_orn[6];
-    bool first_patient_pos_set = false;
-    bool second_patient_pos_set = false;
-    // Iterate through filename and get the two first valid ones and try
-    // to read information from them. If information is read from two, then
-    // break. This could perhaps be coupled with the other for loop.
-    for( unsigned int i = 0; i < filenames.size(); i++ ) {
-      DcmFileFormat fileformat;
-      if( fileformat.loadFile(filenames[i].c_str()).good() ) {
-        OFString string_value;
-        DcmDataset * dataset = fileformat.getDataset();
-        OFCondition res = dataset->findAndGetOFString( DCM_SeriesInstanceUID,
-                                                       string_value );
-        // only use the files that match the series instance of the original 
-        // file.
-        if( use_all_files ||
-            string_value == orig_series_instance_UID ) {
-          OFCondition res = dataset->findAndGetOFString(
-            DCM_ImagePositionPatient, string_value, 2 );
+     // return new image with the correct row order.
+     return new PixelImage( width, height, depth, 
+                            bits_per_pixel, pixel_type, component_type,
+                            data, false, pixel_size );
 
-#ifdef H3D_WINDOWS
-          // Get locale string, used to test what is used as
-          // decimal separator . or ,
-          // DICOM always use . as decimal separator so we need to make sure that
-          // it is used properly.
-          string locale_string( setlocale( LC_NUMERIC, NULL ) );
-          if( locale_string.length() < 7 || locale_string.substr( 0, 7 ) != "English" ) {
-            H3DFloat test_data_comma( atof( "0,2" ) );
-            if( test_data_comma > 0.1 ) {
-              for( unsigned int j = 0; j < string_value.size(); j++ ) {
-                if( string_value[j] == '.' )
-                  string_value[j] = ',';
-              }
-            }
-          }
-#endif
-          if( res == EC_Normal ) {
-            if( first_patient_pos_set ) {
-              patient_pos2 = (H3DFloat)( atof( string_value.c_str() ) );
-              second_patient_pos_set = true;
-              OFString string_value2;
-              OFCondition res2 = dataset->findAndGetOFStringArray(
-                DCM_ImageOrientationPatient, string_value2 );
-              if( res2 == EC_Normal ) {
-                size_t start_pos = 0;
-                for( unsigned int j = 0; j < 6; j++ ) {
-                  size_t pos = string_value2.find( "\\", start_pos, 2 );
-                  patient_orn[j] = (H3DFloat)( atof( string_value2.substr(
-                    start_pos, pos - start_pos ).c_str() ) );
-                  start_pos = pos + 1;
-                }
-                if( patient_pos2 > patient_pos1 ) {
-                  // Sort in reverse alphabetical order.
-                  vector< string > tmp_filenames;
-                  tmp_filenames.reserve( filenames.size() );
-                  for( int j = (int)filenames.size() - 1; j >= 0; j-- )
-                    tmp_filenames.push_back( filenames[j] );
-                  filenames = tmp_filenames;
-                }
-
-                if( H3DAbs( patient_orn[0] - 1 ) > Constants::f_epsilon ||
-                    H3DAbs( patient_orn[1] - 0 ) > Constants::f_epsilon ||
-                    H3DAbs( patient_orn[2] - 0 ) > Constants::f_epsilon ||
-                    H3DAbs( patient_orn[3] - 0 ) > Constants::f_epsilon ||
-                    H3DAbs( patient_orn[4] - 1 ) > Constants::f_epsilon ||
-                    H3DAbs( patient_orn[5] - 0 ) > Constants::f_epsilon ) {
-                  Console(3) << "Warning: ImageOrientationPatient is not "
-                             << "the assumed default. Dicom image might not "
-                             << "be read correctly." << endl;
-                }
-                break;
-              }
-            } else {
-              // Set patient_pos1 and break.
-              patient_pos1 = (H3DFloat)( atof( string_value.c_str() ) );
-              first_patient_pos_set = true;
-            }
-          }
-        }
-      }
+    } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
+      cerr << e << endl;
+      return NULL;
     }
+  } else {
+    // the names of all files to compose.
+    vector< string > names;
+    string path, filename;
+    LoadImageFunctionsInternal::listDicomSeriesCandidates( url, path,
+                                                           filename, names );
+    if( names.empty() ) return NULL;
+
+    return LoadImageFunctionsInternal::loadDicomSeries( url, filename, path,
+                                                        names,
+                                                        progress_func,
+                                                        progress_data );
+  }
+}
 
-    // use ImagePositionPatient if available to set pixel_size z.
-    // If it does not exist SliceThickness is used.
-    if( second_patient_pos_set ) {
-      H3DFloat slice_distance = H3DAbs(patient_pos1 - patient_pos2);
-      pixel_size.z = slice_distance * 1e-3; // to metres
-    }
+H3DUTIL_API bool H3DUtil::getDicomSeriesFiles( const string &url,
+                                               vector< string > &files,
+                                               Vec3f *pixel_size ) {
+  using namespace LoadImageFunctionsInternal;
+  vector< string > names;
+  string path, filename;
+  listDicomSeriesCandidates( url, path, filename, names );
+  if( names.empty() ) return false;
+
+  LoadProgress progress( NULL, NULL );
+  DicomSeries series;
+  if( !findDicomSeries( url, filename, path, names, progress, series ) )
+    return false;
+
+  if( !series.index_filename.empty() && series.index_changed ) {
+    writeDicomHeaderIndex( series.index_filename, series.index_path,
+                           series.all_slices );
+  }
 
-    // read all files and compose them into one image.
-    for( unsigned int i = 0; i < filenames.size(); ++i ) {
-      DcmFileFormat fileformat;
-      OFString series_instance_UID;
+  files.clear();
+  for( unsigned int i = 0; i < series.slices.size(); ++i ) {
+    files.push_back( series.slices[i].filename );
+  }
+  if( pixel_size ) *pixel_size = series.pixel_size;
+  return true;
+}
 
-      if (fileformat.loadFile(filenames[i].c_str()).good()) {
-        DcmDataset *dataset = fileformat.getDataset();
-        OFCondition res = dataset->findAndGetOFString( DCM_SeriesInstanceUID,
-                                                       series_instance_UID );
-      }
-     
-      // only use the files that match the seris instance of the original 
-      // file.
-      if( use_all_files || series_instance_UID == orig_series_instance_UID ) {
-        try {
-          slice_2d.reset( new DicomImage( filenames[i] ) );
-        } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
-          Console(3) << e << endl;
-          delete [] data;
-          return NULL;
-        }
+void H3DUtil::setDicomHeaderCacheDirectory( const string &dir ) {
+  using namespace LoadImageFunctionsInternal;
+  dicom_header_cache_lock.lock();
+  dicom_header_cache_dir = dir;
+  dicom_header_cache_lock.unlock();
+}
 
-        // dicom data is specified from topleft corner. we have to convert it
-        // so it is specified from the bottomleft corner
-        unsigned char * slice_data = (unsigned char *)slice_2d->getImageData();
-        for( unsigned int row = 0; row < height; row++ ) {
-          memcpy( data + (width * height * depth  + row*width)*
-                         bytes_per_pixel,
-                  slice_data + (height - row - 1 ) * width * bytes_per_pixel,
-                  width * bytes_per_pixel );
-        }
-        depth++;
-      }
-    }
-   
-    return new PixelImage( width, height, depth, 
-                           bits_per_pixel, pixel_type, component_type,
-                           data, false, pixel_size );
-  }
+string H3DUtil::getDicomHeaderCacheDirectory() {
+  using namespace LoadImageFunctionsInternal;
+  dicom_header_cache_lock.lock();
+  string dir = dicom_header_cache_dir;
+  dicom_header_cache_lock.unlock();
+  return dir;
 }
 #endif
@@ -0,0 +1,150 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file MappedRawImage.cpp
+/// \brief cpp file for MappedRawImage.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/MappedRawImage.h>
+
+#ifdef H3D_WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace H3DUtil;
+
+MappedRawImage::MappedRawImage( const string &filename,
+                                unsigned int _width,
+                                unsigned int _height,
+                                unsigned int _depth,
+                                unsigned int _bits_per_pixel,
+                                PixelType _pixel_type,
+                                PixelComponentType _pixel_component_type,
+                                const Vec3f &_pixel_size ):
+  PixelImage( _width, _height, _depth, _bits_per_pixel, _pixel_type,
+              _pixel_component_type, NULL, false, _pixel_size ),
+  mapped_data( NULL ),
+  mapped_size( 0 )
+#ifdef H3D_WINDOWS
+  , mapping_handle( NULL )
+#endif
+{
+  mapped_size = ( (size_t) w * h * d * bits_per_pixel ) / 8;
+  if( mapped_size == 0 ) {
+    throw CouldNotMapFile( filename, "Image is empty", H3D_FULL_LOCATION );
+  }
+
+#ifdef H3D_WINDOWS
+  HANDLE file = CreateFileA( filename.c_str(), GENERIC_READ,
+                             FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, NULL );
+  if( file == INVALID_HANDLE_VALUE ) {
+    throw CouldNotMapFile( filename, "Could not open file",
+                           H3D_FULL_LOCATION );
+  }
+
+  LARGE_INTEGER file_size;
+  if( !GetFileSizeEx( file, &file_size ) ||
+      (H3DUInt64) file_size.QuadPart < (H3DUInt64) mapped_size ) {
+    CloseHandle( file );
+    throw CouldNotMapFile( filename, "File is smaller than the image",
+                           H3D_FULL_LOCATION );
+  }
+
+  // PAGE_WRITECOPY gives a private copy on write mapping.
+  mapping_handle = CreateFileMappingA( file, NULL, PAGE_WRITECOPY,
+                                       0, 0, NULL );
+  // the mapping keeps its own reference to the file.
+  CloseHandle( file );
+  if( !mapping_handle ) {
+    throw CouldNotMapFile( filename, "Could not create file mapping",
+                           H3D_FULL_LOCATION );
+  }
+
+  mapped_data = static_cast< unsigned char * >(
+    MapViewOfFile( mapping_handle, FILE_MAP_COPY, 0, 0, mapped_size ) );
+  if( !mapped_data ) {
+    CloseHandle( mapping_handle );
+    mapping_handle = NULL;
+    throw CouldNotMapFile( filename, "Could not map file",
+                           H3D_FULL_LOCATION );
+  }
+#else
+  int fd = open( filename.c_str(), O_RDONLY );
+  if( fd == -1 ) {
+    throw CouldNotMapFile( filename, "Could not open file",
+                           H3D_FULL_LOCATION );
+  }
+
+  struct stat file_info;
+  if( fstat( fd, &file_info ) != 0 ||
+      (H3DUInt64) file_info.st_size < (H3DUInt64) mapped_size ) {
+    close( fd );
+    throw CouldNotMapFile( filename, "File is smaller than the image",
+                           H3D_FULL_LOCATION );
+  }
+
+  // A private mapping makes changes to the image data copy on write
+  // instead of changing the file.
+  void *data = mmap( NULL, mapped_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE, fd, 0 );
+  // the mapping keeps its own reference to the file.
+  close( fd );
+  if( data == MAP_FAILED ) {
+    throw CouldNotMapFile( filename, "Could not map file",
+                           H3D_FULL_LOCATION );
+  }
+  mapped_data = static_cast< unsigned char * >( data );
+#endif
+
+  image_data = mapped_data;
+}
+
+MappedRawImage::~MappedRawImage() {
+  if( image_data == mapped_data ) image_data = NULL;
+  unmap();
+}
+
+void MappedRawImage::deleteImageData( unsigned char *data ) {
+  if( data == mapped_data ) unmap();
+  else delete [] data;
+}
+
+void MappedRawImage::unmap() {
+  if( !mapped_data ) return;
+#ifdef H3D_WINDOWS
+  UnmapViewOfFile( mapped_data );
+  CloseHandle( mapping_handle );
+  mapping_handle = NULL;
+#else
+  munmap( mapped_data, mapped_size );
+#endif
+  mapped_data = NULL;
+  mapped_size = 0;
+}
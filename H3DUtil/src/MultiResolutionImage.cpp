@@ -0,0 +1,285 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file MultiResolutionImage.cpp
+/// \brief cpp file for MultiResolutionImage.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/MultiResolutionImage.h>
+#include <H3DUtil/ImageMipChain.h>
+#include <string.h>
+
+using namespace H3DUtil;
+
+namespace MultiResolutionImageInternals {
+  // The maximum size in each dimension of the preview level.
+  const unsigned int max_preview_size = 32;
+
+  // The size of a dimension of the level after a level of size s.
+  inline unsigned int nextLevelSize( unsigned int s ) {
+    return s > 1 ? s / 2 : 1;
+  }
+}
+
+MultiResolutionImage::MultiResolutionImage( unsigned int _width,
+                                            unsigned int _height,
+                                            unsigned int _depth,
+                                            unsigned int _bits_per_pixel,
+                                            PixelType _pixel_type,
+                                            PixelComponentType _pixel_component_type,
+                                            const Vec3f &_pixel_size ):
+  nr_added_slices( 0 ),
+  preview_level( 0 ),
+  nr_preview_slices( 0 ),
+  load_failed( 0 ),
+  abort_loading( 0 ),
+  load_thread( NULL ),
+  load_func( NULL ),
+  load_data( NULL ) {
+  using namespace MultiResolutionImageInternals;
+  unsigned int w = _width, h = _height, d = _depth;
+  for( ; ; ) {
+    size_t size = ( (size_t) w * h * d * _bits_per_pixel ) / 8;
+    // the size of a pixel grows with the size of the blocks it covers.
+    Vec3f level_pixel_size( _pixel_size.x * _width / w,
+                            _pixel_size.y * _height / h,
+                            _pixel_size.z * _depth / d );
+    levels.push_back(
+      AutoRef< PixelImage >( new PixelImage( w, h, d, _bits_per_pixel,
+                                             _pixel_type,
+                                             _pixel_component_type,
+                                             new unsigned char[ size ],
+                                             false,
+                                             level_pixel_size ) ) );
+    nr_complete_slices.push_back( 0 );
+    if( w <= max_preview_size && h <= max_preview_size &&
+        d <= max_preview_size && preview_level == 0 ) {
+      preview_level = (unsigned int) levels.size() - 1;
+    }
+    if( w == 1 && h == 1 && d == 1 ) break;
+    w = nextLevelSize( w );
+    h = nextLevelSize( h );
+    d = nextLevelSize( d );
+  }
+
+  if( preview_level == 0 ) {
+    // the preview is the full resolution image.
+    preview = levels[0];
+  } else {
+    PixelImage *level = levels[ preview_level ].get();
+    size_t size = ( (size_t) level->width() * level->height() *
+                    level->depth() * _bits_per_pixel ) / 8;
+    preview.reset( new PixelImage( level->width(), level->height(),
+                                   level->depth(), _bits_per_pixel,
+                                   _pixel_type, _pixel_component_type,
+                                   new unsigned char[ size ](),
+                                   false,
+                                   level->pixelSize() ) );
+  }
+  finest_complete_level = (int) levels.size();
+}
+
+MultiResolutionImage::~MultiResolutionImage() {
+  Atomic::store( &abort_loading, 1 );
+  waitForLoading();
+}
+
+void MultiResolutionImage::getElement( void *value, int x, int y, int z ) {
+  PixelImage *level = getSampleLevel();
+  if( !level ) {
+    memset( value, 0, ( bitsPerPixel() + 7 ) / 8 );
+    return;
+  }
+  level->getElement( value,
+                     (int)( (H3DInt64) x * level->width() / width() ),
+                     (int)( (H3DInt64) y * level->height() / height() ),
+                     (int)( (H3DInt64) z * level->depth() / depth() ) );
+}
+
+void MultiResolutionImage::readRegion( void *data,
+                                       unsigned int x,
+                                       unsigned int y,
+                                       unsigned int z,
+                                       unsigned int w,
+                                       unsigned int h,
+                                       unsigned int d ) {
+  if( getSampleLevel() == levels[0].get() ) {
+    levels[0]->readRegion( data, x, y, z, w, h, d );
+  } else {
+    // a coarser level is used, get each pixel as getElement does.
+    readRegionElements( (unsigned char *) data, x, y, z, w, h, d );
+  }
+}
+
+void MultiResolutionImage::getSample( void *value,
+                                      H3DFloat x,
+                                      H3DFloat y,
+                                      H3DFloat z,
+                                      FilterType filter_type ) {
+  PixelImage *level = getSampleLevel();
+  if( level ) {
+    level->getSample( value, x, y, z, filter_type );
+  } else {
+    memset( value, 0, ( bitsPerPixel() + 7 ) / 8 );
+  }
+}
+
+void MultiResolutionImage::getSamples( const Vec3f *coords,
+                                       size_t n,
+                                       H3DUtil::RGBA *values,
+                                       FilterType filter_type ) {
+  PixelImage *level = getSampleLevel();
+  if( level ) {
+    level->getSamples( coords, n, values, filter_type );
+  } else {
+    Image::getSamples( coords, n, values, filter_type );
+  }
+}
+
+void MultiResolutionImage::getSamples( const Vec3f *coords,
+                                       size_t n,
+                                       H3DFloat *values,
+                                       FilterType filter_type ) {
+  PixelImage *level = getSampleLevel();
+  if( level ) {
+    level->getSamples( coords, n, values, filter_type );
+  } else {
+    Image::getSamples( coords, n, values, filter_type );
+  }
+}
+
+PixelImage *MultiResolutionImage::getSampleLevel() {
+  unsigned int level = getFinestCompleteLevel();
+  if( level >= levels.size() ) return NULL;
+  // make sure the data of the level is read after the level index.
+  Atomic::memoryBarrier();
+  // only the preview and level 0 are ever marked as complete.
+  return level == 0 ? levels[0].get() : preview.get();
+}
+
+H3DFloat MultiResolutionImage::getLoadProgress() {
+  if( isComplete() ) return 1;
+  // the preview is counted as the first 10%.
+  unsigned int preview_depth = preview->depth();
+  H3DFloat preview_progress =
+    (H3DFloat) Atomic::load( &nr_preview_slices ) / preview_depth;
+  if( preview_progress > 1 ) preview_progress = 1;
+  H3DFloat slice_progress = (H3DFloat) getNrAddedSlices() / depth();
+  return 0.1f * preview_progress + 0.9f * slice_progress;
+}
+
+void MultiResolutionImage::startLoading( LoadFunc func, void *data ) {
+  if( load_thread ) return;
+  load_func = func;
+  load_data = data;
+  load_thread = new SimpleThread( loadThreadFunc, this );
+}
+
+void MultiResolutionImage::waitForLoading() {
+  if( load_thread ) {
+    load_thread->join();
+    delete load_thread;
+    load_thread = NULL;
+  }
+}
+
+void *MultiResolutionImage::loadThreadFunc( void *data ) {
+  MultiResolutionImage *image = static_cast< MultiResolutionImage * >( data );
+  image->load_func( image, image->load_data );
+  return NULL;
+}
+
+unsigned int MultiResolutionImage::getPreviewSourceSlice(
+  unsigned int preview_z ) {
+  unsigned int preview_depth = preview->depth();
+  unsigned int block_depth = depth() / preview_depth;
+  unsigned int z = preview_z * block_depth + block_depth / 2;
+  return z < depth() ? z : depth() - 1;
+}
+
+void MultiResolutionImage::setPreviewSlice( unsigned int preview_z,
+                                            const unsigned char *slice_data ) {
+  size_t preview_slice_size =
+    ( (size_t) preview->width() * preview->height() * bitsPerPixel() ) / 8;
+  unsigned char *dst = (unsigned char *) preview->getImageData() +
+    preview_slice_size * preview_z;
+  if( preview_level == 0 ) {
+    memcpy( dst, slice_data, preview_slice_size );
+  } else {
+    // downsample the slice in x and y as many times as the preview level
+    // has been downsampled.
+    AutoRef< PixelImage > slice(
+      new PixelImage( width(), height(), 1, bitsPerPixel(),
+                      pixelType(), pixelComponentType(),
+                      const_cast< unsigned char * >( slice_data ), true ) );
+    std::vector< AutoRef< PixelImage > > slice_levels;
+    buildMipChain( slice.get(), slice_levels, BOX_MIP_FILTER, preview_level );
+    memcpy( dst, slice_levels.back()->getImageData(), preview_slice_size );
+  }
+  Atomic::increment( &nr_preview_slices );
+}
+
+void MultiResolutionImage::setPreviewDone() {
+  Atomic::memoryBarrier();
+  // A level is only replaced by a finer one.
+  int level = (int) preview_level;
+  int current = Atomic::load( &finest_complete_level );
+  while( level < current &&
+         !Atomic::compareAndSwap( &finest_complete_level, current, level ) ) {
+    current = Atomic::load( &finest_complete_level );
+  }
+}
+
+void MultiResolutionImage::slicesAdded( unsigned int nr_slices ) {
+  nr_complete_slices[0] += nr_slices;
+  imageDataChanged();
+  if( nr_complete_slices[0] > depth() ) nr_complete_slices[0] = depth();
+  Atomic::store( &nr_added_slices, (int) nr_complete_slices[0] );
+
+  // Build the slices of the coarser levels that only depend on complete
+  // slices of the level before them. The levels are not sampled until
+  // level 0 is complete so they can be written in place.
+  for( unsigned int l = 1; l < levels.size(); ++l ) {
+    unsigned int fz = levels[l-1]->depth() / levels[l]->depth();
+    unsigned int available = nr_complete_slices[l-1] / fz;
+    if( available > levels[l]->depth() ) available = levels[l]->depth();
+    if( available > nr_complete_slices[l] ) {
+      buildSlices( l, nr_complete_slices[l], available );
+      nr_complete_slices[l] = available;
+    }
+  }
+
+  if( nr_complete_slices[0] == depth() ) {
+    // All levels have been built from the full resolution data.
+    Atomic::memoryBarrier();
+    Atomic::store( &finest_complete_level, 0 );
+  }
+}
+
+void MultiResolutionImage::buildSlices( unsigned int level,
+                                        unsigned int begin,
+                                        unsigned int end ) {
+  downsampleImageSlices( levels[ level - 1 ].get(), levels[ level ].get(),
+                         begin, end, BOX_MIP_FILTER );
+}
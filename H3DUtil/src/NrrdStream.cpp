@@ -0,0 +1,762 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file NrrdStream.cpp
+/// \brief cpp file for NrrdReader and NrrdWriter.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/NrrdStream.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <sstream>
+#include <limits>
+#include <locale>
+#include <vector>
+#include <math.h>
+#include <string.h>
+
+using namespace H3DUtil;
+
+namespace NrrdStreamInternals {
+  // The size of the chunks of compressed data read or written at a time.
+  const size_t compressed_chunk_size = 128 * 1024;
+
+  // The largest number of bytes given to zlib in one call.
+  const size_t max_zlib_size = 0x40000000;
+
+  inline double nanValue() {
+    return numeric_limits< double >::quiet_NaN();
+  }
+
+  bool isLittleEndian() {
+    H3DUInt32 v = 1;
+    return *reinterpret_cast< unsigned char * >( &v ) == 1;
+  }
+
+  // Reverse the byte order of each component in data.
+  void swapBytes( unsigned char *data, size_t size,
+                  unsigned int bytes_per_component ) {
+    for( size_t i = 0; i + bytes_per_component <= size;
+         i += bytes_per_component ) {
+      unsigned char *c = data + i;
+      for( unsigned int j = 0; j < bytes_per_component / 2; ++j ) {
+        unsigned char t = c[j];
+        c[j] = c[ bytes_per_component - 1 - j ];
+        c[ bytes_per_component - 1 - j ] = t;
+      }
+    }
+  }
+
+  string trim( const string &s ) {
+    size_t begin = s.find_first_not_of( " \t\r\n" );
+    if( begin == string::npos ) return "";
+    size_t end = s.find_last_not_of( " \t\r\n" );
+    return s.substr( begin, end - begin + 1 );
+  }
+
+  // Get the component type and size from the type field of a Nrrd header.
+  bool parseType( const string &type,
+                  Image::PixelComponentType &component_type,
+                  unsigned int &bytes ) {
+    if( type == "signed char" || type == "int8" || type == "int8_t" ||
+        type == "char" ) {
+      component_type = Image::SIGNED; bytes = 1;
+    } else if( type == "uchar" || type == "unsigned char" ||
+               type == "uint8" || type == "uint8_t" ) {
+      component_type = Image::UNSIGNED; bytes = 1;
+    } else if( type == "short" || type == "short int" ||
+               type == "signed short" || type == "signed short int" ||
+               type == "int16" || type == "int16_t" ) {
+      component_type = Image::SIGNED; bytes = 2;
+    } else if( type == "ushort" || type == "unsigned short" ||
+               type == "unsigned short int" || type == "uint16" ||
+               type == "uint16_t" ) {
+      component_type = Image::UNSIGNED; bytes = 2;
+    } else if( type == "int" || type == "signed int" ||
+               type == "int32" || type == "int32_t" ) {
+      component_type = Image::SIGNED; bytes = 4;
+    } else if( type == "uint" || type == "unsigned int" ||
+               type == "uint32" || type == "uint32_t" ) {
+      component_type = Image::UNSIGNED; bytes = 4;
+    } else if( type == "longlong" || type == "long long" ||
+               type == "long long int" || type == "signed long long" ||
+               type == "signed long long int" || type == "int64" ||
+               type == "int64_t" ) {
+      component_type = Image::SIGNED; bytes = 8;
+    } else if( type == "ulonglong" || type == "unsigned long long" ||
+               type == "unsigned long long int" || type == "uint64" ||
+               type == "uint64_t" ) {
+      component_type = Image::UNSIGNED; bytes = 8;
+    } else if( type == "float" ) {
+      component_type = Image::RATIONAL; bytes = 4;
+    } else if( type == "double" ) {
+      component_type = Image::RATIONAL; bytes = 8;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // Returns the Nrrd type name for a component type and size or an empty
+  // string if there is none.
+  string typeName( Image::PixelComponentType component_type,
+                   unsigned int bytes ) {
+    switch( component_type ) {
+    case Image::SIGNED:
+      if( bytes == 1 ) return "signed char";
+      if( bytes == 2 ) return "short";
+      if( bytes == 4 ) return "int";
+      if( bytes == 8 ) return "long long int";
+      break;
+    case Image::UNSIGNED:
+      if( bytes == 1 ) return "unsigned char";
+      if( bytes == 2 ) return "unsigned short";
+      if( bytes == 4 ) return "unsigned int";
+      if( bytes == 8 ) return "unsigned long long int";
+      break;
+    case Image::RATIONAL:
+      if( bytes == 4 ) return "float";
+      if( bytes == 8 ) return "double";
+      break;
+    }
+    return "";
+  }
+
+  // Split a field value into words. Parenthesized vectors like (1,0,0)
+  // are kept as one word.
+  vector< string > splitWords( const string &value ) {
+    vector< string > words;
+    string word;
+    int depth = 0;
+    for( size_t i = 0; i < value.size(); ++i ) {
+      char c = value[i];
+      if( c == '(' ) ++depth;
+      if( c == ')' ) --depth;
+      if( depth == 0 && ( c == ' ' || c == '\t' ) ) {
+        if( !word.empty() ) words.push_back( word );
+        word.clear();
+      } else {
+        word += c;
+      }
+    }
+    if( !word.empty() ) words.push_back( word );
+    return words;
+  }
+
+  // Parse a number using the classic locale so that the result does not
+  // depend on the locale of the application. nan gives NaN.
+  double parseNumber( const string &s, bool &ok ) {
+    string lower;
+    for( size_t i = 0; i < s.size(); ++i ) lower += (char) tolower( s[i] );
+    if( lower == "nan" ) {
+      ok = true;
+      return nanValue();
+    }
+    istringstream ss( s );
+    ss.imbue( locale::classic() );
+    double v = 0;
+    ss >> v;
+    ok = !ss.fail();
+    return v;
+  }
+
+  // Returns the length of a space direction vector like (0.5,0,0) or NaN
+  // if it is none or invalid.
+  double vectorLength( const string &s ) {
+    if( s.size() < 2 || s[0] != '(' || s[ s.size() - 1 ] != ')' )
+      return nanValue();
+    string inner = s.substr( 1, s.size() - 2 );
+    double sum = 0;
+    size_t start = 0;
+    while( start <= inner.size() ) {
+      size_t end = inner.find( ',', start );
+      if( end == string::npos ) end = inner.size();
+      bool ok;
+      double v = parseNumber( trim( inner.substr( start, end - start ) ), ok );
+      if( !ok ) return nanValue();
+      sum += v * v;
+      start = end + 1;
+    }
+    return sqrt( sum );
+  }
+
+  // Returns the directory part of a path including the last separator.
+  string directoryOf( const string &path ) {
+    size_t pos = path.find_last_of( "/\\" );
+    if( pos == string::npos ) return "";
+    return path.substr( 0, pos + 1 );
+  }
+
+  bool isAbsolutePath( const string &path ) {
+    if( path.empty() ) return false;
+    if( path[0] == '/' || path[0] == '\\' ) return true;
+    return path.size() > 1 && path[1] == ':';
+  }
+}
+
+#ifdef HAVE_ZLIB
+struct NrrdReader::InflateState {
+  z_stream strm;
+  vector< unsigned char > chunk;
+  bool ended;
+};
+
+struct NrrdWriter::DeflateState {
+  z_stream strm;
+  vector< unsigned char > chunk;
+};
+#else
+struct NrrdReader::InflateState {};
+struct NrrdWriter::DeflateState {};
+#endif
+
+NrrdReader::NrrdReader():
+  data_offset( 0 ),
+  is_open( false ),
+  compressed( false ),
+  swap_bytes( false ),
+  bytes_per_component( 1 ),
+  w( 0 ), h( 0 ), d( 0 ),
+  bits_per_pixel( 0 ),
+  pixel_type( Image::LUMINANCE ),
+  pixel_component_type( Image::UNSIGNED ),
+  next_slice( 0 ),
+  inflate_state( NULL ) {
+}
+
+NrrdReader::~NrrdReader() {
+  close();
+}
+
+bool NrrdReader::open( const string &url ) {
+  using namespace NrrdStreamInternals;
+  close();
+
+  ifstream header( url.c_str(), ios::in | ios::binary );
+  if( !header.good() ) {
+    Console(3) << "Warning: Could not open Nrrd file " << url << endl;
+    return false;
+  }
+
+  string line;
+  getline( header, line );
+  if( line.compare( 0, 4, "NRRD" ) != 0 ) {
+    Console(3) << "Warning: " << url << " is not a Nrrd file." << endl;
+    return false;
+  }
+
+  string type, encoding = "raw", endian, data_file;
+  vector< string > sizes, spacings, space_directions;
+  int dimension = 0;
+  long byte_skip = 0, line_skip = 0;
+  bool ok = true;
+
+  while( getline( header, line ) ) {
+    if( !line.empty() && line[ line.size() - 1 ] == '\r' )
+      line.erase( line.size() - 1 );
+    // an empty line ends an attached header.
+    if( line.empty() ) break;
+    if( line[0] == '#' ) continue;
+    // key/value pairs are not used.
+    if( line.find( ":=" ) != string::npos ) continue;
+    size_t colon = line.find( ": " );
+    if( colon == string::npos ) continue;
+    string field = trim( line.substr( 0, colon ) );
+    string value = trim( line.substr( colon + 2 ) );
+    bool number_ok = true;
+
+    if( field == "type" ) {
+      type = value;
+    } else if( field == "dimension" ) {
+      dimension = (int) parseNumber( value, number_ok );
+    } else if( field == "sizes" ) {
+      sizes = splitWords( value );
+    } else if( field == "spacings" ) {
+      spacings = splitWords( value );
+    } else if( field == "space directions" ) {
+      space_directions = splitWords( value );
+    } else if( field == "encoding" ) {
+      encoding = value;
+    } else if( field == "endian" ) {
+      endian = value;
+    } else if( field == "data file" || field == "datafile" ) {
+      data_file = value;
+    } else if( field == "byte skip" || field == "byteskip" ) {
+      byte_skip = (long) parseNumber( value, number_ok );
+    } else if( field == "line skip" || field == "lineskip" ) {
+      line_skip = (long) parseNumber( value, number_ok );
+    }
+    if( !number_ok ) {
+      Console(3) << "Warning: Invalid value for \"" << field
+                 << "\" in Nrrd file " << url << endl;
+      ok = false;
+    }
+  }
+  if( !ok ) return false;
+
+  unsigned int bytes = 0;
+  if( !parseType( type, pixel_component_type, bytes ) ) {
+    Console(3) << "Warning: Unsupported type \"" << type
+               << "\" in Nrrd file " << url << endl;
+    return false;
+  }
+  bytes_per_component = bytes;
+
+  if( dimension < 1 || dimension > 4 || (int) sizes.size() != dimension ) {
+    Console(3) << "Warning: Unsupported dimension in Nrrd file "
+               << url << endl;
+    return false;
+  }
+
+  // if dimension == 4, the first axis is used for the components of
+  // each voxel, the same as in loadNrrdFile.
+  unsigned int first_axis = 0;
+  unsigned int nr_components = 1;
+  pixel_type = Image::LUMINANCE;
+  if( dimension == 4 ) {
+    first_axis = 1;
+    nr_components = (unsigned int) parseNumber( sizes[0], ok );
+    if( nr_components == 1 ) pixel_type = Image::LUMINANCE;
+    else if( nr_components == 2 ) pixel_type = Image::LUMINANCE_ALPHA;
+    else if( nr_components == 3 ) pixel_type = Image::RGB;
+    else if( nr_components == 4 ) pixel_type = Image::RGBA;
+    else {
+      Console(3) << "Warning: Unsupported number of components in Nrrd file "
+                 << url << endl;
+      return false;
+    }
+  }
+  bits_per_pixel = bytes * 8 * nr_components;
+
+  if( encoding == "gzip" || encoding == "gz" ) {
+#ifdef HAVE_ZLIB
+    compressed = true;
+#else
+    Console(3) << "Warning: Nrrd file " << url
+               << " is gzip compressed but zlib is not available." << endl;
+    return false;
+#endif
+  } else if( encoding != "raw" ) {
+    Console(3) << "Warning: Unsupported encoding \"" << encoding
+               << "\" in Nrrd file " << url << endl;
+    return false;
+  }
+
+  unsigned int dims[3] = { 1, 1, 1 };
+  H3DFloat spacing[3] = { 0.0003f, 0.0003f, 0.0003f };
+  for( unsigned int i = 0; i + first_axis < (unsigned int) dimension; ++i ) {
+    unsigned int axis = i + first_axis;
+    double size = parseNumber( sizes[ axis ], ok );
+    if( !ok || size < 1 ) {
+      Console(3) << "Warning: Invalid sizes in Nrrd file " << url << endl;
+      return false;
+    }
+    dims[i] = (unsigned int) size;
+
+    double s = nanValue();
+    if( axis < spacings.size() ) {
+      s = parseNumber( spacings[ axis ], ok );
+    } else if( !space_directions.empty() ) {
+      // space directions has no entry for the component axis.
+      unsigned int dir = axis - ( dimension == 4 &&
+                                  space_directions.size() == 3 ? 1 : 0 );
+      if( dir < space_directions.size() )
+        s = vectorLength( space_directions[ dir ] );
+    }
+    if( s == s ) {
+      spacing[i] = (H3DFloat) s;
+    } else {
+      Console(3) << "Warning: NRRD file " << url
+                 << " lacks spacing information in axis " << i
+                 << ". Sets to default 0.0003\n";
+    }
+  }
+  w = dims[0];
+  h = dims[1];
+  d = dims[2];
+  pixel_size = Vec3f( spacing[0], spacing[1], spacing[2] );
+
+  swap_bytes = bytes > 1 && !endian.empty() &&
+    ( endian == "little" ) != isLittleEndian();
+
+  // Open the data, either following the header or in a separate file.
+  if( data_file.empty() ) {
+    data_url = url;
+    streamoff header_end = header.tellg();
+    header.close();
+    is.open( url.c_str(), ios::in | ios::binary );
+    is.seekg( header_end, ios::beg );
+  } else {
+    if( data_file.find( ' ' ) != string::npos || data_file == "LIST" ) {
+      Console(3) << "Warning: Nrrd file " << url
+                 << " uses several data files, which is not supported."
+                 << endl;
+      return false;
+    }
+    data_url = isAbsolutePath( data_file ) ?
+      data_file : directoryOf( url ) + data_file;
+    header.close();
+    is.open( data_url.c_str(), ios::in | ios::binary );
+  }
+  if( !is.good() ) {
+    Console(3) << "Warning: Could not open Nrrd data file " << data_url
+               << endl;
+    is.close();
+    is.clear();
+    return false;
+  }
+
+  for( long i = 0; i < line_skip; ++i ) {
+    getline( is, line );
+  }
+
+  size_t data_size = sliceSize() * d;
+  if( byte_skip == -1 ) {
+    if( compressed ) {
+      Console(3) << "Warning: byte skip -1 can only be used with raw encoding"
+                 << " in Nrrd file " << url << endl;
+      close();
+      return false;
+    }
+    is.seekg( 0, ios::end );
+    is.seekg( (streamoff) is.tellg() - (streamoff) data_size, ios::beg );
+  } else if( byte_skip > 0 && !compressed ) {
+    is.seekg( byte_skip, ios::cur );
+  }
+  data_offset = is.tellg();
+
+#ifdef HAVE_ZLIB
+  if( compressed ) {
+    inflate_state = new InflateState;
+    memset( &inflate_state->strm, 0, sizeof( inflate_state->strm ) );
+    inflate_state->chunk.resize( compressed_chunk_size );
+    inflate_state->ended = false;
+    // 47 = 15 bit window + 32 to detect gzip or zlib header automatically.
+    if( inflateInit2( &inflate_state->strm, 47 ) != Z_OK ) {
+      Console(3) << "Warning: zlib could not be initialized." << endl;
+      delete inflate_state;
+      inflate_state = NULL;
+      close();
+      return false;
+    }
+  }
+#endif
+
+  is_open = true;
+  next_slice = 0;
+
+  // byte skip applies to the decompressed data for compressed encodings.
+  if( compressed && byte_skip > 0 ) {
+    vector< unsigned char > skipped( byte_skip );
+    if( !readData( &skipped[0], skipped.size() ) ) {
+      close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void NrrdReader::close() {
+#ifdef HAVE_ZLIB
+  if( inflate_state ) {
+    inflateEnd( &inflate_state->strm );
+    delete inflate_state;
+    inflate_state = NULL;
+  }
+#endif
+  if( is.is_open() ) is.close();
+  is.clear();
+  is_open = false;
+  compressed = false;
+}
+
+bool NrrdReader::readSlices( unsigned char *data, unsigned int nr_slices ) {
+  if( !is_open || next_slice + nr_slices > d ) return false;
+  size_t size = sliceSize() * nr_slices;
+  if( !readData( data, size ) ) return false;
+  if( swap_bytes )
+    NrrdStreamInternals::swapBytes( data, size, bytes_per_component );
+  next_slice += nr_slices;
+  return true;
+}
+
+bool NrrdReader::skipSlices( unsigned int nr_slices ) {
+  if( !is_open || next_slice + nr_slices > d ) return false;
+  if( !compressed ) return seekSlice( next_slice + nr_slices );
+  vector< unsigned char > slice( sliceSize() );
+  for( unsigned int i = 0; i < nr_slices; ++i ) {
+    if( !readData( &slice[0], slice.size() ) ) return false;
+    ++next_slice;
+  }
+  return true;
+}
+
+bool NrrdReader::seekSlice( unsigned int z ) {
+  if( !isSeekable() || z > d ) return false;
+  is.clear();
+  is.seekg( data_offset + (streamoff) z * sliceSize(), ios::beg );
+  next_slice = z;
+  return is.good();
+}
+
+bool NrrdReader::readData( unsigned char *data, size_t size ) {
+  using namespace NrrdStreamInternals;
+  if( !compressed ) {
+    is.read( (char *)data, size );
+    if( (size_t) is.gcount() != size ) {
+      Console(3) << "Warning: Nrrd data file " << data_url
+                 << " is smaller than the image size." << endl;
+      return false;
+    }
+    return true;
+  }
+
+#ifdef HAVE_ZLIB
+  z_stream &strm = inflate_state->strm;
+  size_t nr_inflated = 0;
+  while( nr_inflated < size ) {
+    if( inflate_state->ended ) {
+      Console(3) << "Warning: Compressed data in " << data_url
+                 << " is smaller than the image size." << endl;
+      return false;
+    }
+    if( strm.avail_in == 0 ) {
+      is.read( (char *)&inflate_state->chunk[0],
+               inflate_state->chunk.size() );
+      strm.avail_in = (uInt) is.gcount();
+      strm.next_in = &inflate_state->chunk[0];
+      if( strm.avail_in == 0 ) {
+        Console(3) << "Warning: Compressed data in " << data_url
+                   << " is incomplete." << endl;
+        return false;
+      }
+    }
+    size_t remaining = size - nr_inflated;
+    uInt avail_out =
+      remaining > max_zlib_size ? (uInt) max_zlib_size : (uInt) remaining;
+    strm.next_out = data + nr_inflated;
+    strm.avail_out = avail_out;
+    int err = inflate( &strm, Z_NO_FLUSH );
+    nr_inflated += avail_out - strm.avail_out;
+    if( err == Z_STREAM_END ) {
+      inflate_state->ended = true;
+    } else if( err != Z_OK && err != Z_BUF_ERROR ) {
+      Console(3) << "Warning: zlib error " << err << " in " << data_url
+                 << "." << endl;
+      return false;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+NrrdWriter::NrrdWriter():
+  is_open( false ),
+  compressed( false ),
+  w( 0 ), h( 0 ), d( 0 ),
+  bits_per_pixel( 0 ),
+  next_slice( 0 ),
+  deflate_state( NULL ) {
+}
+
+NrrdWriter::~NrrdWriter() {
+  if( is_open ) close();
+}
+
+bool NrrdWriter::open( const string &_filename,
+                       unsigned int width,
+                       unsigned int height,
+                       unsigned int depth,
+                       unsigned int _bits_per_pixel,
+                       Image::PixelType pixel_type,
+                       Image::PixelComponentType pixel_component_type,
+                       const Vec3f &pixel_size,
+                       bool compress ) {
+  using namespace NrrdStreamInternals;
+  if( is_open ) close();
+
+  unsigned int nr_components;
+  if( pixel_type == Image::LUMINANCE ) {
+    nr_components = 1;
+  } else if( pixel_type == Image::LUMINANCE_ALPHA ) {
+    nr_components = 2;
+  } else if( pixel_type == Image::BGR || pixel_type == Image::RGB ||
+             pixel_type == Image::VEC3) {
+    nr_components = 3;
+  } else if( pixel_type == Image::RGBA || pixel_type == Image::BGRA ) {
+    nr_components = 4;
+  } else {
+    return false;
+  }
+
+  string type;
+  if( _bits_per_pixel % ( nr_components * 8 ) == 0 )
+    type = typeName( pixel_component_type,
+                     _bits_per_pixel / ( nr_components * 8 ) );
+  if( type.empty() ) {
+    Console(3) << "Warning: The pixel format cannot be saved as Nrrd file "
+               << _filename << endl;
+    return false;
+  }
+
+#ifndef HAVE_ZLIB
+  if( compress ) {
+    Console(3) << "Warning: Cannot compress Nrrd file " << _filename
+               << " since zlib is not available." << endl;
+    return false;
+  }
+#endif
+
+  os.open( _filename.c_str(), ios::out | ios::binary | ios::trunc );
+  if( !os.good() ) {
+    Console(3) << "Warning: Could not create Nrrd file " << _filename << endl;
+    os.clear();
+    return false;
+  }
+
+  filename = _filename;
+  w = width;
+  h = height;
+  d = depth;
+  bits_per_pixel = _bits_per_pixel;
+  compressed = compress;
+  next_slice = 0;
+
+  // The same fields as written by teem.
+  ostringstream header;
+  header.imbue( locale::classic() );
+  header.precision( 17 );
+  header << "NRRD0004\n"
+         << "# Complete NRRD file format specification at:\n"
+         << "# http://teem.sourceforge.net/nrrd/format.html\n"
+         << "type: " << type << "\n"
+         << "dimension: 4\n"
+         << "sizes: " << nr_components << " " << width << " " << height
+         << " " << depth << "\n"
+         << "spacings: nan " << pixel_size.x << " " << pixel_size.y << " "
+         << pixel_size.z << "\n";
+  if( _bits_per_pixel / nr_components > 8 ) {
+    header << "endian: " << ( isLittleEndian() ? "little" : "big" ) << "\n";
+  }
+  header << "encoding: " << ( compress ? "gzip" : "raw" ) << "\n\n";
+  string header_string = header.str();
+  os.write( header_string.c_str(), header_string.size() );
+
+#ifdef HAVE_ZLIB
+  if( compress ) {
+    deflate_state = new DeflateState;
+    memset( &deflate_state->strm, 0, sizeof( deflate_state->strm ) );
+    deflate_state->chunk.resize( compressed_chunk_size );
+    // 31 = 15 bit window + 16 to write a gzip header.
+    if( deflateInit2( &deflate_state->strm, Z_DEFAULT_COMPRESSION,
+                      Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) {
+      Console(3) << "Warning: zlib could not be initialized." << endl;
+      delete deflate_state;
+      deflate_state = NULL;
+      os.close();
+      return false;
+    }
+  }
+#endif
+
+  is_open = os.good();
+  return is_open;
+}
+
+bool NrrdWriter::writeSlices( const unsigned char *data,
+                              unsigned int nr_slices ) {
+  if( !is_open || next_slice + nr_slices > d ) return false;
+  if( !writeData( data, sliceSize() * nr_slices, false ) ) return false;
+  next_slice += nr_slices;
+  return true;
+}
+
+bool NrrdWriter::close() {
+  if( !is_open ) return false;
+  bool success = next_slice == d;
+  if( !success ) {
+    Console(3) << "Warning: Only " << next_slice << " of " << d
+               << " slices were written to Nrrd file " << filename << endl;
+  }
+  if( compressed && !writeData( NULL, 0, true ) ) success = false;
+#ifdef HAVE_ZLIB
+  if( deflate_state ) {
+    deflateEnd( &deflate_state->strm );
+    delete deflate_state;
+    deflate_state = NULL;
+  }
+#endif
+  os.close();
+  if( os.fail() ) success = false;
+  os.clear();
+  is_open = false;
+  return success;
+}
+
+bool NrrdWriter::writeData( const unsigned char *data,
+                            size_t size,
+                            bool finish ) {
+  using namespace NrrdStreamInternals;
+  if( !compressed ) {
+    os.write( (const char *)data, size );
+    return os.good();
+  }
+
+#ifdef HAVE_ZLIB
+  z_stream &strm = deflate_state->strm;
+  size_t nr_deflated = 0;
+  for( ; ; ) {
+    size_t remaining = size - nr_deflated;
+    uInt avail_in =
+      remaining > max_zlib_size ? (uInt) max_zlib_size : (uInt) remaining;
+    strm.next_in = const_cast< unsigned char * >( data ) + nr_deflated;
+    strm.avail_in = avail_in;
+    bool last = finish && remaining == avail_in;
+    int err;
+    do {
+      strm.next_out = &deflate_state->chunk[0];
+      strm.avail_out = (uInt) deflate_state->chunk.size();
+      err = deflate( &strm, last ? Z_FINISH : Z_NO_FLUSH );
+      if( err == Z_STREAM_ERROR ) {
+        Console(3) << "Warning: zlib stream error when writing "
+                   << filename << "." << endl;
+        return false;
+      }
+      os.write( (const char *)&deflate_state->chunk[0],
+                deflate_state->chunk.size() - strm.avail_out );
+      if( !os.good() ) return false;
+    } while( strm.avail_out == 0 );
+    nr_deflated += avail_in;
+    if( nr_deflated >= size && ( !last || err == Z_STREAM_END ) ) break;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,446 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file PagedImage.cpp
+/// \brief cpp file for PagedImage.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/PagedImage.h>
+#include <H3DUtil/ThreadPool.h>
+#include <H3DUtil/Console.h>
+
+#ifdef HAVE_DCMTK
+#include <H3DUtil/DicomImage.h>
+#include <H3DUtil/LoadImageFunctions.h>
+#endif
+
+#include <sstream>
+#include <string.h>
+
+using namespace H3DUtil;
+
+PagedImage::RawSliceSource::RawSliceSource(
+  const string &_filename,
+  unsigned int _width,
+  unsigned int _height,
+  unsigned int _depth,
+  unsigned int _bits_per_pixel,
+  PixelType _pixel_type,
+  PixelComponentType _pixel_component_type,
+  const Vec3f &_pixel_size,
+  H3DUInt64 _offset ):
+  filename( _filename ),
+  offset( _offset ) {
+  width = _width;
+  height = _height;
+  depth = _depth;
+  bits_per_pixel = _bits_per_pixel;
+  pixel_type = _pixel_type;
+  pixel_component_type = _pixel_component_type;
+  pixel_size = _pixel_size;
+
+  is.open( filename.c_str(), ios::in | ios::binary );
+  if( !is.good() ) {
+    throw CouldNotOpenSource( filename, "Could not open file",
+                              H3D_FULL_LOCATION );
+  }
+
+  H3DUInt64 image_size =
+    ( (H3DUInt64) width * height * depth * bits_per_pixel ) / 8;
+  is.seekg( 0, ios::end );
+  H3DUInt64 file_size = (H3DUInt64) is.tellg();
+  if( !is.good() || file_size < offset + image_size ) {
+    throw CouldNotOpenSource( filename, "File is smaller than the image",
+                              H3D_FULL_LOCATION );
+  }
+}
+
+bool PagedImage::RawSliceSource::readSlice( unsigned int z,
+                                            unsigned char *data ) {
+  size_t slice_size = ( (size_t) width * height * bits_per_pixel ) / 8;
+  is.clear();
+  is.seekg( (streamoff) ( offset + (H3DUInt64) z * slice_size ) );
+  is.read( (char *) data, slice_size );
+  if( (size_t) is.gcount() != slice_size ) {
+    Console(3) << "Warning: Could not read slice " << z << " from "
+               << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+PagedImage::NrrdSliceSource::NrrdSliceSource( const string &_url ):
+  url( _url ) {
+  if( !reader.open( url ) ) {
+    throw CouldNotOpenSource( url, "Could not read Nrrd header",
+                              H3D_FULL_LOCATION );
+  }
+  width = reader.width();
+  height = reader.height();
+  depth = reader.depth();
+  bits_per_pixel = reader.bitsPerPixel();
+  pixel_type = reader.pixelType();
+  pixel_component_type = reader.pixelComponentType();
+  pixel_size = reader.pixelSize();
+}
+
+bool PagedImage::NrrdSliceSource::readSlice( unsigned int z,
+                                             unsigned char *data ) {
+  unsigned int next = reader.getNextSlice();
+  if( z != next ) {
+    if( reader.isSeekable() ) {
+      if( !reader.seekSlice( z ) ) return false;
+    } else if( z > next ) {
+      if( !reader.skipSlices( z - next ) ) return false;
+    } else {
+      // compressed data can only be read forward, start from the
+      // beginning.
+      reader.close();
+      if( !reader.open( url ) || !reader.skipSlices( z ) ) return false;
+    }
+  }
+  return reader.readSlices( data, 1 );
+}
+
+#ifdef HAVE_DCMTK
+PagedImage::DicomSliceSource::DicomSliceSource( const string &url ) {
+  Vec3f series_pixel_size;
+  if( !getDicomSeriesFiles( url, files, &series_pixel_size ) ) {
+    throw CouldNotOpenSource( url, "No DICOM series found",
+                              H3D_FULL_LOCATION );
+  }
+  init();
+  pixel_size = series_pixel_size;
+}
+
+PagedImage::DicomSliceSource::DicomSliceSource(
+  const vector< string > &_files ):
+  files( _files ) {
+  if( files.empty() ) {
+    throw CouldNotOpenSource( "", "No files given", H3D_FULL_LOCATION );
+  }
+  init();
+}
+
+void PagedImage::DicomSliceSource::init() {
+  try {
+    DicomImage slice_2d( files[0] );
+    width = slice_2d.width();
+    height = slice_2d.height();
+    depth = (unsigned int) files.size();
+    bits_per_pixel = slice_2d.bitsPerPixel();
+    pixel_type = slice_2d.pixelType();
+    pixel_component_type = slice_2d.pixelComponentType();
+    pixel_size = slice_2d.pixelSize();
+  } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
+    ostringstream s;
+    s << e;
+    throw CouldNotOpenSource( files[0], s.str(), H3D_FULL_LOCATION );
+  }
+}
+
+bool PagedImage::DicomSliceSource::readSlice( unsigned int z,
+                                              unsigned char *data ) {
+  try {
+    DicomImage slice_2d( files[z] );
+    if( slice_2d.width() != width ||
+        slice_2d.height() != height ||
+        slice_2d.bitsPerPixel() != bits_per_pixel ||
+        slice_2d.pixelType() != pixel_type ||
+        slice_2d.pixelComponentType() != pixel_component_type ) {
+      Console(3) << "Warning: Slice " << files[z]
+                 << " has a different format than the rest of the series"
+                 << endl;
+      return false;
+    }
+
+    // dicom data is specified from topleft corner. we have to convert
+    // it so it is specified from the bottomleft corner
+    unsigned int bytes_per_pixel =
+      bits_per_pixel % 8 == 0 ?
+      bits_per_pixel / 8 : bits_per_pixel / 8 + 1;
+    size_t row_size = (size_t) width * bytes_per_pixel;
+    unsigned char *slice_data = (unsigned char *)slice_2d.getImageData();
+    for( unsigned int row = 0; row < height; row++ ) {
+      memcpy( data + row * row_size,
+              slice_data + ( height - row - 1 ) * row_size,
+              row_size );
+    }
+  } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
+    Console(3) << e << endl;
+    return false;
+  }
+  return true;
+}
+#endif
+
+PagedImage::PagedImage( SliceSource *_source,
+                        size_t _memory_budget,
+                        unsigned int _prefetch_slices ):
+  source( _source ),
+  slices( _source->depth ),
+  memory_budget( 0 ),
+  max_resident_slices( 1 ),
+  prefetch_slices( _prefetch_slices ),
+  last_z( -1 ),
+  previous_z( -1 ),
+  direction( 0 ),
+  nr_prefetch_tasks( 0 ),
+  destroying( false ),
+  nr_slice_reads( 0 ) {
+  setMemoryBudget( _memory_budget );
+}
+
+PagedImage::~PagedImage() {
+  slice_lock.lock();
+  destroying = true;
+  while( nr_prefetch_tasks > 0 ) slice_lock.wait();
+  slice_lock.unlock();
+
+  for( unsigned int z = 0; z < slices.size(); ++z ) {
+    delete [] slices[z].data;
+  }
+  delete source;
+}
+
+void PagedImage::getElement( void *value, int x, int y, int z ) {
+  unsigned int bytes_per_pixel = bitsPerPixel() / 8;
+  if( bitsPerPixel() % 8 != 0 ) bytes_per_pixel++;
+
+  unsigned char *data = acquireSlice( z );
+  if( !data ) {
+    memset( value, 0, bytes_per_pixel );
+    return;
+  }
+  memcpy( value,
+          data + ( (size_t) y * width() + x ) * bytes_per_pixel,
+          bytes_per_pixel );
+  releaseSlice( z );
+}
+
+void PagedImage::readRegion( void *_data,
+                             unsigned int x, unsigned int y, unsigned int z,
+                             unsigned int w, unsigned int h, unsigned int d ) {
+  unsigned char *data = (unsigned char *) _data;
+  size_t bytes_per_pixel = bitsPerPixel() / 8;
+  size_t image_row_size = width() * bytes_per_pixel;
+  size_t row_size = w * bytes_per_pixel;
+  for( unsigned int zi = z; zi < z + d; ++zi ) {
+    unsigned char *slice_data = acquireSlice( zi );
+    if( !slice_data ) {
+      memset( data, 0, row_size * h );
+      data += row_size * h;
+      continue;
+    }
+    const unsigned char *src =
+      slice_data + y * image_row_size + x * bytes_per_pixel;
+    for( unsigned int yi = 0; yi < h; ++yi ) {
+      memcpy( data, src + yi * image_row_size, row_size );
+      data += row_size;
+    }
+    releaseSlice( zi );
+  }
+}
+
+bool PagedImage::getSlice( unsigned int z, unsigned char *data ) {
+  unsigned char *slice_data = acquireSlice( z );
+  if( !slice_data ) return false;
+  memcpy( data, slice_data, sliceSize() );
+  releaseSlice( z );
+  return true;
+}
+
+void PagedImage::setMemoryBudget( size_t _memory_budget ) {
+  slice_lock.lock();
+  memory_budget = _memory_budget;
+  size_t slice_size = sliceSize();
+  size_t nr_slices = slice_size > 0 ? memory_budget / slice_size : 1;
+  max_resident_slices =
+    nr_slices > 1 ? (unsigned int) H3DMin( nr_slices, (size_t) slices.size() ) : 1;
+  discardSlices();
+  slice_lock.unlock();
+}
+
+void PagedImage::setPrefetchSlices( unsigned int nr_slices ) {
+  slice_lock.lock();
+  prefetch_slices = nr_slices;
+  slice_lock.unlock();
+}
+
+unsigned int PagedImage::getNrResidentSlices() {
+  slice_lock.lock();
+  unsigned int nr_slices = (unsigned int) lru.size();
+  slice_lock.unlock();
+  return nr_slices;
+}
+
+unsigned char *PagedImage::acquireSlice( unsigned int z ) {
+  if( z >= slices.size() ) return NULL;
+
+  slice_lock.lock();
+  updateAccessDirection( z );
+  Slice &slice = slices[z];
+  while( slice.state == LOADING ) slice_lock.wait();
+
+  if( slice.state == RESIDENT ) {
+    ++slice.nr_users;
+    lru.splice( lru.begin(), lru, slice.lru_position );
+    slice_lock.unlock();
+    return slice.data;
+  }
+
+  // NOT_RESIDENT or PREFETCH_QUEUED, read it in this thread.
+  slice.state = LOADING;
+  slice_lock.unlock();
+  if( !loadSlice( z, true ) ) return NULL;
+  // the slice cannot be discarded while it is used so the data can be
+  // read without the lock.
+  return slice.data;
+}
+
+void PagedImage::releaseSlice( unsigned int z ) {
+  slice_lock.lock();
+  --slices[z].nr_users;
+  if( lru.size() > max_resident_slices ) discardSlices();
+  slice_lock.unlock();
+}
+
+bool PagedImage::loadSlice( unsigned int z, bool use ) {
+  unsigned char *data = NULL;
+  bool success = false;
+  try {
+    data = new unsigned char[ sliceSize() ];
+    source_lock.lock();
+    success = source->readSlice( z, data );
+    source_lock.unlock();
+    Atomic::increment( &nr_slice_reads );
+  } catch( bad_alloc &ba ) {
+    Console(4) << ba.what() << endl;
+  }
+
+  slice_lock.lock();
+  Slice &slice = slices[z];
+  if( success ) {
+    slice.data = data;
+    slice.state = RESIDENT;
+    if( use ) ++slice.nr_users;
+    lru.push_front( z );
+    slice.lru_position = lru.begin();
+    discardSlices();
+  } else {
+    delete [] data;
+    slice.state = NOT_RESIDENT;
+  }
+  slice_lock.broadcast();
+  slice_lock.unlock();
+  return success;
+}
+
+void PagedImage::updateAccessDirection( unsigned int _z ) {
+  int z = (int) _z;
+  if( z == last_z ) return;
+  if( z == previous_z ) {
+    // going back and forth between two slices.
+    previous_z = last_z;
+    last_z = z;
+    return;
+  }
+
+  int lowest = last_z;
+  int highest = last_z;
+  if( previous_z >= 0 ) {
+    lowest = H3DMin( lowest, previous_z );
+    highest = H3DMax( highest, previous_z );
+  }
+
+  int dir = 0;
+  if( last_z >= 0 ) {
+    if( z == highest + 1 ) dir = 1;
+    else if( z == lowest - 1 ) dir = -1;
+  }
+  if( dir != 0 && dir == direction ) prefetch( _z, dir );
+  direction = dir;
+  previous_z = last_z;
+  last_z = z;
+}
+
+void PagedImage::prefetch( unsigned int z, int dir ) {
+  // leave room for the slices being used, otherwise the slices read in
+  // advance would replace them.
+  unsigned int nr_slices = H3DMin( prefetch_slices, max_resident_slices / 2 );
+  ThreadPool *pool = ThreadPool::getDefaultPool();
+  for( unsigned int i = 1; i <= nr_slices; ++i ) {
+    int prefetch_z = (int) z + dir * (int) i;
+    if( prefetch_z < 0 || prefetch_z >= (int) slices.size() ) break;
+    Slice &slice = slices[prefetch_z];
+    if( slice.state != NOT_RESIDENT ) continue;
+    slice.state = PREFETCH_QUEUED;
+    PrefetchTask *task = new PrefetchTask;
+    task->image = this;
+    task->z = prefetch_z;
+    ++nr_prefetch_tasks;
+    pool->addTask( prefetchTask, task );
+  }
+}
+
+void PagedImage::discardSlices() {
+  std::list< unsigned int >::iterator i = lru.end();
+  while( lru.size() > max_resident_slices && i != lru.begin() ) {
+    --i;
+    Slice &slice = slices[*i];
+    if( slice.nr_users == 0 ) {
+      delete [] slice.data;
+      slice.data = NULL;
+      slice.state = NOT_RESIDENT;
+      i = lru.erase( i );
+    }
+  }
+}
+
+void PagedImage::prefetchTask( void *data ) {
+  PrefetchTask *task = static_cast< PrefetchTask * >( data );
+  PagedImage *image = task->image;
+  unsigned int z = task->z;
+  delete task;
+
+  image->slice_lock.lock();
+  Slice &slice = image->slices[z];
+  bool load = slice.state == PREFETCH_QUEUED;
+  if( load ) {
+    if( image->destroying ) {
+      slice.state = NOT_RESIDENT;
+      load = false;
+    } else {
+      slice.state = LOADING;
+    }
+  }
+  image->slice_lock.unlock();
+
+  if( load ) image->loadSlice( z, false );
+
+  image->slice_lock.lock();
+  --image->nr_prefetch_tasks;
+  image->slice_lock.broadcast();
+  image->slice_lock.unlock();
+}
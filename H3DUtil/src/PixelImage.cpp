@@ -29,9 +29,144 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include "H3DUtil/PixelImage.h"
+#include "H3DUtil/ThreadPool.h"
+#include "H3DUtil/ImageView.h"
 
 using namespace H3DUtil;
 
+namespace PixelImageInternals {
+  // Information needed by the resampling functions. For each pixel in
+  // the new image the two closest pixels in the source image in each 
+  // direction are given together with the interpolation weight.
+  struct ResampleInfo {
+    const unsigned char *src;
+    unsigned char *dst;
+    unsigned int src_width, src_height;
+    unsigned int dst_width, dst_height;
+    std::vector< unsigned int > x0, x1, y0, y1, z0, z1;
+    std::vector< H3DFloat > xw, yw, zw;
+  };
+
+  // Compute the source pixels and weights used for linear interpolation
+  // when resampling from src_size to dst_size pixels. The sample 
+  // positions are the same as for Image::getSample.
+  void computeLinearWeights( unsigned int src_size,
+                             unsigned int dst_size,
+                             std::vector< unsigned int > &i0,
+                             std::vector< unsigned int > &i1,
+                             std::vector< H3DFloat > &w ) {
+    i0.resize( dst_size );
+    i1.resize( dst_size );
+    w.resize( dst_size );
+    H3DFloat step = 1.0f / dst_size;
+    for( unsigned int i = 0; i < dst_size; ++i ) {
+      H3DFloat p = ( ( step / 2 ) + step * i ) * src_size - 0.5f;
+      if( p < 0 ) p = 0;
+      H3DFloat f = H3DFloor( p );
+      i0[i] = (unsigned int) f;
+      if( i0[i] >= src_size ) i0[i] = src_size - 1;
+      i1[i] = i0[i] + 1 < src_size ? i0[i] + 1 : src_size - 1;
+      w[i] = p - f;
+    }
+  }
+
+  // Resample the z-slices [begin, end) of the new image. T is the type of
+  // each component and N the number of components in a pixel. The two
+  // closest rows in the two closest slices are first blended into one row
+  // and then interpolated in x. The loops over contiguous data are
+  // written so that the compiler can vectorize them.
+  template< class T, int N >
+  void resampleSlices( int begin, int end, void *data ) {
+    ResampleInfo *info = static_cast< ResampleInfo * >( data );
+    const T *src = reinterpret_cast< const T * >( info->src );
+    T *dst = reinterpret_cast< T * >( info->dst );
+    size_t row_size = (size_t) info->src_width * N;
+    size_t slice_size = row_size * info->src_height;
+    std::vector< H3DFloat > row_buffer( row_size );
+    H3DFloat *row = &row_buffer[0];
+
+    for( int z = begin; z < end; ++z ) {
+      const T *s0 = src + info->z0[z] * slice_size;
+      const T *s1 = src + info->z1[z] * slice_size;
+      H3DFloat wz = info->zw[z];
+      for( unsigned int y = 0; y < info->dst_height; ++y ) {
+        const T *r00 = s0 + info->y0[y] * row_size;
+        const T *r01 = s0 + info->y1[y] * row_size;
+        const T *r10 = s1 + info->y0[y] * row_size;
+        const T *r11 = s1 + info->y1[y] * row_size;
+        H3DFloat wy = info->yw[y];
+        H3DFloat w00 = ( 1 - wz ) * ( 1 - wy );
+        H3DFloat w01 = ( 1 - wz ) * wy;
+        H3DFloat w10 = wz * ( 1 - wy );
+        H3DFloat w11 = wz * wy;
+        for( size_t i = 0; i < row_size; ++i ) {
+          row[i] = 
+            w00 * r00[i] + w01 * r01[i] + w10 * r10[i] + w11 * r11[i];
+        }
+
+        T *d = dst + ( (size_t) z * info->dst_height + y ) * 
+          info->dst_width * N;
+        for( unsigned int x = 0; x < info->dst_width; ++x ) {
+          const H3DFloat *a = row + info->x0[x] * N;
+          const H3DFloat *b = row + info->x1[x] * N;
+          H3DFloat wx = info->xw[x];
+          for( int c = 0; c < N; ++c ) {
+            d[c] = (T)( a[c] + ( b[c] - a[c] ) * wx );
+          }
+          d += N;
+        }
+      }
+    }
+  }
+
+  template< class T >
+  ThreadPool::RangeFunc getResampleFunction( unsigned int nr_components ) {
+    switch( nr_components ) {
+    case 1: return resampleSlices< T, 1 >;
+    case 2: return resampleSlices< T, 2 >;
+    case 3: return resampleSlices< T, 3 >;
+    case 4: return resampleSlices< T, 4 >;
+    default: return NULL;
+    }
+  }
+
+  // Returns the function to use for resampling the given image or NULL
+  // if there is no specialized function for the format of the image.
+  ThreadPool::RangeFunc getResampleFunction( Image *image ) {
+    unsigned int nr_components = image->nrPixelComponents();
+    unsigned int bits_per_pixel = image->bitsPerPixel();
+    if( nr_components == 0 || bits_per_pixel % ( 8 * nr_components ) != 0 )
+      return NULL;
+    unsigned int bytes_per_component = bits_per_pixel / ( 8 * nr_components );
+
+    switch( image->pixelComponentType() ) {
+    case Image::UNSIGNED:
+      if( bytes_per_component == 1 ) 
+        return getResampleFunction< unsigned char >( nr_components );
+      if( bytes_per_component == 2 ) 
+        return getResampleFunction< unsigned short >( nr_components );
+      if( bytes_per_component == 4 ) 
+        return getResampleFunction< unsigned int >( nr_components );
+      break;
+    case Image::SIGNED:
+      if( bytes_per_component == 1 ) 
+        return getResampleFunction< signed char >( nr_components );
+      if( bytes_per_component == 2 ) 
+        return getResampleFunction< short >( nr_components );
+      if( bytes_per_component == 4 ) 
+        return getResampleFunction< int >( nr_components );
+      break;
+    case Image::RATIONAL:
+      if( bytes_per_component == 4 ) 
+        return getResampleFunction< float >( nr_components );
+      if( bytes_per_component == 8 ) 
+        return getResampleFunction< double >( nr_components );
+      break;
+    }
+    return NULL;
+  }
+}
+
  PixelImage::PixelImage( unsigned int _width,
                          unsigned int _height,
                          unsigned int _depth,
@@ -47,7 +182,9 @@ using namespace H3DUtil;
    bits_per_pixel( _bits_per_pixel ),
    pixel_type( _pixel_type ),
    pixel_component_type( _pixel_component_type ),
-   pixel_size( _pixel_size ){
+   pixel_size( _pixel_size ),
+   data_layout( LINEAR_LAYOUT ),
+   brick_shift( 3 ) {
    if( copy_data ) {
      unsigned int size = (w * h * d * bits_per_pixel)/8;
      image_data = new unsigned char[ size ];
@@ -71,7 +208,9 @@ PixelImage::PixelImage( unsigned int _width,
   bits_per_pixel( _bits_per_pixel ),
   pixel_type( _pixel_type ),
   pixel_component_type( _pixel_component_type ),
-  pixel_size( _pixel_size ){ 
+  pixel_size( _pixel_size ),
+  data_layout( LINEAR_LAYOUT ),
+  brick_shift( 3 ) { 
   unsigned int size = (w * h * d * bits_per_pixel)/8;
   image_data = new unsigned char[ size ];
 } 
@@ -79,7 +218,9 @@ PixelImage::PixelImage( unsigned int _width,
 PixelImage::PixelImage( Image *image,
                         unsigned int new_width,
                         unsigned int new_height,
-                        unsigned int new_depth ) {
+                        unsigned int new_depth ):
+  data_layout( LINEAR_LAYOUT ),
+  brick_shift( 3 ) {
   
   if( image ) {
     unsigned int width = image->width ();
@@ -98,26 +239,64 @@ PixelImage::PixelImage( Image *image,
       pixel_size = image->pixelSize();
       unsigned int size = (w * h * d * bits_per_pixel)/8;
       image_data = new unsigned char[ size ];
-	  memcpy( image_data, image->getImageData(), size );
+      image->readRegion( image_data, 0, 0, 0, w, h, d );
     } else {
-      unsigned int size = 
-        (new_width * new_height * new_depth * bits_per_pixel)/8;
+      size_t size = 
+        ( (size_t) new_width * new_height * new_depth * bits_per_pixel ) / 8;
       unsigned int bytes_per_pixel = bits_per_pixel / 8;
       unsigned char *data = new unsigned char[ size ];
-      H3DFloat z_step = 1.0f / new_depth;
-      H3DFloat y_step = 1.0f / new_height;
-      H3DFloat x_step = 1.0f / new_width;
+
+      ThreadPool::RangeFunc resample_func = 
+        PixelImageInternals::getResampleFunction( image );
+      unsigned char *src_data = 
+        static_cast< unsigned char * >( image->getImageData() );
+      // the specialized resampling needs the data in linear layout, so
+      // other images are copied with readRegion.
+      std::vector< unsigned char > linear_data;
+      if( resample_func &&
+          ( !src_data || image->dataLayout() != LINEAR_LAYOUT ) ) {
+        linear_data.resize( 
+          ( (size_t) width * height * depth * bits_per_pixel ) / 8 );
+        image->readRegion( &linear_data[0], 0, 0, 0, width, height, depth );
+        src_data = &linear_data[0];
+      }
+      if( resample_func ) {
+        // resample the image data directly, in parallel over the z-slices.
+        PixelImageInternals::ResampleInfo info;
+        info.src = src_data;
+        info.dst = data;
+        info.src_width = width;
+        info.src_height = height;
+        info.dst_width = new_width;
+        info.dst_height = new_height;
+        PixelImageInternals::computeLinearWeights( width, new_width, 
+                                                   info.x0, info.x1, 
+                                                   info.xw );
+        PixelImageInternals::computeLinearWeights( height, new_height, 
+                                                   info.y0, info.y1, 
+                                                   info.yw );
+        PixelImageInternals::computeLinearWeights( depth, new_depth, 
+                                                   info.z0, info.z1, 
+                                                   info.zw );
+        ThreadPool::getDefaultPool()->parallelFor( 0, new_depth, 
+                                                   resample_func, &info );
+      } else {
+        // generic fallback for formats without a specialized function.
+        H3DFloat z_step = 1.0f / new_depth;
+        H3DFloat y_step = 1.0f / new_height;
+        H3DFloat x_step = 1.0f / new_width;
       
-      for( unsigned int z = 0; z < new_depth; z++ ) {
-        H3DFloat dt = (z_step / 2) + z_step *z;
-        for( unsigned int y = 0; y < new_height; y++ ) {
-          H3DFloat ht =  (y_step / 2) + y_step *y;
-          for( unsigned int x = 0; x < new_width; x++ ) {
-            H3DFloat wt =  (x_step / 2) + x_step *x; 
-            image->getSample( data + 
-                              ( ( z * new_height + y ) * new_width + x ) * 
-                              bytes_per_pixel,
-                              wt, ht, dt );
+        for( unsigned int z = 0; z < new_depth; z++ ) {
+          H3DFloat dt = (z_step / 2) + z_step *z;
+          for( unsigned int y = 0; y < new_height; y++ ) {
+            H3DFloat ht =  (y_step / 2) + y_step *y;
+            for( unsigned int x = 0; x < new_width; x++ ) {
+              H3DFloat wt =  (x_step / 2) + x_step *x; 
+              image->getSample( data + 
+                                ( ( z * new_height + y ) * new_width + x ) * 
+                                bytes_per_pixel,
+                                wt, ht, dt );
+            }
           }
         }
       }
@@ -131,3 +310,387 @@ PixelImage::PixelImage( Image *image,
     }
   }
 }
+
+void PixelImage::setDataLayout( DataLayout layout, unsigned int brick_size ) {
+  unsigned int new_brick_shift = 0;
+  while( ( 2u << new_brick_shift ) <= brick_size ) ++new_brick_shift;
+  if( layout == data_layout && 
+      ( layout == LINEAR_LAYOUT || new_brick_shift == brick_shift ) ) return;
+
+  if( !image_data ) {
+    data_layout = layout;
+    brick_shift = new_brick_shift;
+    return;
+  }
+
+  unsigned int bytes_per_pixel = bits_per_pixel / 8;
+  unsigned char *image_data_before = image_data;
+  unsigned char *linear_data;
+  if( data_layout == LINEAR_LAYOUT ) {
+    linear_data = image_data;
+  } else {
+    linear_data = new unsigned char[ (size_t) w * h * d * bytes_per_pixel ];
+    getLinearImageData( linear_data );
+    deleteImageData( image_data );
+  }
+
+  data_layout = layout;
+  brick_shift = new_brick_shift;
+  if( layout == LINEAR_LAYOUT ) {
+    image_data = linear_data;
+    return;
+  }
+
+  unsigned int brick_w = 1 << brick_shift;
+  unsigned int brick_h = h > 1 ? brick_w : 1;
+  unsigned int brick_d = d > 1 ? brick_w : 1;
+  size_t padded_size = 
+    (size_t)( ( w + brick_w - 1 ) / brick_w * brick_w ) *
+    ( ( h + brick_h - 1 ) / brick_h * brick_h ) *
+    ( ( d + brick_d - 1 ) / brick_d * brick_d ) * bytes_per_pixel;
+  image_data = new unsigned char[ padded_size ];
+  memset( image_data, 0, padded_size );
+
+  // copy each row of pixels within a brick at a time.
+  for( unsigned int z = 0; z < d; ++z ) {
+    for( unsigned int y = 0; y < h; ++y ) {
+      unsigned char *row = 
+        linear_data + ( (size_t) z * h + y ) * w * bytes_per_pixel;
+      for( unsigned int x = 0; x < w; x += brick_w ) {
+        unsigned int nr_pixels = H3DMin( brick_w, w - x );
+        memcpy( image_data + brickedIndex( x, y, z ) * bytes_per_pixel,
+                row + x * bytes_per_pixel,
+                nr_pixels * bytes_per_pixel );
+      }
+    }
+  }
+  if( linear_data == image_data_before ) deleteImageData( linear_data );
+  else delete [] linear_data;
+}
+
+void PixelImage::getLinearImageData( unsigned char *data ) {
+  readRegion( data, 0, 0, 0, w, h, d );
+}
+
+void PixelImage::readRegion( void *_data,
+                             unsigned int x, unsigned int y, unsigned int z,
+                             unsigned int _w, unsigned int _h,
+                             unsigned int _d ) {
+  if( data_layout == LINEAR_LAYOUT ) {
+    Image::readRegion( _data, x, y, z, _w, _h, _d );
+    return;
+  }
+
+  unsigned char *data = (unsigned char *) _data;
+  unsigned int bytes_per_pixel = bits_per_pixel / 8;
+  unsigned int brick_mask = ( 1 << brick_shift ) - 1;
+  for( unsigned int zi = z; zi < z + _d; ++zi ) {
+    for( unsigned int yi = y; yi < y + _h; ++yi ) {
+      // copy the part of the row within each brick at a time.
+      unsigned int xi = x;
+      while( xi < x + _w ) {
+        unsigned int nr_pixels = H3DMin( ( xi | brick_mask ) + 1, x + _w ) - xi;
+        memcpy( data,
+                image_data + brickedIndex( xi, yi, zi ) * bytes_per_pixel,
+                nr_pixels * bytes_per_pixel );
+        data += nr_pixels * bytes_per_pixel;
+        xi += nr_pixels;
+      }
+    }
+  }
+}
+
+void PixelImage::writeRegion( const void *_data,
+                              unsigned int x, unsigned int y, unsigned int z,
+                              unsigned int _w, unsigned int _h,
+                              unsigned int _d ) {
+  if( data_layout == LINEAR_LAYOUT ) {
+    Image::writeRegion( _data, x, y, z, _w, _h, _d );
+    return;
+  }
+
+  const unsigned char *data = (const unsigned char *) _data;
+  unsigned int bytes_per_pixel = bits_per_pixel / 8;
+  unsigned int brick_mask = ( 1 << brick_shift ) - 1;
+  for( unsigned int zi = z; zi < z + _d; ++zi ) {
+    for( unsigned int yi = y; yi < y + _h; ++yi ) {
+      unsigned int xi = x;
+      while( xi < x + _w ) {
+        unsigned int nr_pixels = H3DMin( ( xi | brick_mask ) + 1, x + _w ) - xi;
+        memcpy( image_data + brickedIndex( xi, yi, zi ) * bytes_per_pixel,
+                data,
+                nr_pixels * bytes_per_pixel );
+        data += nr_pixels * bytes_per_pixel;
+        xi += nr_pixels;
+      }
+    }
+  }
+  imageDataChanged();
+}
+
+void PixelImage::getElement( void *value, int x, int y, int z ) {
+  if( data_layout == LINEAR_LAYOUT ) {
+    Image::getElement( value, x, y, z );
+  } else {
+    unsigned int bytes_per_pixel = bits_per_pixel / 8;
+    memcpy( value, 
+            image_data + brickedIndex( x, y, z ) * bytes_per_pixel,
+            bytes_per_pixel );
+  }
+}
+
+void PixelImage::setElement( void *value, int x, int y, int z ) {
+  if( data_layout == LINEAR_LAYOUT ) {
+    Image::setElement( value, x, y, z );
+  } else {
+    unsigned int bytes_per_pixel = bits_per_pixel / 8;
+    memcpy( image_data + brickedIndex( x, y, z ) * bytes_per_pixel,
+            value,
+            bytes_per_pixel );
+    imageDataChanged();
+  }
+}
+
+namespace PixelImageInternals {
+  // Information needed to sample an image in BRICKED_LAYOUT.
+  struct BrickedSampleInfo {
+    const unsigned char *data;
+    unsigned int width, height, depth;
+    // log2 of the brick size in each direction.
+    unsigned int shift_x, shift_y, shift_z;
+    unsigned int nr_bricks_x, nr_bricks_y;
+    // The difference in index between a pixel on the last row of a brick
+    // and its neighbour in the next brick in each direction.
+    size_t next_brick_x, next_brick_y, next_brick_z;
+    // the number of components in each pixel.
+    unsigned int nr_components;
+    // the first component to sample.
+    unsigned int first_component;
+    // the number of components to sample.
+    unsigned int nr_sampled_components;
+
+    // Returns the index of the pixel at the given position.
+    inline size_t index( unsigned int x, 
+                         unsigned int y, 
+                         unsigned int z ) const {
+      size_t brick = 
+        ( (size_t)( z >> shift_z ) * nr_bricks_y + ( y >> shift_y ) ) * 
+        nr_bricks_x + ( x >> shift_x );
+      size_t local = 
+        ( ( ( z & ( ( 1 << shift_z ) - 1 ) ) << shift_y ) + 
+          ( y & ( ( 1 << shift_y ) - 1 ) ) ) << shift_x |
+        ( x & ( ( 1 << shift_x ) - 1 ) );
+      return ( brick << ( shift_x + shift_y + shift_z ) ) + local;
+    }
+  };
+
+  // Sample an image in BRICKED_LAYOUT at n positions and put the 
+  // normalized component values in values, nr_sampled_components values
+  // for each position. T is the type of each component.
+  template< class T >
+  void sampleBricked( const BrickedSampleInfo &info,
+                      const Vec3f *coords,
+                      size_t n,
+                      Image::FilterType filter_type,
+                      H3DFloat *values ) {
+    const T *data = reinterpret_cast< const T * >( info.data );
+    const int w = info.width, h = info.height, d = info.depth;
+    const unsigned int nc = info.nr_sampled_components;
+    const unsigned int stride = info.nr_components;
+    const H3DFloat scale = ComponentTypeTraits< T >::normalize( (T) 1 );
+
+    for( size_t i = 0; i < n; ++i ) {
+      const Vec3f &c = coords[i];
+      if( filter_type == Image::NEAREST ) {
+        int x = c.x <= 0 ? 0 : c.x >= 1 ? w - 1 : (int) H3DFloor( w * c.x );
+        int y = c.y <= 0 ? 0 : c.y >= 1 ? h - 1 : (int) H3DFloor( h * c.y );
+        int z = c.z <= 0 ? 0 : c.z >= 1 ? d - 1 : (int) H3DFloor( d * c.z );
+        const T *p = data + info.index( x, y, z ) * stride + 
+          info.first_component;
+        for( unsigned int j = 0; j < nc; ++j ) 
+          values[ i * nc + j ] = p[j] * scale;
+        continue;
+      }
+
+      H3DFloat px = c.x * w - 0.5f;
+      H3DFloat py = c.y * h - 0.5f;
+      H3DFloat pz = c.z * d - 0.5f;
+      px = H3DMax( (H3DFloat) 0, H3DMin( px, (H3DFloat)( w - 1 ) ) );
+      py = H3DMax( (H3DFloat) 0, H3DMin( py, (H3DFloat)( h - 1 ) ) );
+      pz = H3DMax( (H3DFloat) 0, H3DMin( pz, (H3DFloat)( d - 1 ) ) );
+      unsigned int fx = (unsigned int) px;
+      unsigned int fy = (unsigned int) py;
+      unsigned int fz = (unsigned int) pz;
+      H3DFloat xd = px - fx, yd = py - fy, zd = pz - fz;
+
+      // The neighbour in each direction is in the same brick unless the
+      // pixel is on the edge of the brick, in which case it is in the 
+      // next brick.
+      size_t dx = 0, dy = 0, dz = 0;
+      if( fx + 1 < (unsigned int) w ) 
+        dx = ( ( fx + 1 ) & ( ( 1 << info.shift_x ) - 1 ) ) ? 
+          1 : info.next_brick_x;
+      if( fy + 1 < (unsigned int) h ) 
+        dy = ( ( fy + 1 ) & ( ( 1 << info.shift_y ) - 1 ) ) ? 
+          ( (size_t) 1 << info.shift_x ) : info.next_brick_y;
+      if( fz + 1 < (unsigned int) d ) 
+        dz = ( ( fz + 1 ) & ( ( 1 << info.shift_z ) - 1 ) ) ? 
+          ( (size_t) 1 << ( info.shift_x + info.shift_y ) ) : 
+          info.next_brick_z;
+      dx *= stride; dy *= stride; dz *= stride;
+
+      const T *p = data + info.index( fx, fy, fz ) * stride + 
+        info.first_component;
+      for( unsigned int j = 0; j < nc; ++j ) {
+        const T *q = p + j;
+        H3DFloat fff = q[0];
+        H3DFloat ffc = q[ dz ];
+        H3DFloat fcf = q[ dy ];
+        H3DFloat fcc = q[ dy + dz ];
+        H3DFloat cff = q[ dx ];
+        H3DFloat cfc = q[ dx + dz ];
+        H3DFloat ccf = q[ dx + dy ];
+        H3DFloat ccc = q[ dx + dy + dz ];
+
+        H3DFloat i1 = fff + ( ffc - fff ) * zd;
+        H3DFloat i2 = fcf + ( fcc - fcf ) * zd;
+        H3DFloat j1 = cff + ( cfc - cff ) * zd;
+        H3DFloat j2 = ccf + ( ccc - ccf ) * zd;
+        H3DFloat w1 = i1 + ( i2 - i1 ) * yd;
+        H3DFloat w2 = j1 + ( j2 - j1 ) * yd;
+        values[ i * nc + j ] = ( w1 + ( w2 - w1 ) * xd ) * scale;
+      }
+    }
+  }
+
+  // Set up info for sampling all components of an image with the given
+  // properties.
+  void setupBrickedSampleInfo( BrickedSampleInfo &info,
+                               const unsigned char *data,
+                               unsigned int w,
+                               unsigned int h,
+                               unsigned int d,
+                               unsigned int brick_shift,
+                               unsigned int nr_components ) {
+    info.data = data;
+    info.width = w;
+    info.height = h;
+    info.depth = d;
+    info.shift_x = brick_shift;
+    info.shift_y = h > 1 ? brick_shift : 0;
+    info.shift_z = d > 1 ? brick_shift : 0;
+    info.nr_bricks_x = ( w + ( 1 << info.shift_x ) - 1 ) >> info.shift_x;
+    info.nr_bricks_y = ( h + ( 1 << info.shift_y ) - 1 ) >> info.shift_y;
+    size_t brick_size = 
+      (size_t) 1 << ( info.shift_x + info.shift_y + info.shift_z );
+    size_t row_size = (size_t) 1 << info.shift_x;
+    size_t slice_size = (size_t) 1 << ( info.shift_x + info.shift_y );
+    info.next_brick_x = brick_size - ( row_size - 1 );
+    info.next_brick_y = 
+      info.nr_bricks_x * brick_size - ( slice_size - row_size );
+    info.next_brick_z = (size_t) info.nr_bricks_x * info.nr_bricks_y * 
+      brick_size - ( brick_size - slice_size );
+    info.nr_components = nr_components;
+    info.first_component = 0;
+    info.nr_sampled_components = nr_components;
+  }
+
+  typedef void (*SampleBrickedFunc)( const BrickedSampleInfo &info,
+                                     const Vec3f *coords,
+                                     size_t n,
+                                     Image::FilterType filter_type,
+                                     H3DFloat *values );
+
+  // Returns the function to use for sampling the given image or NULL if
+  // the format is not supported.
+  SampleBrickedFunc getSampleBrickedFunc( Image *image ) {
+    unsigned int nr_components = image->nrPixelComponents();
+    unsigned int bits_per_pixel = image->bitsPerPixel();
+    if( nr_components == 0 || bits_per_pixel % ( 8 * nr_components ) != 0 )
+      return NULL;
+    unsigned int bytes_per_component = bits_per_pixel / ( 8 * nr_components );
+
+    switch( image->pixelComponentType() ) {
+    case Image::UNSIGNED:
+      if( bytes_per_component == 1 ) return sampleBricked< unsigned char >;
+      if( bytes_per_component == 2 ) return sampleBricked< unsigned short >;
+      if( bytes_per_component == 4 ) return sampleBricked< unsigned int >;
+      break;
+    case Image::SIGNED:
+      if( bytes_per_component == 1 ) return sampleBricked< signed char >;
+      if( bytes_per_component == 2 ) return sampleBricked< short >;
+      if( bytes_per_component == 4 ) return sampleBricked< int >;
+      break;
+    case Image::RATIONAL:
+      if( bytes_per_component == 4 ) return sampleBricked< float >;
+      if( bytes_per_component == 8 ) return sampleBricked< double >;
+      break;
+    }
+    return NULL;
+  }
+}
+
+void PixelImage::getSamples( const Vec3f *coords,
+                             size_t n,
+                             H3DUtil::RGBA *values,
+                             FilterType filter_type ) {
+  using namespace PixelImageInternals;
+  SampleBrickedFunc sample_func = 
+    data_layout == BRICKED_LAYOUT ? getSampleBrickedFunc( this ) : NULL;
+  if( !sample_func ) {
+    Image::getSamples( coords, n, values, filter_type );
+    return;
+  }
+
+  BrickedSampleInfo info;
+  setupBrickedSampleInfo( info, image_data, w, h, d, brick_shift, 
+                          nrPixelComponents() );
+
+  const size_t block_size = 64;
+  H3DFloat v[ block_size * 4 ];
+  for( size_t i = 0; i < n; i += block_size ) {
+    size_t nr_values = H3DMin( block_size, n - i );
+    sample_func( info, coords + i, nr_values, filter_type, v );
+    for( size_t j = 0; j < nr_values; ++j ) {
+      const H3DFloat *p = v + j * info.nr_components;
+      H3DUtil::RGBA &rgba = values[ i + j ];
+      switch( pixel_type ) {
+      case LUMINANCE: 
+        rgba = PixelTypeTraits< LUMINANCE >::toRGBA( p ); break;
+      case LUMINANCE_ALPHA: 
+        rgba = PixelTypeTraits< LUMINANCE_ALPHA >::toRGBA( p ); break;
+      case RGB: 
+      case VEC3: 
+        rgba = PixelTypeTraits< RGB >::toRGBA( p ); break;
+      case BGR: 
+        rgba = PixelTypeTraits< BGR >::toRGBA( p ); break;
+      case RGBA: 
+        rgba = PixelTypeTraits< RGBA >::toRGBA( p ); break;
+      case BGRA: 
+        rgba = PixelTypeTraits< BGRA >::toRGBA( p ); break;
+      }
+    }
+  }
+}
+
+void PixelImage::getSamples( const Vec3f *coords,
+                             size_t n,
+                             H3DFloat *values,
+                             FilterType filter_type ) {
+  using namespace PixelImageInternals;
+  SampleBrickedFunc sample_func = 
+    data_layout == BRICKED_LAYOUT ? getSampleBrickedFunc( this ) : NULL;
+  if( !sample_func ) {
+    Image::getSamples( coords, n, values, filter_type );
+    return;
+  }
+
+  BrickedSampleInfo info;
+  setupBrickedSampleInfo( info, image_data, w, h, d, brick_shift, 
+                          nrPixelComponents() );
+  // the red component is the last one for BGR images.
+  info.first_component = 
+    pixel_type == BGR || pixel_type == BGRA ? 2 : 0;
+  info.nr_sampled_components = 1;
+  sample_func( info, coords, n, filter_type, values );
+}
@@ -0,0 +1,232 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at 
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file Profiler.cpp
+/// \brief CPP file for Profiler.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <H3DUtil/Profiler.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/Atomic.h>
+#include <H3DUtil/H3DMath.h>
+#include <fstream>
+#include <sstream>
+
+using namespace H3DUtil;
+using namespace std;
+
+volatile int Profiler::enabled = 0;
+vector< Profiler::ThreadBuffer * > Profiler::buffers;
+
+namespace ProfilerInternals {
+  // The names given with setThreadName.
+  vector< pair< pthread_t, string > > thread_names;
+
+  // Lock for buffers, thread_names and buffer_size.
+  MutexLock lock;
+
+  unsigned int buffer_size = 65536;
+
+  // Thread specific value with the buffer of the thread.
+  pthread_key_t buffer_key;
+  pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+  void createBufferKey() {
+    pthread_key_create( &buffer_key, NULL );
+  }
+
+  // Write s as a JSON string.
+  void writeJSONString( ostream &os, const string &s ) {
+    os << '"';
+    for( string::const_iterator i = s.begin(); i != s.end(); ++i ) {
+      if( *i == '"' || *i == '\\' ) os << '\\' << *i;
+      else if( (unsigned char) *i < 0x20 ) os << ' ';
+      else os << *i;
+    }
+    os << '"';
+  }
+
+  // Write a time in nanoseconds as microseconds, which the trace event
+  // format uses.
+  void writeMicroseconds( ostream &os, H3DInt64 ns ) {
+    H3DInt64 fraction = ns % 1000;
+    if( fraction < 0 ) fraction = -fraction;
+    if( ns < 0 && ns > -1000 ) os << '-';
+    os << ns / 1000 << '.';
+    os << (char)( '0' + fraction / 100 ) << (char)( '0' + fraction / 10 % 10 )
+       << (char)( '0' + fraction % 10 );
+  }
+}
+
+void Profiler::setEnabled( bool _enabled ) {
+  Atomic::store( &enabled, _enabled ? 1 : 0 );
+}
+
+Profiler::ThreadBuffer *Profiler::getThreadBuffer() {
+  pthread_once( &ProfilerInternals::buffer_key_once,
+                ProfilerInternals::createBufferKey );
+  ThreadBuffer *buffer =
+    (ThreadBuffer *) pthread_getspecific( ProfilerInternals::buffer_key );
+  if( !buffer ) {
+    buffer = new ThreadBuffer;
+    buffer->thread = pthread_self();
+    buffer->nr_written = 0;
+    buffer->nr_cleared = 0;
+    ProfilerInternals::lock.lock();
+    buffer->events.resize( nextPowerOfTwo( ProfilerInternals::buffer_size ) );
+    buffer->tid = (int) buffers.size() + 1;
+    buffers.push_back( buffer );
+    ProfilerInternals::lock.unlock();
+    pthread_setspecific( ProfilerInternals::buffer_key, buffer );
+  }
+  return buffer;
+}
+
+void Profiler::record( const char *name, H3DInt64 start, H3DInt64 end,
+                       int id ) {
+  ThreadBuffer *buffer = getThreadBuffer();
+  int n = buffer->nr_written;
+  Event &e = buffer->events[ n & ( buffer->events.size() - 1 ) ];
+  e.name = name;
+  e.id = id;
+  e.start = start;
+  e.end = end;
+  // publish the event.
+  Atomic::store( &buffer->nr_written, (int)( (unsigned int) n + 1 ) );
+}
+
+void Profiler::setBufferSize( unsigned int nr_zones ) {
+  ProfilerInternals::lock.lock();
+  ProfilerInternals::buffer_size = nr_zones < 2 ? 2 : nr_zones;
+  ProfilerInternals::lock.unlock();
+}
+
+void Profiler::setThreadName( pthread_t thread, const string &name ) {
+  ProfilerInternals::lock.lock();
+  vector< pair< pthread_t, string > > &names = 
+    ProfilerInternals::thread_names;
+  size_t i = 0;
+  while( i < names.size() && !pthread_equal( names[i].first, thread ) ) ++i;
+  if( i < names.size() ) names[i].second = name;
+  else names.push_back( make_pair( thread, name ) );
+  ProfilerInternals::lock.unlock();
+}
+
+void Profiler::clear() {
+  ProfilerInternals::lock.lock();
+  for( size_t i = 0; i < buffers.size(); ++i ) {
+    ThreadBuffer *buffer = buffers[i];
+    Atomic::store( &buffer->nr_cleared,
+                   Atomic::load( &buffer->nr_written ) );
+  }
+  ProfilerInternals::lock.unlock();
+}
+
+void Profiler::writeChromeTrace( ostream &os ) {
+  ProfilerInternals::lock.lock();
+  // The first event is at time 0 in the trace.
+  H3DInt64 origin = TimeStamp::getMonotonicNanoseconds();
+  vector< vector< Event > > events( buffers.size() );
+  for( size_t b = 0; b < buffers.size(); ++b ) {
+    ThreadBuffer *buffer = buffers[b];
+    unsigned int size = (unsigned int) buffer->events.size();
+    // Copy the events and then skip the ones that might have been
+    // overwritten by the thread during the copy. The counters are used as
+    // unsigned values so that wrapping around does not matter.
+    unsigned int end = (unsigned int) Atomic::load( &buffer->nr_written );
+    unsigned int nr = H3DMin( end - (unsigned int)
+                              Atomic::load( &buffer->nr_cleared ), size );
+    unsigned int begin = end - nr;
+    vector< Event > &copy = events[b];
+    copy.reserve( nr );
+    for( unsigned int i = begin; i != end; ++i ) {
+      copy.push_back( buffer->events[ i & ( size - 1 ) ] );
+    }
+    Atomic::memoryBarrier();
+    // The event with index i is overwritten by the write of index
+    // i + size, which might be in progress if it is nr_written.
+    unsigned int nr_written = 
+      (unsigned int) Atomic::load( &buffer->nr_written );
+    int nr_overwritten = (int)( nr_written - end ) + (int) nr + 1 - (int) size;
+    if( nr_overwritten > 0 ) {
+      copy.erase( copy.begin(),
+                  copy.begin() + H3DMin( (unsigned int) nr_overwritten, nr ) );
+    }
+    for( size_t i = 0; i < copy.size(); ++i ) {
+      if( copy[i].start < origin ) origin = copy[i].start;
+    }
+  }
+
+  os << "{\"traceEvents\":[" << endl;
+  bool first = true;
+  for( size_t b = 0; b < buffers.size(); ++b ) {
+    ThreadBuffer *buffer = buffers[b];
+    string name;
+    vector< pair< pthread_t, string > > &names = 
+      ProfilerInternals::thread_names;
+    for( size_t i = 0; i < names.size(); ++i ) {
+      if( pthread_equal( names[i].first, buffer->thread ) ) {
+        name = names[i].second;
+      }
+    }
+    if( name.empty() ) {
+      stringstream s;
+      if( pthread_equal( buffer->thread, ThreadBase::getMainThreadId() ) ) {
+        s << "Main thread";
+      } else {
+        s << "Thread " << buffer->tid;
+      }
+      name = s.str();
+    }
+    if( !first ) os << "," << endl;
+    first = false;
+    os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+       << buffer->tid << ",\"args\":{\"name\":";
+    ProfilerInternals::writeJSONString( os, name );
+    os << "}}";
+
+    for( size_t i = 0; i < events[b].size(); ++i ) {
+      const Event &e = events[b][i];
+      os << "," << endl << "{\"name\":";
+      ProfilerInternals::writeJSONString( os, e.name ? e.name : "" );
+      os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":";
+      ProfilerInternals::writeMicroseconds( os, e.start - origin );
+      os << ",\"dur\":";
+      ProfilerInternals::writeMicroseconds( os, e.end - e.start );
+      if( e.id != -1 ) os << ",\"args\":{\"id\":" << e.id << "}";
+      os << "}";
+    }
+  }
+  os << endl << "]}" << endl;
+  ProfilerInternals::lock.unlock();
+}
+
+bool Profiler::saveChromeTrace( const string &filename ) {
+  ofstream os( filename.c_str() );
+  if( !os.is_open() ) return false;
+  writeChromeTrace( os );
+  os.close();
+  return !os.fail();
+}
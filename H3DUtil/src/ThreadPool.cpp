@@ -0,0 +1,369 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2013, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ThreadPool.cpp
+/// \brief cpp file for ThreadPool.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifdef WIN32
+#define _WIN32_WINNT 0x0500
+#include <windows.h>
+#endif
+
+#include <H3DUtil/ThreadPool.h>
+#include <H3DUtil/H3DMath.h>
+#ifndef H3D_WINDOWS
+#include <unistd.h>
+#endif
+
+using namespace H3DUtil;
+
+namespace ThreadPoolInternal {
+  // The state of a parallelFor call. Allocated on the heap since
+  // tasks helping out with the ranges can start after parallelFor has
+  // returned.
+  struct ParallelForState {
+    ThreadPool::RangeFunc func;
+    void *data;
+    int begin;
+    int end;
+    int grain_size;
+    int nr_ranges;
+    // the next range to execute.
+    volatile int next_range;
+    // the number of ranges that have been executed.
+    volatile int nr_done_ranges;
+    // the number of users of the state.
+    volatile int ref_count;
+    ConditionLock done_lock;
+    bool done;
+  };
+
+  void releaseParallelForState( ParallelForState *state ) {
+    if( Atomic::decrement( &state->ref_count ) == 0 ) delete state;
+  }
+
+  // Execute ranges until all of them have been started.
+  void runRanges( ParallelForState *state ) {
+    for( ; ; ) {
+      int range = Atomic::fetchAndAdd( &state->next_range, 1 );
+      if( range >= state->nr_ranges ) return;
+      int begin = state->begin + range * state->grain_size;
+      int end = begin + state->grain_size;
+      if( end > state->end ) end = state->end;
+      state->func( begin, end, state->data );
+      if( Atomic::increment( &state->nr_done_ranges ) == state->nr_ranges ) {
+        state->done_lock.lock();
+        state->done = true;
+        state->done_lock.broadcast();
+        state->done_lock.unlock();
+      }
+    }
+  }
+
+  // Task function used by parallelFor.
+  void parallelForTask( void *data ) {
+    ParallelForState *state = static_cast< ParallelForState * >( data );
+    runRanges( state );
+    releaseParallelForState( state );
+  }
+
+  MutexLock default_pool_lock;
+  ThreadPool *volatile default_pool = NULL;
+}
+
+ThreadPool::Future::Future():
+  state( NULL ),
+  pool( NULL ) {
+}
+
+ThreadPool::Future::Future( TaskState *_state, ThreadPool *_pool ):
+  state( _state ),
+  pool( _pool ) {
+  if( state ) Atomic::increment( &state->ref_count );
+}
+
+ThreadPool::Future::Future( const Future &f ):
+  state( f.state ),
+  pool( f.pool ) {
+  if( state ) Atomic::increment( &state->ref_count );
+}
+
+ThreadPool::Future::~Future() {
+  if( state ) releaseState( state );
+}
+
+ThreadPool::Future &ThreadPool::Future::operator=( const Future &f ) {
+  if( f.state ) Atomic::increment( &f.state->ref_count );
+  if( state ) releaseState( state );
+  state = f.state;
+  pool = f.pool;
+  return *this;
+}
+
+bool ThreadPool::Future::isDone() const {
+  return !state || Atomic::load( &state->done );
+}
+
+void ThreadPool::Future::wait() const {
+  if( !state ) return;
+
+  // A worker thread must not block while there are tasks in the queues
+  // since the task waited for might be one of them.
+  int worker_index = pool->getWorkerIndex();
+  if( worker_index != -1 ) {
+    Task task;
+    while( !Atomic::load( &state->done ) &&
+           pool->popTask( worker_index, task ) ) {
+      pool->runTask( task );
+    }
+  }
+
+  state->done_lock.lock();
+  while( !state->done ) state->done_lock.wait();
+  state->done_lock.unlock();
+}
+
+ThreadPool::ThreadPool( int nr_threads ):
+  nr_queued_tasks( 0 ),
+  nr_sleeping_workers( 0 ),
+  next_worker( 0 ),
+  running( 1 ) {
+  if( nr_threads < 1 ) nr_threads = getHardwareConcurrency();
+
+  workers.resize( nr_threads );
+  for( int i = 0; i < nr_threads; ++i ) {
+    workers[i] = new Worker;
+    workers[i]->pool = this;
+    workers[i]->index = i;
+  }
+
+  for( int i = 0; i < nr_threads; ++i ) {
+    pthread_create( &workers[i]->thread_id, NULL, workerFunc, workers[i] );
+  }
+  thread_id = workers[0]->thread_id;
+}
+
+ThreadPool::~ThreadPool() {
+  work_lock.lock();
+  running = 0;
+  work_lock.broadcast();
+  work_lock.unlock();
+
+  for( unsigned int i = 0; i < workers.size(); ++i ) {
+    pthread_join( workers[i]->thread_id, NULL );
+  }
+  for( unsigned int i = 0; i < workers.size(); ++i ) {
+    delete workers[i];
+  }
+}
+
+ThreadPool::Future ThreadPool::addTask( TaskFunc func, void *data ) {
+  Task task;
+  task.func = func;
+  task.data = data;
+  task.state = new TaskState;
+  task.state->done = 0;
+  task.state->ref_count = 1;
+  Future f( task.state, this );
+  pushTask( task );
+  return f;
+}
+
+void ThreadPool::parallelFor( int begin, int end,
+                              RangeFunc func, void *data,
+                              int grain_size ) {
+  if( end <= begin ) return;
+  int nr_threads = getNrThreads() + ( inPoolThread() ? 0 : 1 );
+  if( grain_size < 1 ) {
+    // a few ranges per thread to even out differences in execution time.
+    grain_size = ( end - begin ) / ( 4 * nr_threads );
+    if( grain_size < 1 ) grain_size = 1;
+  }
+  int nr_ranges = ( end - begin + grain_size - 1 ) / grain_size;
+  if( nr_ranges == 1 ) {
+    func( begin, end, data );
+    return;
+  }
+
+  ThreadPoolInternal::ParallelForState *state =
+    new ThreadPoolInternal::ParallelForState;
+  state->func = func;
+  state->data = data;
+  state->begin = begin;
+  state->end = end;
+  state->grain_size = grain_size;
+  state->nr_ranges = nr_ranges;
+  state->next_range = 0;
+  state->nr_done_ranges = 0;
+  state->done = false;
+
+  // the calling thread executes ranges as well so one task less than
+  // the number of ranges is needed.
+  int nr_tasks = H3DMin( nr_ranges - 1, getNrThreads() );
+  state->ref_count = nr_tasks + 1;
+  for( int i = 0; i < nr_tasks; ++i ) {
+    Task task;
+    task.func = ThreadPoolInternal::parallelForTask;
+    task.data = state;
+    task.state = NULL;
+    pushTask( task );
+  }
+
+  ThreadPoolInternal::runRanges( state );
+
+  // All ranges have been started, wait for the ones executed by other
+  // threads to finish.
+  state->done_lock.lock();
+  while( !state->done ) state->done_lock.wait();
+  state->done_lock.unlock();
+  ThreadPoolInternal::releaseParallelForState( state );
+}
+
+ThreadPool *ThreadPool::getDefaultPool() {
+  using namespace ThreadPoolInternal;
+  if( !default_pool ) {
+    default_pool_lock.lock();
+    if( !default_pool ) {
+      ThreadPool *pool = new ThreadPool;
+      Atomic::memoryBarrier();
+      default_pool = pool;
+    }
+    default_pool_lock.unlock();
+  }
+  return default_pool;
+}
+
+int ThreadPool::getHardwareConcurrency() {
+#ifdef H3D_WINDOWS
+  SYSTEM_INFO info;
+  GetSystemInfo( &info );
+  int nr_processors = (int) info.dwNumberOfProcessors;
+#else
+  int nr_processors = (int) sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+  return nr_processors > 0 ? nr_processors : 1;
+}
+
+void ThreadPool::pushTask( const Task &task ) {
+  int index = getWorkerIndex();
+  if( index == -1 ) {
+    index = (unsigned int) Atomic::fetchAndAdd( &next_worker, 1 ) %
+      workers.size();
+  }
+  Worker *worker = workers[ index ];
+  worker->tasks_lock.lock();
+  worker->tasks.push_back( task );
+  worker->tasks_lock.unlock();
+
+  // A worker increments nr_sleeping_workers before it checks
+  // nr_queued_tasks and goes to sleep so either it sees the new task
+  // or we see that it is sleeping.
+  Atomic::increment( &nr_queued_tasks );
+  if( Atomic::load( &nr_sleeping_workers ) > 0 ) {
+    work_lock.lock();
+    work_lock.signal();
+    work_lock.unlock();
+  }
+}
+
+bool ThreadPool::popTask( int worker_index, Task &task ) {
+  int nr_workers = (int) workers.size();
+  if( worker_index != -1 ) {
+    Worker *worker = workers[ worker_index ];
+    worker->tasks_lock.lock();
+    if( !worker->tasks.empty() ) {
+      task = worker->tasks.back();
+      worker->tasks.pop_back();
+      worker->tasks_lock.unlock();
+      Atomic::decrement( &nr_queued_tasks );
+      return true;
+    }
+    worker->tasks_lock.unlock();
+  }
+
+  // steal from the other workers.
+  int start = worker_index + 1;
+  for( int i = 0; i < nr_workers; ++i ) {
+    Worker *victim = workers[ ( start + i ) % nr_workers ];
+    if( victim->index == worker_index ) continue;
+    victim->tasks_lock.lock();
+    if( !victim->tasks.empty() ) {
+      task = victim->tasks.front();
+      victim->tasks.pop_front();
+      victim->tasks_lock.unlock();
+      Atomic::decrement( &nr_queued_tasks );
+      return true;
+    }
+    victim->tasks_lock.unlock();
+  }
+  return false;
+}
+
+void ThreadPool::runTask( const Task &task ) {
+  task.func( task.data );
+  if( task.state ) {
+    task.state->done_lock.lock();
+    task.state->done = 1;
+    task.state->done_lock.broadcast();
+    task.state->done_lock.unlock();
+    releaseState( task.state );
+  }
+}
+
+int ThreadPool::getWorkerIndex() {
+  ThreadId id = getCurrentThreadId();
+  for( unsigned int i = 0; i < workers.size(); ++i ) {
+    if( pthread_equal( workers[i]->thread_id, id ) ) return (int) i;
+  }
+  return -1;
+}
+
+void ThreadPool::releaseState( TaskState *state ) {
+  if( Atomic::decrement( &state->ref_count ) == 0 ) delete state;
+}
+
+void *ThreadPool::workerFunc( void *data ) {
+  Worker *worker = static_cast< Worker * >( data );
+  ThreadPool *pool = worker->pool;
+  Task task;
+  for( ; ; ) {
+    if( pool->popTask( worker->index, task ) ) {
+      pool->runTask( task );
+      continue;
+    }
+
+    // no tasks available, wait for new ones.
+    pool->work_lock.lock();
+    Atomic::increment( &pool->nr_sleeping_workers );
+    while( Atomic::load( &pool->nr_queued_tasks ) <= 0 && pool->running ) {
+      pool->work_lock.wait();
+    }
+    Atomic::decrement( &pool->nr_sleeping_workers );
+    bool stop = !pool->running && Atomic::load( &pool->nr_queued_tasks ) <= 0;
+    pool->work_lock.unlock();
+    if( stop ) break;
+  }
+  return NULL;
+}
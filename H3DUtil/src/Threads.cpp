@@ -36,10 +36,16 @@
 #include <iostream>
 using namespace std;
 #include <H3DUtil/Threads.h>
+#include <H3DUtil/ThreadPool.h>
+#include <H3DUtil/Profiler.h>
 #ifndef H3D_WINDOWS
 #include <unistd.h>
 #endif
+#ifdef H3D_LINUX
+#include <time.h>
+#endif
 #include <errno.h>
+#include <string.h>
 
 #ifdef MACOSX
 #include <mach/mach_init.h>
@@ -48,6 +54,7 @@ using namespace std;
 #endif
 
 #include <H3DUtil/Console.h>
+#include <H3DUtil/H3DMath.h>
 
 
 using namespace H3DUtil;
@@ -139,6 +146,257 @@ void ConditionLock::broadcast() {
   pthread_cond_broadcast( &cond );
 }
 
+namespace ThreadsInternal {
+  // The number of times a TicketLock is tested before yielding.
+  const int TICKET_LOCK_SPIN_COUNT = 1000;
+
+  // Returns true if more than one processor is available, spinning is
+  // useless otherwise.
+  bool spinningUseful() {
+    static int nr_processors = ThreadPool::getHardwareConcurrency();
+    return nr_processors > 1;
+  }
+}
+
+AdaptiveMutexLock::AdaptiveMutexLock( unsigned int _max_spin_count ) :
+  max_spin_count( ThreadsInternal::spinningUseful() ? 
+                  (int) _max_spin_count : 0 ),
+  spin_estimate( 0 ) {
+}
+
+void AdaptiveMutexLock::lock() {
+  if( tryLock() ) return;
+  // Spin for a while longer than it took to get the lock recently, so that
+  // the estimate can grow again when the lock is held for shorter times.
+  int estimate = Atomic::load( &spin_estimate );
+  int max_spins = H3DMin( max_spin_count, 2 * estimate + 10 );
+  int nr_spins = 0;
+  bool locked = false;
+  while( nr_spins < max_spins ) {
+    ++nr_spins;
+    Atomic::pause();
+    if( tryLock() ) {
+      locked = true;
+      break;
+    }
+  }
+  if( !locked ) pthread_mutex_lock( &mutex );
+  spin_estimate = estimate + ( nr_spins - estimate ) / 8;
+}
+
+ReadWriteLock::ReadWriteLock() {
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init( &attr );
+#ifdef H3D_LINUX
+  // The default on Linux is to prefer readers.
+  pthread_rwlockattr_setkind_np( &attr,
+                                 PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP );
+#endif
+  pthread_rwlock_init( &rwlock, &attr );
+  pthread_rwlockattr_destroy( &attr );
+}
+
+ReadWriteLock::~ReadWriteLock() {
+  pthread_rwlock_destroy( &rwlock );
+}
+
+void ReadWriteLock::lock() {
+  pthread_rwlock_wrlock( &rwlock );
+}
+
+void ReadWriteLock::unlock() {
+  pthread_rwlock_unlock( &rwlock );
+}
+
+bool ReadWriteLock::tryLock() {
+  return pthread_rwlock_trywrlock( &rwlock ) == 0;
+}
+
+void ReadWriteLock::readLock() {
+  pthread_rwlock_rdlock( &rwlock );
+}
+
+bool ReadWriteLock::tryReadLock() {
+  return pthread_rwlock_tryrdlock( &rwlock ) == 0;
+}
+
+TicketLock::TicketLock() :
+  next_ticket( 0 ),
+  now_serving( 0 ) {
+}
+
+void TicketLock::lock() {
+  int ticket = Atomic::fetchAndAdd( &next_ticket, 1 );
+  int nr_spins = 0;
+  while( Atomic::load( &now_serving ) != ticket ) {
+    // The holder or a thread before us in line might not be running.
+    if( ++nr_spins < ThreadsInternal::TICKET_LOCK_SPIN_COUNT &&
+        ThreadsInternal::spinningUseful() ) {
+      Atomic::pause();
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+void TicketLock::unlock() {
+  Atomic::increment( &now_serving );
+}
+
+bool TicketLock::tryLock() {
+  int ticket = Atomic::load( &now_serving );
+  return Atomic::compareAndSwap( &next_ticket, ticket, ticket + 1 );
+}
+
+Barrier::Barrier( unsigned int _nr_threads, unsigned int _spin_count ) :
+  nr_threads( (int) _nr_threads ),
+  nr_arrived( 0 ),
+  sense( 0 ),
+  spin_count( _spin_count ) {
+}
+
+bool Barrier::wait() {
+  // The sense must be read before arriving, after that the round can
+  // end at any time.
+  int my_sense = Atomic::load( &sense );
+  if( Atomic::increment( &nr_arrived ) == Atomic::load( &nr_threads ) ) {
+    // Last to arrive. Reset the counter for the next round before ending
+    // this one, no thread can arrive at the next round before that.
+    Atomic::store( &nr_arrived, 0 );
+    lock.lock();
+    Atomic::increment( &sense );
+    lock.broadcast();
+    lock.unlock();
+    return true;
+  }
+
+  for( unsigned int i = 0; i < spin_count; ++i ) {
+    if( Atomic::load( &sense ) != my_sense ) return false;
+  }
+
+  lock.lock();
+  while( Atomic::load( &sense ) == my_sense ) {
+    lock.wait();
+  }
+  lock.unlock();
+  return false;
+}
+
+void Barrier::setNrThreads( unsigned int _nr_threads ) {
+  Atomic::store( &nr_threads, (int) _nr_threads );
+}
+
+#ifdef H3D_LINUX
+namespace ThreadsInternal {
+  const long NANOSEC_PER_SEC = 1000000000;
+
+  // Add ns nanoseconds to t.
+  inline void addNanoseconds( timespec &t, long ns ) {
+    t.tv_nsec += ns;
+    while( t.tv_nsec >= NANOSEC_PER_SEC ) {
+      t.tv_nsec -= NANOSEC_PER_SEC;
+      t.tv_sec++;
+    }
+    while( t.tv_nsec < 0 ) {
+      t.tv_nsec += NANOSEC_PER_SEC;
+      t.tv_sec--;
+    }
+  }
+
+  // Returns a - b in nanoseconds.
+  inline long long diffNanoseconds( const timespec &a, const timespec &b ) {
+    return ( (long long)a.tv_sec - b.tv_sec ) * NANOSEC_PER_SEC +
+      ( a.tv_nsec - b.tv_nsec );
+  }
+
+  // Sleep until the given time of the monotonic clock.
+  inline void sleepUntil( const timespec &t ) {
+    while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL ) ==
+           EINTR );
+  }
+
+  // Wait until the next deadline of a periodic loop and update deadline
+  // to the time the next loop should start. Returns false if the deadline
+  // had already passed.
+  bool waitForDeadline( timespec &deadline, long period_ns, long spin_ns ) {
+    addNanoseconds( deadline, period_ns );
+    timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    long long time_left = diffNanoseconds( deadline, now );
+    if( time_left < 0 ) {
+      // If we are more than a period late we start over from now instead
+      // of running several loops in a row to catch up.
+      if( -time_left > period_ns ) deadline = now;
+      return false;
+    }
+
+    if( spin_ns > 0 ) {
+      if( time_left > spin_ns ) {
+        timespec wake_up = deadline;
+        addNanoseconds( wake_up, -spin_ns );
+        sleepUntil( wake_up );
+      }
+      do {
+        clock_gettime( CLOCK_MONOTONIC, &now );
+      } while( diffNanoseconds( deadline, now ) > 0 );
+    } else {
+      sleepUntil( deadline );
+    }
+    return true;
+  }
+}
+#endif
+
+namespace ThreadsInternal {
+  // The time of the monotonic clock in seconds. Used for the loop and
+  // callback timing, where the resolution of a TimeStamp is too low.
+  inline double monotonicTime() {
+    return TimeStamp::getMonotonicNanoseconds() * 1e-9;
+  }
+
+  // The length in seconds of the windows that the loop statistics are
+  // measured over.
+  const double loop_statistics_window = 1.0;
+
+  // Reset all values in stats.
+  void clearLoopStatistics( PeriodicThread::LoopStatistics &stats,
+                            int frequency ) {
+    memset( &stats, 0, sizeof( stats ) );
+    if( frequency > 0 ) {
+      stats.nominal_period = 1.0 / frequency;
+      // the histogram covers periods up to twice the nominal period.
+      stats.period_bucket_size = 
+        2 * stats.nominal_period /
+        PeriodicThread::LoopStatistics::NR_PERIOD_BUCKETS;
+    } else {
+      stats.period_bucket_size = 1e-5;
+    }
+  }
+
+  // Returns the jitter value below which the given fraction of the loops 
+  // in stats is.
+  double jitterPercentile( const PeriodicThread::LoopStatistics &stats,
+                           double fraction ) {
+    unsigned int nr_values = stats.nr_periods;
+    if( nr_values == 0 ) return 0;
+
+    double limit = fraction * nr_values;
+    unsigned int count = 0;
+    for( int i = 0; i < PeriodicThread::LoopStatistics::NR_JITTER_BUCKETS;
+         ++i ) {
+      count += stats.jitter_histogram[i];
+      if( count >= limit ) {
+        // use the upper limit of the bucket, but never more than the 
+        // largest value measured. The last bucket has no upper limit.
+        if( i == PeriodicThread::LoopStatistics::NR_JITTER_BUCKETS - 1 )
+          return stats.max_jitter;
+        return H3DMin( ( i + 1 ) * 1e-6, stats.max_jitter );
+      }
+    }
+    return stats.max_jitter;
+  }
+}
+
 void *PeriodicThread::thread_func( void * _data ) {
   PeriodicThread *thread = static_cast< PeriodicThread * >( _data );
   pthread_setcanceltype( PTHREAD_CANCEL_ASYNCHRONOUS, NULL );
@@ -187,10 +445,23 @@ void *PeriodicThread::thread_func( void * _data ) {
   }
 
 #else
-  TimeStamp last_time;
+  double last_time = ThreadsInternal::monotonicTime();
+#ifdef H3D_LINUX
+  timespec deadline;
+  clock_gettime( CLOCK_MONOTONIC, &deadline );
+#endif
 #endif
 
+  // used to measure the achieved frequency.
+  double frequency_start_time = ThreadsInternal::monotonicTime();
+  unsigned int nr_loops = 0;
+
+  // used for the loop statistics.
+  double loop_start_time = 0;
+  bool first_loop = true;
+
   while( thread->thread_func_is_running ) {
+    bool overrun = false;
     if( thread->frequency > 0 ) {
 #ifdef WIN32
       if (WaitForSingleObject(hTimer, INFINITE) != WAIT_OBJECT_0)
@@ -203,38 +474,77 @@ void *PeriodicThread::thread_func( void * _data ) {
         return NULL;
       }
 #else
-      TimeStamp a;
-      TimeStamp current_time;
-      double dt =  current_time - last_time;
-      double delay = 1.0 / thread->frequency - dt;
-      if( delay > 0 ) {
-         usleep( 1e6 * delay );
+#ifdef H3D_LINUX
+      if( thread->scheduling_mode == ABSOLUTE_DEADLINE ) {
+        long period_ns = ThreadsInternal::NANOSEC_PER_SEC / thread->frequency;
+        long spin_ns = (long)( thread->spin_time * 1e9 );
+        if( !ThreadsInternal::waitForDeadline( deadline, period_ns, spin_ns ) )
+          overrun = true;
+      } else
+#endif
+      {
+        double dt = ThreadsInternal::monotonicTime() - last_time;
+        double delay = 1.0 / thread->frequency - dt;
+        if( delay > 0 ) {
+          usleep( 1e6 * delay );
+        } else {
+          overrun = true;
+        }
+        last_time = ThreadsInternal::monotonicTime();
+#ifdef H3D_LINUX
+        // keep the deadline up to date in case the mode is changed.
+        clock_gettime( CLOCK_MONOTONIC, &deadline );
+#endif
       }
-      last_time = TimeStamp();
 #endif
     }
-    vector< PeriodicThread::CallbackList::iterator > to_remove;
-    thread->callback_lock.lock();
-    for( PeriodicThread::CallbackList::iterator i = thread->callbacks.begin();
-         i != thread->callbacks.end(); i++ ) {
-      PeriodicThread::CallbackCode c = ( (*i).second ).first(
-        ( (*i).second ).second );
-      if( c == PeriodicThread::CALLBACK_DONE ) {
-        to_remove.push_back( i );
-      }
+
+    if( overrun ) Atomic::increment( &thread->nr_overruns );
+
+    ++nr_loops;
+    H3DInt64 loop_start_ns = TimeStamp::getMonotonicNanoseconds();
+    double now = loop_start_ns * 1e-9;
+    if( now - frequency_start_time >= 1.0 ) {
+      thread->achieved_frequency = nr_loops / ( now - frequency_start_time );
+      frequency_start_time = now;
+      nr_loops = 0;
     }
 
-    thread->callbacks_added_lock.lock();
-    // remove all callbacks that returned CALLBACK_DONE.
-    for( vector< PeriodicThread::CallbackList::iterator >::iterator i = 
-           to_remove.begin();
-         i != to_remove.end(); i++ ) {
-      thread->free_ids.push_back( (*(*i) ).first );
-      thread->callbacks.erase( *i );
+    if( Atomic::load( &thread->reset_loop_statistics ) ) {
+      Atomic::store( &thread->reset_loop_statistics, 0 );
+      ThreadsInternal::clearLoopStatistics( thread->loop_statistics,
+                                            thread->frequency );
+      thread->published_loop_statistics.setValue( thread->loop_statistics );
+      thread->loop_statistics_window_start = now;
+      first_loop = true;
+    }
+    // the first loop after a reset has no previous loop to measure the 
+    // period from.
+    double period = first_loop ? -1 : now - loop_start_time;
+    loop_start_time = now;
+    first_loop = false;
+
+    // only measure the time it takes to get the lock if it is not 
+    // available right away.
+    double lock_wait_time = 0;
+    if( !thread->callback_lock.tryLock() ) {
+      double lock_start_time = ThreadsInternal::monotonicTime();
+      thread->callback_lock.lock();
+      lock_wait_time = ThreadsInternal::monotonicTime() - lock_start_time;
     }
-    thread->callbacks_added_lock.unlock();
+    thread->updateLoopStatistics( now, period, overrun, lock_wait_time );
 
-    thread->callback_lock.signal();
+    thread->transferCallbackList();
+    thread->callbacks.callAll();
+
+    if( Profiler::isEnabled() ) {
+      Profiler::record( "PeriodicThread loop", loop_start_ns,
+                        TimeStamp::getMonotonicNanoseconds() );
+    }
+
+    // wake up all threads waiting in synchronousCallback.
+    thread->nr_callback_passes++;
+    thread->callback_lock.broadcast();
 
     // if no more callbacks wait for a callback to be added in order to
     // avoid spending time doing no useful operations in the thread.
@@ -243,14 +553,27 @@ void *PeriodicThread::thread_func( void * _data ) {
       // if the user clears the callbacks list and then destroys the thread
       // class. In that case the wait statement can be reached after
       // signal in ~PeriodicThread().
-      if( thread->callbacks.size() == 0 && thread->thread_func_is_running )
-        thread->callback_lock.wait();
-    } else {
-      thread->transferCallbackList();
+      if( thread->callbacks.empty() && thread->thread_func_is_running ) {
+        // Tell the producers that we are about to wait before checking the
+        // queue a last time. A callback added after the check will see the
+        // flag and wake us up in wakeUpThread.
+        Atomic::store( &thread->waiting_for_callbacks, 1 );
+        Atomic::memoryBarrier();
+        if( thread->callbacks_added.empty() )
+          thread->callback_lock.wait();
+        thread->waiting_for_callbacks = 0;
+      }
     }
 
     thread->callback_lock.unlock();
 
+#ifdef H3D_LINUX
+    // The sleep until the next deadline gives other threads the chance to
+    // run so yielding is not needed.
+    if( thread->frequency > 0 &&
+        thread->scheduling_mode == ABSOLUTE_DEADLINE ) continue;
+#endif
+
     sched_yield();
 #ifndef WIN32
 		// According to documentation usleep(0) should not do anything so it should
@@ -268,15 +591,21 @@ void *PeriodicThread::thread_func( void * _data ) {
 
 ThreadBase::ThreadId ThreadBase::main_thread_id =
   ThreadBase::getCurrentThreadId();
-ConditionLock HapticThreadBase::haptic_lock; 
+MutexLock HapticThreadBase::threads_lock;
 ConditionLock HapticThreadBase::sg_lock; 
-int HapticThreadBase::haptic_threads_left = -1;
+Barrier HapticThreadBase::sync_barrier;
 std::vector< HapticThreadBase * > HapticThreadBase::threads;
 
 namespace ThreadsInternal {
-  // callback functions
-  PeriodicThreadBase::CallbackCode doNothing( void * ) { 
-    return PeriodicThreadBase::CALLBACK_DONE; 
+  // Thread specific value with the HapticThreadBase of a haptic thread.
+  // NULL until it is known if the thread is a haptic thread.
+  pthread_key_t haptic_thread_key;
+  pthread_once_t haptic_thread_key_once = PTHREAD_ONCE_INIT;
+  // The value for threads that are not haptic threads.
+  void *const NOT_HAPTIC_THREAD = (void *) 1;
+
+  void createHapticThreadKey() {
+    pthread_key_create( &haptic_thread_key, NULL );
   }
 }
 
@@ -284,8 +613,19 @@ PeriodicThreadBase::PeriodicThreadBase() : next_id(0) {}
 
 PeriodicThread::PeriodicThread( int _thread_priority,
                                 int _thread_frequency ):
+  waiting_for_callbacks( 0 ),
+  nr_callback_passes( 0 ),
   frequency( _thread_frequency ),
-  thread_func_is_running( true ) {
+  thread_func_is_running( true ),
+  scheduling_mode( RELATIVE_SLEEP ),
+  spin_time( 0 ),
+  achieved_frequency( 0 ),
+  nr_overruns( 0 ),
+  loop_statistics_window_start( 0 ),
+  reset_loop_statistics( 1 ) {
+  LoopStatistics stats;
+  ThreadsInternal::clearLoopStatistics( stats, frequency );
+  published_loop_statistics.setValue( stats );
 #ifdef WIN32
   priority = _thread_priority == THREAD_PRIORITY_LOWEST ? LOW_PRIORITY :
              _thread_priority == THREAD_PRIORITY_NORMAL ? NORMAL_PRIORITY :
@@ -316,9 +656,20 @@ PeriodicThread::PeriodicThread( int _thread_priority,
 
 PeriodicThread::PeriodicThread( Priority _thread_priority,
                                 int _thread_frequency ):
+  waiting_for_callbacks( 0 ),
+  nr_callback_passes( 0 ),
   priority( _thread_priority ),
   frequency( _thread_frequency ),
-  thread_func_is_running( true ) {
+  thread_func_is_running( true ),
+  scheduling_mode( RELATIVE_SLEEP ),
+  spin_time( 0 ),
+  achieved_frequency( 0 ),
+  nr_overruns( 0 ),
+  loop_statistics_window_start( 0 ),
+  reset_loop_statistics( 1 ) {
+  LoopStatistics stats;
+  ThreadsInternal::clearLoopStatistics( stats, frequency );
+  published_loop_statistics.setValue( stats );
   
   pthread_attr_t attr;
   pthread_attr_init( &attr );
@@ -368,7 +719,7 @@ PeriodicThread::~PeriodicThread() {
   if( !pthread_equal( this_thread, thread_id ) ) {
     callback_lock.lock();
     exitThread();
-    callback_lock.signal();
+    callback_lock.broadcast();
     callback_lock.unlock();
     pthread_join( thread_id, NULL );
   } else {
@@ -376,6 +727,64 @@ PeriodicThread::~PeriodicThread() {
   }
 }
 
+void PeriodicThread::updateLoopStatistics( double now,
+                                           double period,
+                                           bool overrun,
+                                           double lock_wait_time ) {
+  LoopStatistics &stats = loop_statistics;
+  stats.nr_loops++;
+  if( overrun ) stats.nr_overruns++;
+  stats.lock_wait_time += lock_wait_time;
+  if( lock_wait_time > stats.max_lock_wait_time ) 
+    stats.max_lock_wait_time = lock_wait_time;
+
+  if( period >= 0 ) {
+    stats.nr_periods++;
+    if( stats.nr_periods == 1 || period < stats.min_period ) 
+      stats.min_period = period;
+    if( period > stats.max_period ) stats.max_period = period;
+    stats.mean_period += ( period - stats.mean_period ) / stats.nr_periods;
+
+    int bucket = (int)( period / stats.period_bucket_size );
+    if( bucket >= LoopStatistics::NR_PERIOD_BUCKETS ) 
+      bucket = LoopStatistics::NR_PERIOD_BUCKETS - 1;
+    stats.period_histogram[ bucket ]++;
+
+    double jitter = 
+      stats.nominal_period > 0 ? H3DAbs( period - stats.nominal_period ) : 0;
+    if( jitter > stats.max_jitter ) stats.max_jitter = jitter;
+    bucket = (int)( jitter * 1e6 );
+    if( bucket >= LoopStatistics::NR_JITTER_BUCKETS ) 
+      bucket = LoopStatistics::NR_JITTER_BUCKETS - 1;
+    stats.jitter_histogram[ bucket ]++;
+  }
+
+  // publish the values once per window instead of every loop, and start
+  // a new window so that the histograms only contain recent loops.
+  if( now - loop_statistics_window_start >= 
+      ThreadsInternal::loop_statistics_window ) {
+    published_loop_statistics.setValue( loop_statistics );
+    ThreadsInternal::clearLoopStatistics( loop_statistics, frequency );
+    loop_statistics_window_start = now;
+  }
+}
+
+void PeriodicThread::getLoopStatistics( LoopStatistics &stats ) {
+  published_loop_statistics.getValue( stats );
+
+  stats.median_jitter = ThreadsInternal::jitterPercentile( stats, 0.5 );
+  stats.jitter_99th_percentile = 
+    ThreadsInternal::jitterPercentile( stats, 0.99 );
+  stats.jitter_999th_percentile = 
+    ThreadsInternal::jitterPercentile( stats, 0.999 );
+}
+
+void PeriodicThread::setSchedulingMode( SchedulingMode mode,
+                                        double _spin_time ) {
+  spin_time = _spin_time;
+  scheduling_mode = mode;
+}
+
 SimpleThread::SimpleThread( void *(func) (void *),
                             void *args,
                             int thread_priority ) {
@@ -447,109 +856,337 @@ SimpleThread::~SimpleThread() {
 
 void PeriodicThread::synchronousCallback( CallbackFunc func, void *data ) {
   callback_lock.lock();
-  // signal the thread that a new callback is available if it is waiting for one.
-  if( frequency < 0 && callbacks.size() == 0 ) callback_lock.signal();
   // add the new callback.
-  callbacks.push_back( make_pair( genCallbackId(), make_pair( func, data ) ) );
-  // wait for the callback to be done.
-  callback_lock.wait();
+  int cb_id = callbacks.reserveHandle();
+  if( cb_id == -1 ) {
+    Console(4) << "PeriodicThread: Too many callbacks. Callback not added."
+               << endl;
+    callback_lock.unlock();
+    return;
+  }
+  callbacks.add( cb_id, func, data );
+  // signal the thread that a new callback is available if it is waiting for one.
+  if( waiting_for_callbacks ) callback_lock.broadcast();
+  // wait for the callback to be done, i.e. for the thread to finish a
+  // pass through the callbacks.
+  unsigned int pass = nr_callback_passes;
+  while( pass == nr_callback_passes ) callback_lock.wait();
   callback_lock.unlock();
 }
 
 int PeriodicThread::asynchronousCallback( CallbackFunc func, void *data ) {
-  int cb_id = -1;
-  if( frequency < 0 ) {
-    callback_lock.lock();
-    // signal the thread that a new callback is available if it is waiting for
-    // one.
-    if( callbacks.size() == 0 ) callback_lock.signal();
-    cb_id = genCallbackId();
-    // add the new callback
-    callbacks.push_back( make_pair( cb_id, make_pair( func, data ) ) );
-    callback_lock.unlock();
-  } else {
-    callbacks_added_lock.lock();
-    cb_id = genCallbackId();
-    // add the new callback
-    callbacks_added.push_back( make_pair( cb_id, make_pair( func, data ) ) );
-    callbacks_added_lock.unlock();
-  }
+  int cb_id = addCallback( func, data );
+  wakeUpThread();
   return cb_id;
 }
 
-bool PeriodicThread::removeAsynchronousCallback( int callback_handle ) {
-  callback_lock.lock();
-  callbacks_added_lock.lock();
-  // For threads with a low frequency it could be that the callback is
-  // in callbacks_added, therefore lock both locks and then go through
-  // both lists.
-  for( CallbackList::iterator i = callbacks_added.begin();
-       i != callbacks_added.end(); i++ ) {
-  if( (*i).first == callback_handle ) {
-      // Add callback_handle integer to the free_ids list in order
-      // to reuse id later.
-      free_ids.push_back( callback_handle );
-      callbacks_added.erase( i );
-      callbacks_added_lock.unlock();
+int PeriodicThread::addCallback( CallbackFunc func, void *data ) {
+  CallbackTable::Entry cb;
+  cb.func = func;
+  cb.data = data;
+  cb.handle = callbacks.reserveHandle();
+  if( cb.handle == -1 ) {
+    Console(4) << "PeriodicThread: Too many callbacks. Callback not added."
+               << endl;
+    return -1;
+  }
+  if( !callbacks_added.push( cb ) ) {
+    // The queue is full. Add the callback directly to the callbacks table
+    // instead. If called from within a callback in this thread the
+    // callback_lock is already held.
+    if( pthread_equal( getCurrentThreadId(), thread_id ) ) {
+      transferCallbackList();
+      callbacks.add( cb.handle, cb.func, cb.data );
+    } else {
+      callback_lock.lock();
+      transferCallbackList();
+      callbacks.add( cb.handle, cb.func, cb.data );
       callback_lock.unlock();
-      return true;
     }
   }
+  return cb.handle;
+}
 
-  for( CallbackList::iterator i = callbacks.begin();
-       i != callbacks.end(); i++ ) {
-    if( (*i).first == callback_handle ) {
-      // Add callback_handle integer to the free_ids list in order
-      // to reuse id later.
-      free_ids.push_back( callback_handle );
-      callbacks.erase( i );
-      callbacks_added_lock.unlock();
+void PeriodicThread::wakeUpThread() {
+  if( frequency < 0 ) {
+    // make sure the callback pushed to callbacks_added is visible before
+    // reading the flag.
+    Atomic::memoryBarrier();
+    if( waiting_for_callbacks ) {
+      callback_lock.lock();
+      if( waiting_for_callbacks ) {
+        waiting_for_callbacks = 0;
+        callback_lock.broadcast();
+      }
       callback_lock.unlock();
-      return true;
     }
   }
-  callbacks_added_lock.unlock();
+}
+
+bool PeriodicThread::removeAsynchronousCallback( int callback_handle ) {
+  callback_lock.lock();
+  // If the callback is still in the callbacks_added queue it is marked
+  // as removed and will be ignored when transferred.
+  bool removed = callbacks.remove( callback_handle );
   callback_lock.unlock();
-  return false;
+  return removed;
 }
 
 /// Remove all callbacks.
 void PeriodicThread::clearAllCallbacks() {
   callback_lock.lock();
-  callbacks_added_lock.lock();
   // For threads with a low frequency it could be that the callback is
-  // in callbacks_added, therefore lock both locks and then go through
-  // both lists.
+  // in callbacks_added, therefore empty both of them.
+  transferCallbackList();
+  callbacks.clear();
+  callback_lock.unlock();
+}
+
+CallbackTable::CallbackTable():
+  nr_removed_entries( 0 ),
+  nr_chunks( 0 ),
+  free_head( 0xffffffff ) {
+  for( int i = 0; i < MAX_CHUNKS; ++i ) chunks[i] = NULL;
+  // allocate memory up front so that no allocations are needed for
+  // the number of callbacks normally used.
+  entries.reserve( CHUNK_SIZE );
+  grow();
+}
+
+CallbackTable::~CallbackTable() {
+  for( int i = 0; i < nr_chunks; ++i ) delete [] chunks[i];
+}
 
-  // All the ids should be added to the free_ids list in
-  // order to be reused later.
-  for( CallbackList::iterator i = callbacks_added.begin();
-       i != callbacks_added.end(); i++ ) {
-    free_ids.push_back( (*i).first );
+int CallbackTable::reserveHandle() {
+  for( ; ; ) {
+    H3DUInt64 head = (H3DUInt64) Atomic::load( &free_head );
+    unsigned int index = (unsigned int)( head & 0xffffffff );
+    if( index == 0xffffffff ) {
+      // no free slots.
+      if( !grow() ) return -1;
+      continue;
+    }
+    // next_free might have been changed by another thread if the slot
+    // has been taken, but then the counter in free_head has changed and
+    // the compare and swap will fail.
+    unsigned int next = (unsigned int) getSlot( index ).next_free;
+    H3DUInt64 new_head = ( ( ( head >> 32 ) + 1 ) << 32 ) | next;
+    if( Atomic::compareAndSwap( &free_head,
+                                (H3DInt64) head,
+                                (H3DInt64) new_head ) ) {
+      Slot &slot = getSlot( index );
+      slot.position = SLOT_RESERVED;
+      return ( slot.generation << HANDLE_INDEX_BITS ) | index;
+    }
   }
-  callbacks_added.clear();
+}
 
-  // All the ids should be added to the free_ids list in
-  // order to be reused later.
-  for( CallbackList::iterator i = callbacks.begin();
-       i != callbacks.end(); i++ ) {
-    free_ids.push_back( (*i).first );
+void CallbackTable::freeSlot( int index ) {
+  Slot &slot = getSlot( index );
+  slot.generation = ( slot.generation + 1 ) & GENERATION_MASK;
+  slot.position = SLOT_FREE;
+  Atomic::increment( &slot.stats_sequence );
+  slot.stats.handle = -1;
+  Atomic::increment( &slot.stats_sequence );
+  for( ; ; ) {
+    H3DUInt64 head = (H3DUInt64) Atomic::load( &free_head );
+    slot.next_free = (int)( head & 0xffffffff );
+    H3DUInt64 new_head = ( ( ( head >> 32 ) + 1 ) << 32 ) | 
+      (unsigned int) index;
+    if( Atomic::compareAndSwap( &free_head,
+                                (H3DInt64) head,
+                                (H3DInt64) new_head ) ) {
+      return;
+    }
   }
-  callbacks.clear();
-  callbacks_added_lock.unlock();
-  callback_lock.unlock();
 }
 
+bool CallbackTable::grow() {
+  grow_lock.lock();
+  // another thread might have added slots while we waited for the lock.
+  if( ( Atomic::load( &free_head ) & 0xffffffff ) != 0xffffffff ) {
+    grow_lock.unlock();
+    return true;
+  }
 
-HapticThreadBase::HapticThreadBase() {
-  sg_lock.lock();
-  threads.push_back( this );
-  sg_lock.unlock();
+  if( nr_chunks == MAX_CHUNKS ) {
+    grow_lock.unlock();
+    return false;
+  }
 
+  int first_index = nr_chunks * CHUNK_SIZE;
+  Slot *chunk = new Slot[ CHUNK_SIZE ];
+  for( int i = 0; i < CHUNK_SIZE; ++i ) {
+    chunk[i].generation = 0;
+    chunk[i].position = SLOT_FREE;
+    chunk[i].next_free = first_index + i + 1;
+    chunk[i].stats_sequence = 0;
+    chunk[i].stats.handle = -1;
+  }
+  chunks[ nr_chunks ] = chunk;
+  Atomic::increment( &nr_chunks );
+
+  // link the new slots into the list of free slots.
+  for( ; ; ) {
+    H3DUInt64 head = (H3DUInt64) Atomic::load( &free_head );
+    chunk[ CHUNK_SIZE - 1 ].next_free = (int)( head & 0xffffffff );
+    H3DUInt64 new_head = ( ( ( head >> 32 ) + 1 ) << 32 ) | 
+      (unsigned int) first_index;
+    if( Atomic::compareAndSwap( &free_head,
+                                (H3DInt64) head,
+                                (H3DInt64) new_head ) ) {
+      break;
+    }
+  }
+  grow_lock.unlock();
+  return true;
+}
+
+CallbackTable::Slot *CallbackTable::getSlotForHandle( int handle ) {
+  if( handle < 0 ) return NULL;
+  int index = handle & HANDLE_INDEX_MASK;
+  if( index >= nr_chunks * CHUNK_SIZE ) return NULL;
+  Slot &slot = getSlot( index );
+  if( slot.generation != ( handle >> HANDLE_INDEX_BITS ) ) return NULL;
+  return &slot;
+}
+
+void CallbackTable::add( int handle,
+                         PeriodicThreadBase::CallbackFunc func,
+                         void *data ) {
+  Slot *slot = getSlotForHandle( handle );
+  if( !slot ) return;
+  if( slot->position == SLOT_CANCELLED ) {
+    // removed before it was added.
+    freeSlot( handle & HANDLE_INDEX_MASK );
+    return;
+  }
+  slot->position = (int) entries.size();
+  Atomic::increment( &slot->stats_sequence );
+  slot->stats.handle = handle;
+  slot->stats.nr_calls = 0;
+  slot->stats.total_time = 0;
+  slot->stats.max_time = 0;
+  Atomic::increment( &slot->stats_sequence );
+  Entry e;
+  e.func = func;
+  e.data = data;
+  e.handle = handle;
+  entries.push_back( e );
+}
+
+bool CallbackTable::remove( int handle ) {
+  Slot *slot = getSlotForHandle( handle );
+  if( !slot ) return false;
+  if( slot->position >= 0 ) {
+    entries[ slot->position ].func = NULL;
+    ++nr_removed_entries;
+    freeSlot( handle & HANDLE_INDEX_MASK );
+    return true;
+  } else if( slot->position == SLOT_RESERVED ) {
+    slot->position = SLOT_CANCELLED;
+    return true;
+  }
+  return false;
+}
+
+void CallbackTable::clear() {
+  for( size_t i = 0; i < entries.size(); ++i ) {
+    if( entries[i].func ) {
+      freeSlot( entries[i].handle & HANDLE_INDEX_MASK );
+    }
+  }
+  entries.clear();
+  nr_removed_entries = 0;
+}
+
+void CallbackTable::callAll() {
+  // Callbacks added by the callbacks themselves are added last and
+  // will be called in the next pass.
+  size_t nr_entries = entries.size();
+  for( size_t i = 0; i < nr_entries; ++i ) {
+    // entries might be reallocated by a callback adding a new callback so
+    // do not keep references into it.
+    PeriodicThreadBase::CallbackFunc func = entries[i].func;
+    if( !func ) continue;
+    int handle = entries[i].handle;
+    H3DInt64 start_time = TimeStamp::getMonotonicNanoseconds();
+    PeriodicThreadBase::CallbackCode code = func( entries[i].data );
+    H3DInt64 end_time = TimeStamp::getMonotonicNanoseconds();
+    double time = ( end_time - start_time ) * 1e-9;
+    if( Profiler::isEnabled() ) {
+      Profiler::record( "PeriodicThread callback", start_time, end_time,
+                        handle );
+    }
+
+    // the callback might have removed itself, in which case the slot
+    // no longer belongs to it.
+    if( entries[i].func ) {
+      Slot &slot = getSlot( entries[i].handle & HANDLE_INDEX_MASK );
+      Atomic::increment( &slot.stats_sequence );
+      slot.stats.nr_calls++;
+      slot.stats.total_time += time;
+      if( time > slot.stats.max_time ) slot.stats.max_time = time;
+      Atomic::increment( &slot.stats_sequence );
+
+      if( code == PeriodicThreadBase::CALLBACK_DONE ) {
+        entries[i].func = NULL;
+        ++nr_removed_entries;
+        freeSlot( entries[i].handle & HANDLE_INDEX_MASK );
+      }
+    }
+  }
+  if( nr_removed_entries > 0 ) compact();
+}
+
+void CallbackTable::getStatistics( std::vector< Statistics > &stats ) {
+  stats.clear();
+  // chunks are never deallocated while the table exists so all slots
+  // up to nr_chunks can be read.
+  int nr_slots = Atomic::load( &nr_chunks ) * CHUNK_SIZE;
+  for( int i = 0; i < nr_slots; ++i ) {
+    Slot &slot = getSlot( i );
+    Statistics s;
+    int sequence;
+    do {
+      sequence = Atomic::load( &slot.stats_sequence );
+      s = slot.stats;
+      Atomic::memoryBarrier();
+    } while( ( sequence & 1 ) || sequence != slot.stats_sequence );
+    if( s.handle != -1 ) stats.push_back( s );
+  }
+}
+
+void CallbackTable::compact() {
+  size_t j = 0;
+  for( size_t i = 0; i < entries.size(); ++i ) {
+    if( entries[i].func ) {
+      if( i != j ) {
+        entries[j] = entries[i];
+        getSlot( entries[j].handle & HANDLE_INDEX_MASK ).position = (int) j;
+      }
+      ++j;
+    }
+  }
+  entries.resize( j );
+  nr_removed_entries = 0;
+}
+
+HapticThreadBase::HapticThreadBase() : pause_requested( 0 ) {
+  threads_lock.lock();
+  threads.push_back( this );
+  threads_lock.unlock();
 }
 
 HapticThreadBase::~HapticThreadBase() {
+  removeHapticThread();
+}
+
+void HapticThreadBase::removeHapticThread() {
+  // A synchronization in progress might wait for this thread, so wait
+  // for it to finish before removing the thread.
   sg_lock.lock();
+  threads_lock.lock();
   vector< HapticThreadBase *>::iterator i = 
     std::find( threads.begin(), 
                threads.end(), 
@@ -557,72 +1194,106 @@ HapticThreadBase::~HapticThreadBase() {
   if( i != threads.end() ) {
     threads.erase( i );
   }
+  threads_lock.unlock();
   sg_lock.unlock();
 }
 
+HapticThreadBase *HapticThreadBase::getCurrentHapticThread() {
+  pthread_once( &ThreadsInternal::haptic_thread_key_once,
+                ThreadsInternal::createHapticThreadKey );
+  void *value = pthread_getspecific( ThreadsInternal::haptic_thread_key );
+  if( !value ) {
+    PeriodicThread::ThreadId id = PeriodicThread::getCurrentThreadId();
+    value = ThreadsInternal::NOT_HAPTIC_THREAD;
+    threads_lock.lock();
+    for( vector< HapticThreadBase *>::iterator i = threads.begin();
+         i != threads.end(); i++ ) {
+      ThreadBase *thread = dynamic_cast< ThreadBase * >( *i );
+      if( thread && pthread_equal( thread->getThreadId(), id ) ) {
+        value = *i;
+        break;
+      }
+    }
+    threads_lock.unlock();
+    pthread_setspecific( ThreadsInternal::haptic_thread_key, value );
+  }
+  if( value == ThreadsInternal::NOT_HAPTIC_THREAD ) return NULL;
+  return (HapticThreadBase *) value;
+}
 
 bool HapticThreadBase::inHapticThread() {
-  PeriodicThread::ThreadId id = PeriodicThread::getCurrentThreadId();
-  for( vector< HapticThreadBase *>::iterator i = threads.begin();
-       i != threads.end(); i++ ) {
-    ThreadBase *thread = dynamic_cast< ThreadBase * >( *i );
-    if( thread && pthread_equal( thread->getThreadId(), id ) )
-      return true;
-  }
-  return false;
+  return getCurrentHapticThread() != NULL;
 }
 
-PeriodicThreadBase::CallbackCode HapticThreadBase::sync_haptics( void * ) {
-  sg_lock.lock();
-  haptic_threads_left--;
-  if( haptic_threads_left == 0 ) {
-    sg_lock.signal();
-    sg_lock.wait();
-    sg_lock.unlock();
-    haptic_lock.lock();
-    haptic_lock.broadcast();
-    haptic_lock.unlock();
-  } else {
-    sg_lock.unlock();
-    haptic_lock.lock();
-    haptic_lock.wait();
-    haptic_lock.unlock();
+void HapticThreadBase::setInHapticThread() {
+  pthread_once( &ThreadsInternal::haptic_thread_key_once,
+                ThreadsInternal::createHapticThreadKey );
+  pthread_setspecific( ThreadsInternal::haptic_thread_key, this );
+}
+
+PeriodicThreadBase::CallbackCode
+HapticThreadBase::markHapticThread( void *data ) {
+  static_cast< HapticThreadBase * >( data )->setInHapticThread();
+  return PeriodicThreadBase::CALLBACK_DONE;
+}
+
+void HapticThreadBase::pauseIfRequested() {
+  if( Atomic::load( &pause_requested ) ) {
+    Atomic::store( &pause_requested, 0 );
+    // Wait for all haptic threads to be paused and then for the callback
+    // function to finish.
+    sync_barrier.wait();
+    sync_barrier.wait();
   }
-  
+}
+
+PeriodicThreadBase::CallbackCode HapticThreadBase::sync_haptics( void *data ) {
+  static_cast< HapticThreadBase * >( data )->pauseIfRequested();
   return PeriodicThreadBase::CALLBACK_DONE;
 }
+
 void HapticThreadBase::synchronousHapticCB(
                         PeriodicThreadBase::CallbackFunc func, 
                         void *data ) {
-  // add empty callbacks in order to make sure that the haptics threads 
-  // have released the callback_lock since last call to sync_haptics.
+  HapticThreadBase *current = getCurrentHapticThread();
+  if( current ) {
+    // A synchronization in progress might wait for this thread, so it
+    // has to pause while waiting instead of in its sync_haptics callback.
+    while( !sg_lock.tryLock() ) {
+      current->pauseIfRequested();
+      sched_yield();
+    }
+  } else {
+    sg_lock.lock();
+  }
+
+  // The calling thread is not paused if it is a haptic thread. Haptic
+  // threads that are not PeriodicThreadBase instances cannot be paused.
+  vector< HapticThreadBase * > to_pause;
+  threads_lock.lock();
   for( vector< HapticThreadBase *>::iterator i = threads.begin();
        i != threads.end(); i++ ) {
-    PeriodicThreadBase *thread = dynamic_cast< PeriodicThreadBase * >( *i );
-    if( thread ) {
-      thread->asynchronousCallback( ThreadsInternal::doNothing, NULL );
-
+    if( *i != current && dynamic_cast< PeriodicThreadBase * >( *i ) ) {
+      to_pause.push_back( *i );
     }
   }
-  sg_lock.lock(); 
-  haptic_threads_left = (int) threads.size();
-  if( haptic_threads_left > 0 ) {
-    for( vector< HapticThreadBase *>::iterator i = threads.begin();
-         i != threads.end(); i++ ) {
-      PeriodicThreadBase *thread = dynamic_cast< PeriodicThreadBase * >( *i );
-      if( thread ) {
-        thread->asynchronousCallback( sync_haptics, NULL );
-      }
-    }
-    sg_lock.wait();
-    func( data );
-    sg_lock.signal();
+  threads_lock.unlock();
 
+  if( to_pause.empty() ) {
+    func( data );
   } else {
+    sync_barrier.setNrThreads( (unsigned int) to_pause.size() + 1 );
+    for( vector< HapticThreadBase * >::iterator i = to_pause.begin();
+         i != to_pause.end(); i++ ) {
+      Atomic::store( &(*i)->pause_requested, 1 );
+      dynamic_cast< PeriodicThreadBase * >( *i )->
+        asynchronousCallback( sync_haptics, *i );
+    }
+    sync_barrier.wait();
     func( data );
+    sync_barrier.wait();
   }
   sg_lock.unlock();
-  sched_yield();
 }
 
 ThreadBase::ThreadId ThreadBase::getCurrentThreadId() {
@@ -643,6 +1314,7 @@ typedef struct tagTHREADNAME_INFO {
 #endif
 
 void ThreadBase::setThreadName( ThreadId thread_id, const string &name ) {
+  Profiler::setThreadName( thread_id, name );
 
 #ifdef _MSC_VER
  Sleep(10);
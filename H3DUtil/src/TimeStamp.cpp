@@ -29,40 +29,79 @@
 
 #include <H3DUtil/TimeStamp.h>
 
+#ifdef H3D_LINUX
+#include <time.h>
+#endif
+
+#ifdef MACOSX
+#include <mach/mach_time.h>
+#endif
+
 using namespace H3DUtil;
 
-#ifdef WIN32
 bool TimeStamp::init_done = false;
 double TimeStamp::start_time = 0;
-LARGE_INTEGER TimeStamp::start_perf_count;
+H3DInt64 TimeStamp::start_nanoseconds = 0;
+#ifdef WIN32
 LARGE_INTEGER TimeStamp::perf_freq;
 #endif
 
-
-#ifdef WIN32
 double TimeStamp::getCurrentTime() {
+  // The first call is made during static initialization by Console, so
+  // no locking is needed.
   if( !init_done ) {
-    struct __timeb64 timebuffer;
-    _ftime64( &timebuffer );
-    start_time = timebuffer.time + timebuffer.millitm / 1e3;
-    if( !QueryPerformanceCounter( &start_perf_count ) ) {
+    start_nanoseconds = getMonotonicNanoseconds();
+    start_time = getWallClockTime();
+    init_done = true;
+  }
+  return start_time + 
+    ( getMonotonicNanoseconds() - start_nanoseconds ) * 1e-9;
+}
+
+#ifdef WIN32
+H3DInt64 TimeStamp::getMonotonicNanoseconds() {
+  if( perf_freq.QuadPart == 0 ) {
+    if( !QueryPerformanceFrequency( &perf_freq ) ) {
       throw PerformanceCounterNotSupported( "", H3D_FULL_LOCATION );
     }
-    QueryPerformanceFrequency( &perf_freq );
-    init_done = true;
   }
-  LARGE_INTEGER current_count;
-  QueryPerformanceCounter( &current_count );
-  
-  LARGE_INTEGER diff;
-  diff.QuadPart = current_count.QuadPart - start_perf_count.QuadPart;
-  double seconds_since_start = 
-    (double)diff.QuadPart / (double)perf_freq.QuadPart;
-  return start_time + seconds_since_start;
+  LARGE_INTEGER count;
+  QueryPerformanceCounter( &count );
+  // Split the conversion to avoid overflowing when multiplying the count.
+  H3DInt64 seconds = count.QuadPart / perf_freq.QuadPart;
+  H3DInt64 rest = count.QuadPart % perf_freq.QuadPart;
+  return seconds * 1000000000 + rest * 1000000000 / perf_freq.QuadPart;
+}
+
+double TimeStamp::getWallClockTime() {
+  struct __timeb64 timebuffer;
+  _ftime64( &timebuffer );
+  return timebuffer.time + timebuffer.millitm / 1e3;
 }
 #else
 #ifdef HAVE_SYS_TIME_H
-double TimeStamp::getCurrentTime() {
+#if defined( H3D_LINUX )
+H3DInt64 TimeStamp::getMonotonicNanoseconds() {
+  timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return (H3DInt64) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+#elif defined( MACOSX )
+H3DInt64 TimeStamp::getMonotonicNanoseconds() {
+  static mach_timebase_info_data_t timebase = { 0, 0 };
+  if( timebase.denom == 0 ) mach_timebase_info( &timebase );
+  return (H3DInt64)( mach_absolute_time() * timebase.numer / timebase.denom );
+}
+#else
+H3DInt64 TimeStamp::getMonotonicNanoseconds() {
+  // No monotonic clock known, use the system clock.
+  struct timeval tp;
+  gettimeofday( &tp, NULL );
+  return (H3DInt64) tp.tv_sec * 1000000000 + (H3DInt64) tp.tv_usec * 1000;
+}
+#endif
+
+double TimeStamp::getWallClockTime() {
   struct timeval tp;
   struct timezone tzp;
   gettimeofday( &tp, &tzp );